@@ -0,0 +1,23 @@
+/**
+ * Contains the bit-packed grid representation and the bit-parallel kernel for stepping Moore-neighbourhood rules 64
+ * cells at a time.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_BITPACK_H
+#define CONWAY_BITPACK_H
+
+#include "environment.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Bitmask with bit n set, for building the birth and survival masks of a rule from neighbour counts. */
+#define NEIGHBOURS(n) (1u << (n))
+
+void bitpack_sync(Environment *env);
+void bitpack_unpack(Environment *env);
+void bitpack_unpack_tiles(Environment *env, uint32_t first_tx, uint32_t end_tx, uint32_t first_ty, uint32_t end_ty);
+uint32_t bitpack_moore_block(Environment *env, uint32_t birth, uint32_t survive, uint32_t first_row, uint32_t end_row,
+                             uint32_t first_word, uint32_t end_word, bool *changed);
+
+#endif // CONWAY_BITPACK_H
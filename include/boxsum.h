@@ -0,0 +1,20 @@
+/**
+ * Contains the kernel for counting neighbours in the included neighbourhoods out of running box sums, so that each
+ * count costs the same no matter how large the neighbourhood is.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_BOXSUM_H
+#define CONWAY_BOXSUM_H
+
+#include "environment.h"
+#include "neighbourhoods.h"
+#include "rules.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+bool boxsum_supports(Neighbourhood const *neighbourhood);
+uint32_t boxsum_block(Environment *env, CellType const *cell_type, uint32_t first_row, uint32_t end_row,
+                      uint32_t first_col, uint32_t end_col, bool *changed);
+
+#endif // CONWAY_BOXSUM_H
@@ -0,0 +1,37 @@
+/**
+ * Contains the binary checkpoint format for saving and restoring a simulation, and a background thread for writing
+ * checkpoints periodically without holding up the simulation.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_CHECKPOINT_H
+#define CONWAY_CHECKPOINT_H
+
+#include "environment.h"
+#include "rules.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/** The version of the checkpoint format written, which restoring must match. */
+#define CHECKPOINT_VERSION 2
+/** The longest cell type name, rulestring or neighbourhood name stored in a checkpoint, including the terminator. */
+#define CHECKPOINT_NAME_LENGTH 64
+/** Flag set when the grid is stored with runs of empty words left out (see checkpoint_write). */
+#define CHECKPOINT_COMPRESSED 1u
+
+/** A copy of a simulation taken at one generation, ready to be written to disk. */
+typedef struct checkpoint_image CheckpointImage;
+
+typedef struct checkpointer Checkpointer;
+
+CheckpointImage *checkpoint_capture(Environment *env, CellType const *cell_type);
+void checkpoint_free(CheckpointImage *image);
+bool checkpoint_write(CheckpointImage const *image, char const *path, bool compress);
+bool checkpoint_save(Environment *env, CellType const *cell_type, char const *path, bool compress);
+Environment *checkpoint_restore(char const *path, CellType *cell_type, char rulestring[CHECKPOINT_NAME_LENGTH]);
+
+Checkpointer *checkpointer_init(char const *path, uint64_t interval);
+void checkpointer_destroy(Checkpointer *checkpointer);
+void checkpointer_update(Checkpointer *checkpointer, Environment *env, CellType const *cell_type);
+
+#endif // CONWAY_CHECKPOINT_H
@@ -0,0 +1,62 @@
+/**
+ * Contains the detection of simulations which have settled into a still life or oscillator, by remembering the hash
+ * of the grid at each generation and watching for repeats.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_CYCLES_H
+#define CONWAY_CYCLES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** The number of generations remembered by the history table (must be a power of 2). */
+#define CYCLE_HISTORY 4096
+
+/** What to do once a simulation is confirmed to be repeating itself. */
+typedef enum {
+    CYCLE_CONTINUE = 0, /**< Keep simulating. */
+    CYCLE_PAUSE,        /**< Pause the simulation. */
+    CYCLE_FAST_FORWARD, /**< Skip over whole periods instead of calculating them. */
+} CycleAction;
+
+/** A generation remembered by the history table. */
+typedef struct {
+    uint64_t hash;       /**< The hash of the grid. */
+    uint64_t generation; /**< The generation which had the hash. */
+    uint64_t epoch;      /**< The epoch the entry was recorded in, entries from other epochs are ignored. */
+} CycleEntry;
+
+/** Watches the hashes of successive generations for a repeat. */
+typedef struct {
+    CycleEntry *history;           /**< Direct-mapped table of the generations seen, indexed by hash. */
+    uint64_t epoch;                /**< Incremented to forget the history when the simulation is edited. */
+    uint64_t candidate_hash;       /**< The hash of a generation which has been seen before. */
+    uint64_t candidate_generation; /**< The generation at which the candidate was seen again. */
+    uint64_t candidate_start;      /**< The generation at which the candidate was first seen. */
+    bool confirmed;                /**< Whether the candidate has repeated twice, so the simulation is repeating. */
+    bool refining;                 /**< Whether consecutive generations are being checked for a shorter period. */
+    uint64_t confirmed_hash;       /**< The hash of the generation at which the cycle was confirmed. */
+    uint64_t confirmed_generation; /**< The generation at which the cycle was confirmed. */
+    uint64_t last_generation;      /**< The last generation recorded. */
+} CycleDetector;
+
+void cycle_init(CycleDetector *detector);
+void cycle_destroy(CycleDetector *detector);
+void cycle_reset(CycleDetector *detector);
+bool cycle_record(CycleDetector *detector, uint64_t hash, uint64_t generation, uint64_t *start, uint32_t *period);
+
+/**
+ * Defined here so that the grid's hash can be updated without a call for every cell.
+ * @param index The index of a cell in the grid
+ * @return The random key XORed into the hash of a grid while the cell is alive
+ */
+static inline uint64_t cycle_cell_key(uint64_t index) {
+    // SplitMix64 finalizer, so keys need no table
+    uint64_t key = index + 0x9E3779B97F4A7C15ULL;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+    return key ^ (key >> 31);
+}
+
+#endif // CONWAY_CYCLES_H
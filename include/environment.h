@@ -7,32 +7,100 @@
 #ifndef CONWAY_ENVIRONMENT_H
 #define CONWAY_ENVIRONMENT_H
 
+#include "cycles.h"
+#include "workers.h"
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/** Width of the ring of wrapped cells around the grid, which must cover the radius of the largest neighbourhood. */
+#define ENV_HALO 2
+
+/** Width of the tiles which the grid is split into for skipping inactive regions. Matches the bit-packed words. */
+#define ENV_TILE_WIDTH 64
+/** Height of the tiles which the grid is split into for skipping inactive regions. */
+#define ENV_TILE_HEIGHT 32
+
+/** The number of steps the population is remembered for in the simulation analytics. */
+#define ANALYTICS_HISTORY 64
+
+/** The population after each of the most recent steps of a simulation. */
+typedef struct {
+    uint32_t counts[ANALYTICS_HISTORY]; /**< The populations, oldest first once full. */
+    uint32_t length;                    /**< The number of steps remembered, at most ANALYTICS_HISTORY. */
+} PopulationHistory;
+
 /** Bundle of simulation analytics data. */
 typedef struct {
-    uint32_t total_cells;      /**< The total number of cells in the simulation grid at a given time. */
-    uint32_t initial_cells;    /**< The number of initial cells (user drawn) in the simulation. */
-    uint64_t generations;      /**< The number of generations that have passed. */
-    uint16_t generation_speed; /**< The speed of each generation in milliseconds. */
+    uint32_t total_cells;         /**< The total number of cells in the simulation grid at a given time. */
+    uint32_t initial_cells;       /**< The number of initial cells (user drawn) in the simulation. */
+    uint64_t generations;         /**< The number of generations that have passed. */
+    uint32_t generation_period;   /**< The length of each generation in microseconds, 0 for as fast as possible. */
+    double generation_rate;       /**< The number of generations calculated per second, measured while playing. */
+    uint64_t stable_generation;   /**< The generation at which the simulation started repeating itself. */
+    uint32_t period;              /**< The period the simulation repeats with (1 for a still life), 0 until it does. */
+    bool extended;                /**< Whether the analytics below were collected with the last step. */
+    uint32_t births;              /**< The number of cells born in the last step. */
+    uint32_t deaths;              /**< The number of cells which died in the last step. */
+    uint32_t step;                /**< The number of generations the last step covered. */
+    uint32_t box_x;               /**< The first column of the smallest rectangle holding every living cell. */
+    uint32_t box_y;               /**< The first row of the smallest rectangle holding every living cell. */
+    uint32_t box_width;           /**< The width of the rectangle holding every living cell, 0 if none are. */
+    uint32_t box_height;          /**< The height of the rectangle holding every living cell, 0 if none are. */
+    uint32_t regions;             /**< The number of regions (tiles) the grid is split into. */
+    uint32_t live_regions;        /**< The number of regions with any living cell. */
+    uint32_t densest_region;      /**< The living cells in the region with the largest share of its cells alive. */
+    uint32_t densest_area;        /**< The number of cells in that region, smaller for the regions on the edges. */
+    PopulationHistory population; /**< The population after each of the most recent steps. */
 } SimulationAnalytics;
 
 /** Represents the simulation environment. */
 typedef struct environment {
-    uint32_t width;           /**< The width of the simulation grade. */
-    uint32_t height;          /**< The height of the simulation grid. */
-    SimulationAnalytics data; /**< The simulation analytics corresponding to this environment. */
-    bool *grid;               /**< The current cell grid. */
-    bool *_next_generation;   /**< The cell grid for placing the next calculated grid. */
+    uint32_t width;             /**< The width of the simulation grade. */
+    uint32_t height;            /**< The height of the simulation grid. */
+    uint32_t stride;            /**< The distance between rows of the grid, including the halo on either side. */
+    SimulationAnalytics data;   /**< The simulation analytics corresponding to this environment. */
+    bool *grid;                 /**< The current cell grid, pointing at cell (0, 0) inside the halo. */
+    bool *_next_generation;     /**< The cell grid for placing the next calculated grid, laid out like `grid`. */
+    uint32_t row_words;         /**< The number of 64-bit words in each row of the bit-packed grid. */
+    uint64_t *packed;           /**< The current cell grid, bit-packed with 64 cells per word. */
+    uint64_t *_next_packed;     /**< The bit-packed grid for placing the next calculated grid. */
+    bool packed_stale;          /**< True if `grid` has changed since `packed` was last synchronized with it. */
+    bool grid_stale;            /**< True if `packed` has changed since `grid` was last synchronized with it. */
+    bool *tile_stale;           /**< Whether each tile of `grid` is behind `packed` (see bitpack_unpack). */
+    bool stepped_packed;        /**< Whether the last generation was calculated on the bit-packed grids. */
+    bool packed_kernel;         /**< Whether cell types which support it are stepped with the bit-packed kernel. */
+    bool analytics;             /**< Whether the extended analytics are collected while calculating generations. */
+    WorkerPool *workers;        /**< The threads which share the work of calculating each generation. */
+    uint32_t tiles_x;           /**< The number of columns of tiles. */
+    uint32_t tiles_y;           /**< The number of rows of tiles. */
+    bool *tile_changed;         /**< Whether any cell of each tile changed in the last step (or was edited). */
+    bool *_next_tile_changed;   /**< Tile change flags for the generation being calculated. */
+    bool *tile_dirty;           /**< Whether each tile changed since the flags were last collected and cleared. */
+    bool _next_behind;          /**< True if the next generation grids are several generations behind the current. */
+    uint32_t *tile_population;  /**< The number of living cells in each tile as of the last generation. */
+    uint64_t _step_signature;   /**< Identifies the rule and kernel of the last generation, see next_generation. */
+    bool *_block_scratch;       /**< Scratch grids kept between calls to block_generations, NULL until first used. */
+    size_t _block_scratch_size; /**< The number of cells in `_block_scratch`. */
+    uint64_t hash;              /**< The hash of the grid, XORing a key (see cycle_cell_key) for each living cell. */
+    CycleDetector cycles;       /**< Watches the hash of each generation for the simulation repeating itself. */
 } Environment;
 
-Environment *env_init(uint32_t width, uint32_t height, uint16_t generation_speed);
+Environment *env_init(uint32_t width, uint32_t height, uint32_t generation_period);
 void env_destroy(Environment *env);
 void env_clear(Environment *env);
 bool env_access(Environment const *env, uint32_t x, uint32_t y);
 void env_write(Environment *env, uint32_t x, uint32_t y, bool value);
+uint32_t env_fill_run(Environment *env, uint32_t x, uint32_t y, uint32_t length);
 bool env_in_bounds(Environment const *env, uint32_t x, uint32_t y);
 bool env_toggle_cell(Environment *env, uint32_t x, uint32_t y);
+void env_refresh_halo(Environment *env);
+void env_mark_all_changed(Environment *env);
+bool env_tile_active(Environment const *env, uint32_t tx, uint32_t ty);
+void env_forget_cycle(Environment *env);
+void env_unpack(Environment *env);
+uint64_t env_hash_changes(Environment const *env, uint32_t first_row, uint32_t end_row, uint32_t first_col,
+                          uint32_t end_col, bool packed, uint32_t changes[2]);
+void env_collect_analytics(Environment *env, uint32_t births, uint32_t deaths, uint32_t step);
 
 #endif // CONWAY_ENVIRONMENT_H
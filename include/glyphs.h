@@ -0,0 +1,27 @@
+/**
+ * Contains the drawing of text from a glyph atlas. Every printable ASCII character is rasterised once into a single
+ * texture, and text is drawn as a batch of textured quads from it, laid out again only when the text changes.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_GLYPHS_H
+#define CONWAY_GLYPHS_H
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+/** The first character in the atlas. */
+#define GLYPHS_FIRST ' '
+/** The last character in the atlas. Characters outside the atlas are drawn as GLYPHS_MISSING. */
+#define GLYPHS_LAST '~'
+/** The character drawn in place of one which is not in the atlas. */
+#define GLYPHS_MISSING '?'
+
+typedef struct glyph_atlas GlyphAtlas;
+
+GlyphAtlas *glyphs_init(SDL_Renderer *renderer, TTF_Font *font);
+void glyphs_destroy(GlyphAtlas *atlas);
+void glyphs_layout(GlyphAtlas *atlas, char const *text, int x, int y, int wrap_width, SDL_Color colour);
+void glyphs_draw(GlyphAtlas const *atlas);
+
+#endif // CONWAY_GLYPHS_H
@@ -0,0 +1,26 @@
+/**
+ * Contains a HashLife engine for Conway's Game of Life (B3/S23 in the Moore neighbourhood), which jumps the simulation
+ * forward by exponentially many generations at a time using a memoised quadtree.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_HASHLIFE_H
+#define CONWAY_HASHLIFE_H
+
+#include "environment.h"
+#include <stdint.h>
+
+/** The largest number of generations (as a power of 2) which can be jumped in a single step. */
+#define HASHLIFE_MAX_STEP_LOG2 48
+
+typedef struct hashlife HashLife;
+
+HashLife *hashlife_init(void);
+void hashlife_destroy(HashLife *hl);
+void hashlife_import(HashLife *hl, Environment const *env);
+void hashlife_step(HashLife *hl, unsigned int log2_generations);
+uint64_t hashlife_population(HashLife const *hl);
+uint32_t hashlife_export(HashLife const *hl, Environment *env);
+uint64_t hashlife_jump(HashLife *hl, Environment *env, uint64_t generations);
+
+#endif // CONWAY_HASHLIFE_H
@@ -0,0 +1,32 @@
+/**
+ * Contains the history of recent generations, for stepping the simulation backwards. Each generation is stored as the
+ * list of cells which changed since the one before, so going back a generation toggles those cells again. A copy of
+ * the whole grid is kept every so often, so that distant generations can be reached without replaying every change.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_HISTORY_H
+#define CONWAY_HISTORY_H
+
+#include "environment.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** The largest number of generations remembered (must be a power of 2). */
+#define HISTORY_GENERATIONS 65536
+/** The number of generations between copies of the whole grid. */
+#define HISTORY_KEYFRAME_INTERVAL 256
+/** The default number of bytes of changed cells and grid copies held before the oldest generations are dropped. */
+#define HISTORY_MEMORY ((size_t)64 << 20)
+
+typedef struct history History;
+
+History *history_init(size_t memory);
+void history_destroy(History *history);
+void history_record(History *history, Environment *env);
+bool history_back(History *history, Environment *env);
+bool history_forward(History *history, Environment *env);
+bool history_seek(History *history, Environment *env, uint64_t generation);
+
+#endif // CONWAY_HISTORY_H
@@ -0,0 +1,15 @@
+/**
+ * Contains a helper for reading whole files through a memory mapping, for the loaders which parse a file in one pass.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_MAPFILE_H
+#define CONWAY_MAPFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool map_file(char const *path, char const **contents, size_t *length);
+void unmap_file(char const *contents, size_t length);
+
+#endif // CONWAY_MAPFILE_H
@@ -9,6 +9,7 @@
 
 #include "environment.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 /** Represents a coordinate in the 2D plane. */
 typedef struct coord {
@@ -16,6 +17,9 @@ typedef struct coord {
     int32_t y; /**< The y component of the coordinate. */
 } Coordinate;
 
+/** The size of the largest neighbourhood. */
+#define MAX_NEIGHBOURHOOD 24
+
 /** Represents a cell's neighbourhood. */
 typedef struct neighbourhood {
     uint8_t size;            /**< The number of grid cells in the neighbourhood. */
@@ -51,6 +55,9 @@ extern const Neighbourhood VON_NEUMANN_R2;
 extern const Neighbourhood TRIPLE_MOORE;
 extern const Neighbourhood TRIPLE_MOORE_CORNER;
 
+Neighbourhood const *neighbourhood_by_name(char const *name);
+char const *neighbourhood_name(Neighbourhood const *neighbourhood);
+uint32_t neighbourhood_radius(Neighbourhood const *neighbourhood);
 Coordinate translate(Coordinate coord, int32_t x, int32_t y);
 void translate_coordinates(Coordinate *coords, size_t len, int32_t x, int32_t y);
 Coordinate wrap(Environment const *env, Coordinate coord);
@@ -0,0 +1,42 @@
+/**
+ * Contains logic for loading patterns from disk into the simulation environment. Plaintext (.cells), RLE and Macrocell
+ * files are supported, and are parsed straight out of a memory mapping of the file.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_PATTERNS_H
+#define CONWAY_PATTERNS_H
+
+#include "environment.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** The number of cells collected before they are placed into the grid together. */
+#define PATTERN_BATCH 4096
+/** The largest Macrocell level accepted, which keeps every coordinate of the pattern within 64 bits. */
+#define PATTERN_MAX_LEVEL 62
+
+/** The file formats a pattern can be stored in. */
+typedef enum {
+    PATTERN_PLAINTEXT, /**< Rows of '.' and 'O', with '!' comment lines. */
+    PATTERN_RLE,       /**< Run-length encoded rows following an `x = m, y = n` header. */
+    PATTERN_MACROCELL, /**< The quadtree of a HashLife universe, one node per line. */
+} PatternFormat;
+
+/** A pattern file, mapped into memory. */
+typedef struct pattern {
+    PatternFormat format; /**< The format the pattern is stored in. */
+    char const *text;     /**< The contents of the file. */
+    size_t length;        /**< The length of the file in bytes. */
+    size_t body;          /**< The offset of the first cell (or node) past any header and comments. */
+    uint64_t width;       /**< The width of the pattern's bounding box. */
+    uint64_t height;      /**< The height of the pattern's bounding box. */
+} Pattern;
+
+bool pattern_open(Pattern *pattern, char const *path);
+void pattern_close(Pattern *pattern);
+bool pattern_place(Pattern const *pattern, Environment *env, int32_t x, int32_t y);
+bool pattern_load(Environment *env, char const *path);
+
+#endif // CONWAY_PATTERNS_H
@@ -0,0 +1,60 @@
+/**
+ * Contains the instrumentation of the hot paths, which times each phase of a frame and of a generation. Only built in
+ * with `make PROFILE=1` (which defines CONWAY_PROFILE); otherwise PROFILE_SCOPE compiles to nothing.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_PROFILE_H
+#define CONWAY_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** The number of most recent times of each phase which its percentiles are taken over. */
+#define PROFILE_WINDOW 1024
+
+/** The phases timed. Each is only ever timed from one thread. */
+typedef enum {
+    PROFILE_EVENTS,     /**< Handling one of the display's events (display thread). */
+    PROFILE_UPLOAD,     /**< Writing the frame into the cell texture and copying it to the screen (display thread). */
+    PROFILE_TEXT,       /**< Formatting, laying out and drawing the overlay text (display thread). */
+    PROFILE_PRESENT,    /**< Presenting what was drawn, including waiting for vsync (display thread). */
+    PROFILE_FRAME,      /**< A whole frame, from clearing the screen to presenting it (display thread). */
+    PROFILE_COMMANDS,   /**< Applying a command from the display (simulation thread). */
+    PROFILE_GENERATION, /**< Calculating a generation, or a block of them (simulation thread). */
+    PROFILE_PUBLISH,    /**< Copying a generation into a frame for the display (simulation thread). */
+    PROFILE_PHASES,     /**< The number of phases. */
+} ProfilePhase;
+
+#ifdef CONWAY_PROFILE
+
+uint64_t profile_now(void);
+void profile_record(ProfilePhase phase, uint64_t nanoseconds);
+void profile_format(char **string);
+bool profile_dump(char const *path);
+
+/** A phase being timed until the end of the enclosing block. */
+typedef struct {
+    ProfilePhase phase; /**< The phase. */
+    uint64_t start;     /**< When the phase started, from profile_now. */
+} ProfileScope;
+
+/**
+ * Records the time of a scope as it ends.
+ * @param scope The scope
+ */
+static inline void profile_scope_end(ProfileScope const *scope) {
+    profile_record(scope->phase, profile_now() - scope->start);
+}
+
+/** Times the rest of the enclosing block as a phase. */
+#define PROFILE_SCOPE(phase)                                                                                           \
+    ProfileScope profile_scope_##phase __attribute__((cleanup(profile_scope_end))) = {(phase), profile_now()}
+
+#else
+
+#define PROFILE_SCOPE(phase) (void)0
+
+#endif // CONWAY_PROFILE
+
+#endif // CONWAY_PROFILE_H
@@ -0,0 +1,24 @@
+/**
+ * Contains the density pyramid of a grid, which holds the share of living cells in every 2x2, 4x4, 8x8 and so on
+ * block of cells, for drawing the grid zoomed out below one pixel per cell.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_PYRAMID_H
+#define CONWAY_PYRAMID_H
+
+#include "environment.h"
+#include <stdint.h>
+
+/** The number of levels above the grid, where level n averages blocks of 2^n x 2^n cells. */
+#define PYRAMID_LEVELS 8
+
+typedef struct density_pyramid DensityPyramid;
+
+DensityPyramid *pyramid_init(Environment const *env);
+void pyramid_destroy(DensityPyramid *pyramid);
+void pyramid_mark(DensityPyramid *pyramid, Environment const *env);
+void pyramid_update(DensityPyramid *pyramid, Environment *env);
+uint8_t const *pyramid_level(DensityPyramid const *pyramid, unsigned int level, uint32_t *width, uint32_t *height);
+
+#endif // CONWAY_PYRAMID_H
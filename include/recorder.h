@@ -0,0 +1,36 @@
+/**
+ * Contains the recorder, which saves each generation shown to a Y4M video or a sequence of PNG images. Encoding and
+ * writing happen on a background thread, so recording never holds up the simulation or the display.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_RECORDER_H
+#define CONWAY_RECORDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** The default number of bytes of frames waiting to be written before new frames are dropped. */
+#define RECORDER_MEMORY ((size_t)256 << 20)
+/** The largest number of frames waiting to be written. */
+#define RECORDER_MAX_FRAMES 1024
+/** The frame rate written in the header of a Y4M video. */
+#define RECORDER_FRAME_RATE 30
+
+/** The formats a recording can be written in. */
+typedef enum {
+    RECORD_PNG, /**< One 1-bit PNG image per frame, named by the generation. */
+    RECORD_Y4M, /**< A single uncompressed YUV4MPEG2 (4:4:4) video. */
+} RecordFormat;
+
+typedef struct recorder Recorder;
+
+Recorder *recorder_init(char const *path, uint32_t width, uint32_t height, size_t memory);
+void recorder_destroy(Recorder *recorder);
+bool recorder_capture(Recorder *recorder, uint64_t const *cells, int64_t x0, int64_t y0, uint32_t width,
+                      uint32_t height, uint64_t generation, uint64_t hash, uint32_t alive, uint32_t dead);
+uint64_t recorder_dropped(Recorder const *recorder);
+uint64_t recorder_skipped(Recorder const *recorder);
+
+#endif // CONWAY_RECORDER_H
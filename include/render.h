@@ -0,0 +1,22 @@
+/**
+ * Contains the drawing of the simulation grid. The grid is expanded into the pixels of a streaming texture with one
+ * pixel per cell, which the GPU scales up to the zoom level in a single copy. The texture is kept between frames, and
+ * only the tiles of the grid which changed are written into it again.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_RENDER_H
+#define CONWAY_RENDER_H
+
+#include "simulation.h"
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+
+typedef struct cell_renderer CellRenderer;
+
+CellRenderer *render_init(SDL_Renderer *renderer);
+void render_destroy(CellRenderer *cells);
+bool render_frame(CellRenderer *cells, SimulationFrame const *frame, int x_offset, int y_offset, SDL_Color alive,
+                  SDL_Color dead);
+
+#endif // CONWAY_RENDER_H
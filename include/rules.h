@@ -8,49 +8,95 @@
 #ifndef CONWAY_RULES_H
 #define CONWAY_RULES_H
 
+#include "bitpack.h"
 #include "environment.h"
 #include "neighbourhoods.h"
-#include <SDL2/SDL.h>
+
+/** The width of the blocks which step_generations calculates several generations of at a time. */
+#define TEMPORAL_BLOCK_WIDTH 256
+/** The height of the blocks which step_generations calculates several generations of at a time. */
+#define TEMPORAL_BLOCK_HEIGHT 128
+/** The most generations step_generations calculates of a block at a time. */
+#define TEMPORAL_BLOCK_DEPTH 8
+/** Grids with fewer cells than this stay in cache from one generation to the next, so are not worth blocking. */
+#define TEMPORAL_MIN_CELLS (1u << 21)
 
 typedef bool (*StateCalculator)(Environment const *, uint32_t, uint32_t);
 
+/** A Life-like (outer totalistic) rule compiled from a B/S rulestring into a branch-free lookup table. */
+typedef struct life_rule {
+    uint32_t birth;                      /**< Neighbour counts (bitmask) which cause a dead cell to be born. */
+    uint32_t survive;                    /**< Neighbour counts (bitmask) which allow a living cell to survive. */
+    bool table[2][MAX_NEIGHBOURHOOD + 1]; /**< The next state of a cell, indexed by its state and neighbour count. */
+} LifeRule;
+
+/** The size of the largest closest part of a neighbourhood counted separately by a SplitRule. */
+#define MAX_CLOSEST 8
+
+/**
+ * Calculates the next state of a cell from the number of living cells in its neighbourhood and in the closest part of
+ * its neighbourhood.
+ */
+typedef bool (*CountRule)(bool alive, unsigned int count, unsigned int closest);
+
+/** A rule which depends on the closest neighbours of a cell as well as its whole neighbourhood. */
+typedef struct split_rule {
+    Neighbourhood const *closest;                          /**< The closest part of the neighbourhood. */
+    CountRule next_state;                                  /**< The rule, or NULL for cell types without one. */
+    bool table[2][MAX_NEIGHBOURHOOD + 1][MAX_CLOSEST + 1]; /**< The compiled rule, indexed by state and counts. */
+} SplitRule;
+
 /** Represents a type of cell. */
 typedef struct cell_type {
-    const char *name;           /**< The name of the cell type. */
-    StateCalculator calculator; /**< The function to use for calculating the next state of a cell of this type. */
+    const char *name;                   /**< The name of the cell type. */
+    const char *rulestring;             /**< The B/S rulestring of a Life-like cell type, or NULL. */
+    Neighbourhood const *neighbourhood; /**< The neighbourhood the rulestring counts neighbours in. */
+    StateCalculator calculator;         /**< The function for calculating the next state of a non Life-like cell. */
+    LifeRule rule;                      /**< The compiled rulestring (see cell_type_compile). */
+    SplitRule split;                    /**< The rule of a cell type which also counts its closest neighbours. */
 } CellType;
 
 #define state_calculator(name) bool name(Environment const *env, uint32_t x, uint32_t y)
-state_calculator(conway_next_state);
-state_calculator(maze_next_state);
-state_calculator(noise_next_state);
-state_calculator(fractal_next_state);
-state_calculator(fractal_corner_next_state);
-state_calculator(lesse_conway_next_state);
 state_calculator(triple_moore_conway_next_state);
-state_calculator(conway_cancer_next_state);
 state_calculator(von_neumann_r2_conway_next_state);
+bool triple_moore_conway_rule(bool alive, unsigned int count, unsigned int closest_eight);
+bool von_neumann_r2_conway_rule(bool alive, unsigned int count, unsigned int closest_four);
 
 #define ConwayCell                                                                                                     \
-    { "conway cell", conway_next_state }
+    { "conway cell", "B3/S23", &MOORE, NULL, {0}, {0} }
 #define MazeCell                                                                                                       \
-    { "maze cell", maze_next_state }
+    { "maze cell", "B3/S2345", &MOORE, NULL, {0}, {0} }
 #define NoiseCell                                                                                                      \
-    { "noise cell", noise_next_state }
+    { "noise cell", "B2/S45", &MOORE, NULL, {0}, {0} }
 #define FractalCell                                                                                                    \
-    { "fractal cell", fractal_next_state }
+    { "fractal cell", "B1/S234", &VON_NEUMANN, NULL, {0}, {0} }
 #define FractalCornerCell                                                                                              \
-    { "fractal corner cell", fractal_corner_next_state }
+    { "fractal corner cell", "B1/S234", &VON_NEUMANN_CORNERS, NULL, {0}, {0} }
 #define LesseConwayCell                                                                                                \
-    { "lesse conway cell", lesse_conway_next_state }
+    { "lesse conway cell", "B3/S23", &LESSE, NULL, {0}, {0} }
 #define TripleMooreConwayCell                                                                                          \
-    { "triple moore conway cell", triple_moore_conway_next_state }
+    {                                                                                                                  \
+        "triple moore conway cell", NULL, &TRIPLE_MOORE, triple_moore_conway_next_state, {0},                          \
+        {&MOORE, triple_moore_conway_rule, {{{0}}}}                                                                    \
+    }
 #define VonNeumannR2ConwayCell                                                                                         \
-    { "von neumann r2 conway cell", von_neumann_r2_conway_next_state }
+    {                                                                                                                  \
+        "von neumann r2 conway cell", NULL, &VON_NEUMANN_R2, von_neumann_r2_conway_next_state, {0},                    \
+        {&VON_NEUMANN, von_neumann_r2_conway_rule, {{{0}}}}                                                            \
+    }
 #define ConwayCancerCell                                                                                               \
-    { "conway cancer cell", conway_cancer_next_state }
+    { "conway cancer cell", "B4/S3456", &VON_NEUMANN_R2, NULL, {0}, {0} }
 
+bool rule_compile(char const *rulestring, Neighbourhood const *neighbourhood, LifeRule *rule);
+bool cell_type_compile(CellType *cell_type);
+CellType const *cell_type_by_name(char const *name);
+void format_analytics_string(char **string, SimulationAnalytics const *data, uint64_t area, CellType const *cell_type);
 void populate_analytics_string(char **string, Environment const *env, CellType const *cell_type);
+uint32_t step_block(Environment *env, CellType const *cell_type, uint32_t first_row, uint32_t end_row,
+                    uint32_t first_col, uint32_t end_col, bool *changed);
+uint64_t step_signature(CellType const *cell_type, bool bit_packed);
 void next_generation(Environment *env, CellType const *cell_type);
+void step_generations(Environment *env, CellType const *cell_type, uint64_t generations);
+uint64_t fast_forward(Environment *env, CellType const *cell_type, uint64_t generations);
 
 #endif // CONWAY_RULES_H
@@ -0,0 +1,26 @@
+/**
+ * Contains the vectorised kernel for stepping Life-like rules on the byte-per-cell grid, which sums the neighbours of
+ * 16 or 32 cells at a time with SIMD instructions chosen at runtime.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_SIMD_H
+#define CONWAY_SIMD_H
+
+#include "environment.h"
+#include "rules.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/** The instruction sets the vectorised kernel can use. */
+typedef enum {
+    SIMD_SCALAR = 0, /**< Plain C, one cell at a time. */
+    SIMD_SSE2,       /**< 16 cells at a time. */
+    SIMD_AVX2,       /**< 32 cells at a time. */
+} SimdLevel;
+
+SimdLevel simd_detect(void);
+uint32_t simd_life_block(SimdLevel level, Environment *env, CellType const *cell_type, uint32_t first_row,
+                         uint32_t end_row, uint32_t first_col, uint32_t end_col, bool *changed);
+
+#endif // CONWAY_SIMD_H
@@ -0,0 +1,113 @@
+/**
+ * Contains the simulation thread, which calculates generations independently of the display. Completed generations
+ * are published through a triple buffer so the display always has the latest one to draw without waiting, and the
+ * display changes the simulation by queueing commands for the thread.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_SIMULATION_H
+#define CONWAY_SIMULATION_H
+
+#include "checkpoint.h"
+#include "environment.h"
+#include "hashlife.h"
+#include "history.h"
+#include "pyramid.h"
+#include "rules.h"
+#include "world.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** The number of generations (as a power of 2) jumped ahead with HashLife, or skipped at once in a cycle. */
+#define SIMULATION_JUMP_LOG2 10
+/** The longest the simulation thread calculates generations (in microseconds) before handling commands and frames. */
+#define SIMULATION_BUDGET_US 8000
+/** How long the generation rate is measured over (in microseconds) before it is updated. */
+#define SIMULATION_RATE_WINDOW_US 500000
+/** The number of commands which can wait for the simulation thread before more are dropped. */
+#define SIMULATION_QUEUE 1024
+
+/** The changes the display can make to the simulation. */
+typedef enum {
+    SIMULATION_TOGGLE_PLAYING, /**< Pause or play. */
+    SIMULATION_SET_SPEED,      /**< Set the generation length to `value` microseconds. */
+    SIMULATION_CLEAR,          /**< Kill every cell. */
+    SIMULATION_TOGGLE_CELL,    /**< Toggle the cell at (`x`, `y`), counting it as drawn by the user. */
+    SIMULATION_WRITE_CELL,     /**< Set the cell at (`x`, `y`) to `value`. */
+    SIMULATION_CELL_TYPE,      /**< Switch to `cell_type`. */
+    SIMULATION_TOGGLE_PACKED,  /**< Toggle the bit-packed kernel. */
+    SIMULATION_JUMP,           /**< Jump ahead with HashLife (Conway cells in the wrapping grid only). */
+    SIMULATION_SAVE,           /**< Save a checkpoint. */
+    SIMULATION_REWIND,         /**< Pause, and move `value` generations through the history (negative to go back). */
+    SIMULATION_VIEW,           /**< Show `width` x `height` cells from (`x`, `y`), in blocks of 2^`value` cells. */
+} SimulationCommandType;
+
+/** A change queued for the simulation thread. */
+typedef struct {
+    SimulationCommandType type; /**< What to change. */
+    int64_t x;                  /**< The x coordinate of a cell or of the view. */
+    int64_t y;                  /**< The y coordinate of a cell or of the view. */
+    int64_t value;              /**< The state of a cell, a speed, a number of generations or a level of detail. */
+    uint32_t width;             /**< The number of columns of cells in the view. */
+    uint32_t height;            /**< The number of rows of cells in the view. */
+    CellType const *cell_type;  /**< The cell type to switch to, which must outlive the simulation thread. */
+} SimulationCommand;
+
+/**
+ * The part of a generation on screen, published for display. At level of detail 0 it holds the cells themselves;
+ * above that it holds the density of each block of 2^`lod` x 2^`lod` cells (see pyramid.h). It also lists the tiles of
+ * the grid on screen which changed since an earlier frame, so a display which kept the pixels of that frame or any
+ * frame after it only needs to redraw those tiles.
+ */
+typedef struct {
+    int64_t x0;               /**< The x coordinate of the first column of cells. */
+    int64_t y0;               /**< The y coordinate of the first row of cells. */
+    uint32_t width;           /**< The number of columns of cells, or of blocks. */
+    uint32_t height;          /**< The number of rows of cells, or of blocks. */
+    unsigned int lod;         /**< The level of detail, where each block covers 2^`lod` cells across. */
+    uint32_t row_words;       /**< The number of 64-bit words in each row of `cells`. */
+    uint64_t *cells;          /**< The cells, bit-packed with 64 cells per word, at level of detail 0. */
+    size_t capacity;          /**< The number of words allocated for `cells`. */
+    uint8_t *density;         /**< The density of each block, row by row, above level of detail 0. */
+    size_t density_capacity;  /**< The number of bytes allocated for `density`. */
+    uint64_t serial;          /**< The number of frames published before and including this one. */
+    uint64_t since;           /**< The serial of the frame `changes` are counted from. */
+    uint32_t tiles_x;         /**< The number of columns of tiles in the grid, for finding the tiles in `changes`. */
+    uint32_t *changes;        /**< The tiles changed (row * `tiles_x` + column), in order, unless `all_changed`. */
+    uint32_t change_count;    /**< The number of tiles in `changes`. */
+    size_t change_capacity;   /**< The number of tiles allocated for `changes`. */
+    bool all_changed;         /**< Whether everything on screen should be redrawn rather than only `changes`. */
+    SimulationAnalytics data; /**< The analytics of the generation. */
+    uint64_t area;            /**< The number of cells in the simulated area, for the percentage alive. */
+    uint64_t hash;            /**< The hash of the grid (0 for the unbounded world). */
+    CellType cell_type;       /**< The cell type being simulated. */
+    bool playing;             /**< Whether the simulation is playing. */
+} SimulationFrame;
+
+/** The parts of a simulation handed to the simulation thread, which are only touched by it until it is stopped. */
+typedef struct {
+    Environment *env;            /**< The wrapping grid, simulated unless `world` is given. */
+    World *world;                /**< The unbounded world, or NULL. */
+    HashLife *hashlife;          /**< The HashLife universe used for jumps. */
+    History *history;            /**< The history of generations to rewind through, or NULL. */
+    Checkpointer *checkpointer;  /**< Saves checkpoints periodically, or NULL. */
+    char const *checkpoint_path; /**< Where checkpoints are saved on request. */
+    CellType cell_type;          /**< The cell type to start simulating. */
+    CycleAction on_cycle;        /**< What to do once the simulation repeats itself. */
+    bool playing;                /**< Whether to start playing. */
+    uint32_t view_width;         /**< The width of the part of the grid or world shown at first. */
+    uint32_t view_height;        /**< The height of the part of the grid or world shown at first. */
+    void (*on_publish)(void *);  /**< Called by the thread when a frame follows one the display took, or NULL. */
+    void *publish_context;       /**< Passed to `on_publish`. */
+} SimulationSetup;
+
+typedef struct simulation Simulation;
+
+Simulation *simulation_start(SimulationSetup const *setup);
+void simulation_stop(Simulation *simulation);
+bool simulation_command(Simulation *simulation, SimulationCommand const *command);
+SimulationFrame const *simulation_frame(Simulation *simulation);
+bool simulation_frame_cell(SimulationFrame const *frame, int64_t x, int64_t y);
+
+#endif // CONWAY_SIMULATION_H
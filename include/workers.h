@@ -0,0 +1,25 @@
+/**
+ * Contains a persistent pool of worker threads for splitting the simulation step into bands of rows.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_WORKERS_H
+#define CONWAY_WORKERS_H
+
+#include <stdint.h>
+
+/** Maximum number of threads (including the calling thread) in a worker pool. */
+#define MAX_WORKERS 64
+
+/** A unit of work, run once for every band. `worker` identifies the running thread, from 0 to the pool size. */
+typedef void (*BandJob)(void *context, uint32_t band, unsigned int worker);
+
+typedef struct worker_pool WorkerPool;
+
+WorkerPool *workers_init(unsigned int count);
+void workers_destroy(WorkerPool *pool);
+unsigned int workers_count(WorkerPool const *pool);
+unsigned int workers_default_count(void);
+void workers_run(WorkerPool *pool, BandJob job, void *context, uint32_t bands);
+
+#endif // CONWAY_WORKERS_H
@@ -0,0 +1,49 @@
+/**
+ * Contains a sparse, unbounded simulation world made of fixed-size chunks which are allocated as cells spread into
+ * them and freed once they empty out.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#ifndef CONWAY_WORLD_H
+#define CONWAY_WORLD_H
+
+#include "environment.h"
+#include "rules.h"
+#include "workers.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** The width and height of a chunk in cells. Must be at least the radius of the largest neighbourhood. */
+#define CHUNK_SIZE 64
+
+typedef struct chunk Chunk;
+
+/** Called for each living cell found by world_visit. */
+typedef void (*CellVisitor)(void *context, int64_t x, int64_t y);
+
+/** Represents an unbounded simulation world. */
+typedef struct world {
+    SimulationAnalytics data;  /**< The simulation analytics corresponding to this world. */
+    Chunk **buckets;           /**< Hash table of the allocated chunks, keyed on their chunk coordinates. */
+    size_t bucket_count;       /**< The number of buckets in the hash table. */
+    size_t chunk_count;        /**< The number of allocated chunks. */
+    Chunk *free_chunks;        /**< Freed chunks kept around for reuse. */
+    Chunk **_step_chunks;      /**< The chunks being stepped in the current generation. */
+    size_t _step_capacity;     /**< The capacity of _step_chunks. */
+    WorkerPool *workers;       /**< The threads which share the work of calculating each generation. */
+    uint64_t _step_signature;  /**< Identifies the rule of the last generation, see step_signature. */
+} World;
+
+World *world_init(uint32_t generation_period);
+void world_destroy(World *world);
+void world_clear(World *world);
+bool world_access(World const *world, int64_t x, int64_t y);
+void world_write(World *world, int64_t x, int64_t y, bool value);
+bool world_toggle_cell(World *world, int64_t x, int64_t y);
+void world_next_generation(World *world, CellType const *cell_type);
+void world_visit(World const *world, int64_t x0, int64_t y0, int64_t x1, int64_t y1, CellVisitor visitor,
+                 void *context);
+void populate_world_analytics_string(char **string, World const *world, CellType const *cell_type);
+
+#endif // CONWAY_WORLD_H
@@ -0,0 +1,187 @@
+/**
+ * Contains the bit-packed grid representation and the bit-parallel kernel for stepping Moore-neighbourhood rules 64
+ * cells at a time. The kernel only writes the bit-packed grid: the byte-per-cell grid falls behind in the tiles which
+ * change, and those are unpacked when something next reads them.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/bitpack.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+_Static_assert(ENV_TILE_WIDTH == 64, "Each row of a tile must be one bit-packed word");
+
+/**
+ * Packs the byte-per-cell grid into the bit-packed grid if it has been modified since they were last in sync.
+ * @param env The environment whose grids should be synchronized
+ */
+void bitpack_sync(Environment *env) {
+    if (!env->packed_stale) return;
+    assert(!env->grid_stale); // Only one of the grids is ever ahead of the other
+
+    for (uint32_t y = 0; y < env->height; y++) {
+        bool const *row = &env->grid[(uint64_t)env->stride * y];
+        uint64_t *words = &env->packed[(uint64_t)env->row_words * y];
+
+        for (uint32_t i = 0; i < env->row_words; i++) {
+            uint32_t start = i * 64;
+            uint32_t end = start + 64 < env->width ? start + 64 : env->width;
+            uint64_t word = 0;
+            for (uint32_t x = start; x < end; x++)
+                word |= (uint64_t)row[x] << (x - start);
+            words[i] = word;
+        }
+    }
+    env->packed_stale = false;
+}
+
+/**
+ * Unpacks the bit-packed grid into the byte-per-cell grid in the tiles of a rectangle which are behind it.
+ * @param env The environment whose grids should be synchronized
+ * @param first_tx The first column of tiles
+ * @param end_tx One past the last column of tiles
+ * @param first_ty The first row of tiles
+ * @param end_ty One past the last row of tiles
+ */
+void bitpack_unpack_tiles(Environment *env, uint32_t first_tx, uint32_t end_tx, uint32_t first_ty, uint32_t end_ty) {
+    if (!env->grid_stale) return;
+
+    for (uint32_t ty = first_ty; ty < end_ty; ty++) {
+        uint32_t first_row = ty * ENV_TILE_HEIGHT;
+        uint32_t end_row = first_row + ENV_TILE_HEIGHT < env->height ? first_row + ENV_TILE_HEIGHT : env->height;
+        for (uint32_t tx = first_tx; tx < end_tx; tx++) {
+            bool *stale = &env->tile_stale[(size_t)ty * env->tiles_x + tx];
+            if (!*stale) continue;
+            *stale = false;
+
+            uint32_t start = tx * 64;
+            uint32_t end = start + 64 < env->width ? start + 64 : env->width;
+            for (uint32_t y = first_row; y < end_row; y++) {
+                uint64_t word = env->packed[(uint64_t)env->row_words * y + tx];
+                bool *row = &env->grid[(uint64_t)env->stride * y];
+                for (uint32_t x = start; x < end; x++)
+                    row[x] = (word >> (x - start)) & 1;
+            }
+        }
+    }
+}
+
+/**
+ * Unpacks the bit-packed grid into the byte-per-cell grid wherever the bit-packed kernel has left it behind. Must be
+ * called before the byte-per-cell grid is read or written (see env_access).
+ * @param env The environment whose grids should be synchronized
+ */
+void bitpack_unpack(Environment *env) {
+    bitpack_unpack_tiles(env, 0, env->tiles_x, 0, env->tiles_y);
+    env->grid_stale = false;
+}
+
+/**
+ * Shifts a bit-packed row so that each bit holds the state of its western neighbour, wrapping at the row edges.
+ * @param row The bit-packed row
+ * @param i The index of the word to shift
+ * @param words The number of words in the row
+ * @param width The number of cells in the row
+ * @return The western neighbours of the 64 cells in word i
+ */
+static inline uint64_t west(uint64_t const *row, uint32_t i, uint32_t words, uint32_t width) {
+    uint64_t carry = i > 0 ? row[i - 1] >> 63 : (row[words - 1] >> ((width - 1) % 64)) & 1;
+    return (row[i] << 1) | carry;
+}
+
+/**
+ * Shifts a bit-packed row so that each bit holds the state of its eastern neighbour, wrapping at the row edges.
+ * @param row The bit-packed row
+ * @param i The index of the word to shift
+ * @param words The number of words in the row
+ * @param width The number of cells in the row
+ * @return The eastern neighbours of the 64 cells in word i
+ */
+static inline uint64_t east(uint64_t const *row, uint32_t i, uint32_t words, uint32_t width) {
+    if (i + 1 < words) return (row[i] >> 1) | (row[i + 1] << 63);
+    return (row[i] >> 1) | ((row[0] & 1) << ((width - 1) % 64)); // Last cell sees the first cell of the row
+}
+
+/**
+ * Applies a birth/survival rule to 64 cells at once from their bit-sliced neighbour counts.
+ * @param alive The current states of the cells
+ * @param count The four bit planes of each cell's neighbour count, least significant first
+ * @param birth Bitmask of the neighbour counts which cause a dead cell to be born
+ * @param survive Bitmask of the neighbour counts which allow a living cell to survive
+ * @return The next states of the cells
+ */
+static inline uint64_t apply_rule(uint64_t alive, uint64_t const count[4], uint32_t birth, uint32_t survive) {
+    uint64_t next = 0;
+    for (unsigned int n = 0; n <= 8; n++) {
+        if (!((birth | survive) & NEIGHBOURS(n))) continue;
+
+        // Select the cells whose count is exactly n
+        uint64_t matches = ~(uint64_t)0;
+        for (unsigned int bit = 0; bit < 4; bit++)
+            matches &= (n >> bit) & 1 ? count[bit] : ~count[bit];
+
+        uint64_t born = birth & NEIGHBOURS(n) ? ~alive : 0;
+        uint64_t survives = survive & NEIGHBOURS(n) ? alive : 0;
+        next |= matches & (born | survives);
+    }
+    return next;
+}
+
+/**
+ * Calculates the next generation of a rule in the Moore neighbourhood on the bit-packed grid for a block of words,
+ * using a bit-sliced adder tree to count the neighbours of 64 cells per word operation. The result is only written to
+ * the bit-packed next generation grid. The bit-packed grid must already be in sync (see bitpack_sync).
+ * @param env The environment to step
+ * @param birth Bitmask of the neighbour counts which cause a dead cell to be born
+ * @param survive Bitmask of the neighbour counts which allow a living cell to survive
+ * @param first_row The first row of the block
+ * @param end_row One past the last row of the block
+ * @param first_word The first word of each row in the block
+ * @param end_word One past the last word of each row in the block
+ * @param changed Set to true if any cell in the block changed state, left untouched otherwise
+ * @return The number of living cells in the block in the next generation
+ */
+uint32_t bitpack_moore_block(Environment *env, uint32_t birth, uint32_t survive, uint32_t first_row, uint32_t end_row,
+                             uint32_t first_word, uint32_t end_word, bool *changed) {
+
+    uint32_t words = env->row_words;
+    uint32_t width = env->width;
+    uint32_t population = 0;
+    uint64_t last_mask = width % 64 == 0 ? ~(uint64_t)0 : ((uint64_t)1 << (width % 64)) - 1;
+    uint64_t difference = 0;
+
+    for (uint32_t y = first_row; y < end_row; y++) {
+        uint64_t const *above = &env->packed[(uint64_t)words * (y == 0 ? env->height - 1 : y - 1)];
+        uint64_t const *row = &env->packed[(uint64_t)words * y];
+        uint64_t const *below = &env->packed[(uint64_t)words * (y == env->height - 1 ? 0 : y + 1)];
+        uint64_t *next = &env->_next_packed[(uint64_t)words * y];
+
+        for (uint32_t i = first_word; i < end_word; i++) {
+
+            // The eight neighbours of each cell in the word, one bit plane each
+            uint64_t n0 = west(above, i, words, width), n1 = above[i], n2 = east(above, i, words, width);
+            uint64_t n3 = west(row, i, words, width), n4 = east(row, i, words, width);
+            uint64_t n5 = west(below, i, words, width), n6 = below[i], n7 = east(below, i, words, width);
+
+            // Full adders reduce the eight planes to ones, twos and fours
+            uint64_t sa = n0 ^ n1 ^ n2, ca = (n0 & n1) | (n2 & (n0 ^ n1));
+            uint64_t sb = n3 ^ n4 ^ n5, cb = (n3 & n4) | (n5 & (n3 ^ n4));
+            uint64_t sc = n6 ^ n7, cc = n6 & n7;
+            uint64_t ones = sa ^ sb ^ sc, cd = (sa & sb) | (sc & (sa ^ sb));
+            uint64_t ta = ca ^ cb ^ cc, fa = (ca & cb) | (cc & (ca ^ cb));
+            uint64_t twos = ta ^ cd, fb = ta & cd;
+            uint64_t count[4] = {ones, twos, fa ^ fb, fa & fb};
+
+            uint64_t state = apply_rule(row[i], count, birth, survive);
+            if (i == words - 1) state &= last_mask; // Cells past the row width stay dead
+            next[i] = state;
+            difference |= state ^ row[i];
+            population += __builtin_popcountll(state);
+        }
+    }
+
+    if (difference) *changed = true;
+    return population;
+}
@@ -0,0 +1,177 @@
+/**
+ * Contains the kernel for counting neighbours in the included neighbourhoods out of running box sums. Every included
+ * neighbourhood is a combination of the 3x3 and 5x5 boxes around a cell, the cell itself and a few groups of four
+ * cells. The box sums are windows over sums of the columns of a row, so each count costs the same no matter how large
+ * the neighbourhood is.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/boxsum.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** The number of cells in a row whose column sums are calculated at a time. */
+#define SEGMENT 64
+
+/** The number of times each group of cells is added to (or removed from) a neighbour count. */
+typedef struct {
+    int8_t box5;    /**< The 5x5 box centred on the cell. */
+    int8_t box3;    /**< The 3x3 box centred on the cell. */
+    int8_t cell;    /**< The cell itself. */
+    int8_t plus;    /**< The four orthogonal cells at a distance of 1. */
+    int8_t arms;    /**< The four orthogonal cells at a distance of 2. */
+    int8_t corners; /**< The four diagonal cells at a distance of 2. */
+} CountTerms;
+
+/** How to count each of the included neighbourhoods. */
+static const struct {
+    Neighbourhood const *neighbourhood;
+    CountTerms terms;
+} NEIGHBOURHOOD_TERMS[] = {
+    {&VON_NEUMANN, {.plus = 1}},
+    {&VON_NEUMANN_CORNERS, {.box3 = 1, .cell = -1, .plus = -1}},
+    {&LESSE, {.box3 = 1, .cell = -1, .plus = -1, .arms = 1}},
+    {&MOORE, {.box3 = 1, .cell = -1}},
+    {&VON_NEUMANN_R2, {.box3 = 1, .cell = -1, .arms = 1}},
+    {&TRIPLE_MOORE, {.box5 = 1, .cell = -1, .corners = -1}},
+    {&TRIPLE_MOORE_CORNER, {.box5 = 1, .cell = -1}},
+};
+
+/**
+ * Finds how to count a neighbourhood.
+ * @param neighbourhood The neighbourhood
+ * @return The terms of its count, or NULL if it is not one of the included neighbourhoods
+ */
+static CountTerms const *count_terms(Neighbourhood const *neighbourhood) {
+    for (size_t i = 0; i < sizeof(NEIGHBOURHOOD_TERMS) / sizeof(NEIGHBOURHOOD_TERMS[0]); i++) {
+        if (NEIGHBOURHOOD_TERMS[i].neighbourhood == neighbourhood) return &NEIGHBOURHOOD_TERMS[i].terms;
+    }
+    return NULL;
+}
+
+/**
+ * @param neighbourhood A neighbourhood
+ * @return true if neighbours in the neighbourhood can be counted with box sums, false otherwise
+ */
+bool __attribute__((const)) boxsum_supports(Neighbourhood const *neighbourhood) {
+    return count_terms(neighbourhood) != NULL;
+}
+
+/**
+ * Counts the living cells in the neighbourhood of each cell in a segment of a row.
+ * @param counts Output for the neighbour count of each cell
+ * @param terms The terms of the neighbourhood's count
+ * @param cells The first cell of the segment
+ * @param stride The distance between rows of cells
+ * @param box5 The sum of the 5x5 box centred on each cell
+ * @param box3 The sum of the 3x3 box centred on each cell
+ * @param length The number of cells in the segment
+ */
+static void count_segment(uint8_t *counts, CountTerms const *terms, bool const *cells, int64_t stride,
+                          uint8_t const *box5, uint8_t const *box3, uint32_t length) {
+
+    // Each term is its own pass over the segment so that every pass vectorises
+    int box5_term = terms->box5, box3_term = terms->box3, cell_term = terms->cell;
+    int plus_term = terms->plus, arms_term = terms->arms, corners_term = terms->corners;
+    for (uint32_t i = 0; i < length; i++)
+        counts[i] = (uint8_t)(box5_term * box5[i] + box3_term * box3[i] + cell_term * cells[i]);
+    if (plus_term) {
+        bool const *west = cells - 1, *east = cells + 1, *north = cells - stride, *south = cells + stride;
+        for (uint32_t i = 0; i < length; i++)
+            counts[i] += (uint8_t)(plus_term * (west[i] + east[i] + north[i] + south[i]));
+    }
+    if (arms_term) {
+        bool const *west = cells - 2, *east = cells + 2, *north = cells - 2 * stride, *south = cells + 2 * stride;
+        for (uint32_t i = 0; i < length; i++)
+            counts[i] += (uint8_t)(arms_term * (west[i] + east[i] + north[i] + south[i]));
+    }
+    if (corners_term) {
+        bool const *north_west = cells - 2 * stride - 2, *north_east = cells - 2 * stride + 2;
+        bool const *south_west = cells + 2 * stride - 2, *south_east = cells + 2 * stride + 2;
+        for (uint32_t i = 0; i < length; i++)
+            counts[i] += (uint8_t)(corners_term * (north_west[i] + north_east[i] + south_west[i] + south_east[i]));
+    }
+}
+
+/**
+ * Calculates the next generation of a cell type with a split rule for a block of cells on the byte-per-cell grid, with
+ * both of its counts built out of box sums. Both of the cell type's neighbourhoods must be supported (see
+ * boxsum_supports).
+ * @param env The environment being stepped, with an up to date halo
+ * @param cell_type The cell type, with a compiled split rule
+ * @param first_row The first row of the block
+ * @param end_row One past the last row of the block
+ * @param first_col The first column of the block
+ * @param end_col One past the last column of the block
+ * @param changed Set to true if any cell in the block changed state, left untouched otherwise
+ * @return The number of living cells in the block in the next generation
+ */
+uint32_t boxsum_block(Environment *env, CellType const *cell_type, uint32_t first_row, uint32_t end_row,
+                      uint32_t first_col, uint32_t end_col, bool *changed) {
+
+    CountTerms const *terms = count_terms(cell_type->neighbourhood);
+    CountTerms const *closest_terms = count_terms(cell_type->split.closest);
+    assert(terms != NULL && closest_terms != NULL);
+
+    int64_t stride = env->stride;
+    uint32_t total_cells = 0;
+    bool difference = false;
+    for (uint32_t y = first_row; y < end_row; y++) {
+        bool const *row = &env->grid[(uint64_t)env->stride * y];
+        bool *next_row = &env->_next_generation[(uint64_t)env->stride * y];
+
+        for (uint32_t start = first_col; start < end_col; start += SEGMENT) {
+            uint32_t end = start + SEGMENT < end_col ? start + SEGMENT : end_col;
+
+            uint32_t length = end - start;
+
+            // Sum the columns of 3 and 5 cells centred on the row, from two cells left of the segment to two right
+            uint8_t column3[SEGMENT + 4];
+            uint8_t column5[SEGMENT + 4];
+            bool const *left = row + start - 2;
+            bool const *above = left - stride, *below = left + stride;
+            bool const *far_above = left - 2 * stride, *far_below = left + 2 * stride;
+            for (uint32_t i = 0; i < length + 4; i++) {
+                column3[i] = (uint8_t)(above[i] + left[i] + below[i]);
+                column5[i] = (uint8_t)(column3[i] + far_above[i] + far_below[i]);
+            }
+
+            // Sum windows of 3 and 5 columns into the boxes centred on each cell
+            uint8_t box3[SEGMENT];
+            uint8_t box5[SEGMENT];
+            for (uint32_t i = 0; i < length; i++) {
+                box3[i] = (uint8_t)(column3[i + 1] + column3[i + 2] + column3[i + 3]);
+                box5[i] = (uint8_t)(column5[i] + column5[i + 1] + column5[i + 2] + column5[i + 3] + column5[i + 4]);
+            }
+
+            uint8_t counts[SEGMENT];
+            uint8_t closest[SEGMENT];
+            count_segment(counts, terms, row + start, stride, box5, box3, length);
+            count_segment(closest, closest_terms, row + start, stride, box5, box3, length);
+
+            // Look up each cell's next state, then tally the segment in passes which vectorise
+            bool const *cells = row + start;
+            bool *next_cells = next_row + start;
+            bool const *table = &cell_type->split.table[0][0][0];
+            uint16_t index[SEGMENT];
+            for (uint32_t i = 0; i < length; i++) {
+                index[i] =
+                    (uint16_t)((cells[i] * (MAX_NEIGHBOURHOOD + 1) + counts[i]) * (MAX_CLOSEST + 1) + closest[i]);
+            }
+            for (uint32_t i = 0; i < length; i++)
+                next_cells[i] = table[index[i]];
+
+            uint8_t changes = 0;
+            for (uint32_t i = 0; i < length; i++) {
+                total_cells += next_cells[i];
+                changes |= next_cells[i] ^ cells[i];
+            }
+            difference |= changes != 0;
+        }
+    }
+
+    if (difference) *changed = true;
+    return total_cells;
+}
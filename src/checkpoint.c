@@ -0,0 +1,405 @@
+/**
+ * Contains the binary checkpoint format for saving and restoring a simulation, and a background thread for writing
+ * checkpoints periodically without holding up the simulation.
+ *
+ * A checkpoint is a fixed-size header followed by the bit-packed grid, one row of 64-bit words after another. The grid
+ * may be compressed by leaving out runs of empty words: it is then a series of blocks, each a count of empty words and
+ * a count of the words which follow them in the file. Either way restoring copies whole words out of a memory mapping
+ * of the file, with no per-cell parsing. Checkpoints are written in the byte order of the machine and are rejected by
+ * machines with the other byte order.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/checkpoint.h"
+#include "../include/bitpack.h"
+#include "../include/mapfile.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Identifies checkpoint files. */
+static const char CHECKPOINT_MAGIC[8] = "C-ONWAY";
+/** Written in the byte order of the machine, so that checkpoints from machines with another byte order are caught. */
+#define CHECKPOINT_BYTE_ORDER 0x01020304u
+
+/** The start of a checkpoint file. Its size is a multiple of 8 so that the grid which follows is aligned. */
+typedef struct {
+    char magic[8];                              /**< CHECKPOINT_MAGIC. */
+    uint32_t version;                           /**< CHECKPOINT_VERSION. */
+    uint32_t byte_order;                        /**< CHECKPOINT_BYTE_ORDER. */
+    uint32_t width;                             /**< The width of the grid. */
+    uint32_t height;                            /**< The height of the grid. */
+    uint32_t flags;                             /**< CHECKPOINT_COMPRESSED, or 0. */
+    uint32_t period;                            /**< SimulationAnalytics.period. */
+    uint64_t generations;                       /**< SimulationAnalytics.generations. */
+    uint64_t stable_generation;                 /**< SimulationAnalytics.stable_generation. */
+    uint32_t total_cells;                       /**< SimulationAnalytics.total_cells. */
+    uint32_t initial_cells;                     /**< SimulationAnalytics.initial_cells. */
+    uint32_t generation_period;                 /**< SimulationAnalytics.generation_period. */
+    uint32_t reserved;                          /**< Zero. */
+    uint64_t grid_length;                       /**< The number of bytes of grid following the header. */
+    char cell_type[CHECKPOINT_NAME_LENGTH];     /**< The name of the cell type. */
+    char rulestring[CHECKPOINT_NAME_LENGTH];    /**< The rulestring of a Life-like cell type, or empty. */
+    char neighbourhood[CHECKPOINT_NAME_LENGTH]; /**< The name of the neighbourhood of a Life-like cell type. */
+} CheckpointHeader;
+
+_Static_assert(sizeof(CheckpointHeader) % sizeof(uint64_t) == 0, "The grid must be aligned after the header");
+
+/** A block of a compressed grid. */
+typedef struct {
+    uint32_t empty; /**< The number of empty words in the grid before the block's words. */
+    uint32_t words; /**< The number of words which follow the block in the file. */
+} CheckpointBlock;
+
+struct checkpoint_image {
+    CheckpointHeader header; /**< The header, with everything but the grid length and flags filled in. */
+    uint64_t *grid;          /**< The bit-packed grid. */
+    size_t words;            /**< The number of words in the grid. */
+};
+
+struct checkpointer {
+    char *path;               /**< Where checkpoints are written. */
+    uint64_t interval;        /**< The number of generations between checkpoints. */
+    uint64_t last_generation; /**< The generation of the last checkpoint taken. */
+    pthread_t thread;         /**< The thread writing the checkpoints. */
+    pthread_mutex_t lock;     /**< Guards `pending` and `quit`. */
+    pthread_cond_t wake;      /**< Signalled when a checkpoint is waiting or the thread should quit. */
+    CheckpointImage *pending; /**< The checkpoint waiting to be written, or NULL. */
+    bool quit;                /**< Set to make the thread exit once nothing is pending. */
+};
+
+/**
+ * Copies a string into a fixed-size field, truncating it if needed.
+ * @param field The field
+ * @param string The string, or NULL for an empty field
+ */
+static void copy_name(char field[CHECKPOINT_NAME_LENGTH], char const *string) {
+    memset(field, 0, CHECKPOINT_NAME_LENGTH);
+    if (string != NULL) strncpy(field, string, CHECKPOINT_NAME_LENGTH - 1);
+}
+
+/**
+ * Takes a copy of the simulation which can be written to disk later, by another thread if need be. Only the
+ * bit-packed grid is copied, so this takes much less time than writing the checkpoint.
+ * @param env The environment to copy
+ * @param cell_type The cell type being simulated
+ * @return The copy
+ */
+CheckpointImage *checkpoint_capture(Environment *env, CellType const *cell_type) {
+
+    CheckpointImage *image = malloc(sizeof(CheckpointImage));
+    assert(image != NULL);
+    CheckpointHeader *header = &image->header;
+    memset(header, 0, sizeof(CheckpointHeader));
+    memcpy(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+    header->version = CHECKPOINT_VERSION;
+    header->byte_order = CHECKPOINT_BYTE_ORDER;
+    header->width = env->width;
+    header->height = env->height;
+    header->period = env->data.period;
+    header->generations = env->data.generations;
+    header->stable_generation = env->data.stable_generation;
+    header->total_cells = env->data.total_cells;
+    header->initial_cells = env->data.initial_cells;
+    header->generation_period = env->data.generation_period;
+    copy_name(header->cell_type, cell_type->name);
+    if (cell_type->rulestring != NULL) {
+        copy_name(header->rulestring, cell_type->rulestring);
+        copy_name(header->neighbourhood, neighbourhood_name(cell_type->neighbourhood));
+    }
+
+    bitpack_sync(env);
+    image->words = (size_t)env->row_words * env->height;
+    image->grid = malloc(image->words * sizeof(uint64_t));
+    assert(image->grid != NULL);
+    memcpy(image->grid, env->packed, image->words * sizeof(uint64_t));
+    return image;
+}
+
+/**
+ * Frees a copy of the simulation.
+ * @param image The copy to free
+ */
+void checkpoint_free(CheckpointImage *image) {
+    free(image->grid);
+    free(image);
+}
+
+/**
+ * Writes the compressed grid, as blocks of words which follow runs of empty words.
+ * @param image The checkpoint being written
+ * @param file The file to write to
+ * @param length Output for the number of bytes written
+ * @return true if the grid was written, false otherwise
+ */
+static bool write_compressed(CheckpointImage const *image, FILE *file, uint64_t *length) {
+    uint64_t const *grid = image->grid;
+    size_t i = 0;
+    *length = 0;
+    while (i < image->words) {
+        CheckpointBlock block = {0, 0};
+        while (i < image->words && grid[i] == 0 && block.empty < UINT32_MAX) {
+            block.empty++;
+            i++;
+        }
+        size_t start = i;
+        while (i < image->words && grid[i] != 0 && block.words < UINT32_MAX) {
+            block.words++;
+            i++;
+        }
+        if (fwrite(&block, sizeof(block), 1, file) != 1) return false;
+        if (fwrite(&grid[start], sizeof(uint64_t), block.words, file) != block.words) return false;
+        *length += sizeof(block) + (uint64_t)block.words * sizeof(uint64_t);
+    }
+    return true;
+}
+
+/**
+ * Writes a copy of the simulation to disk. It is written to a temporary file first and then renamed, so an existing
+ * checkpoint is only ever replaced by a complete one.
+ * @param image The copy of the simulation
+ * @param path The path to write the checkpoint to
+ * @param compress Whether to leave out runs of empty words, which shrinks sparse grids
+ * @return true if the checkpoint was written, false otherwise
+ */
+bool checkpoint_write(CheckpointImage const *image, char const *path, bool compress) {
+
+    size_t path_length = strlen(path) + sizeof(".tmp");
+    char *temporary = malloc(path_length);
+    assert(temporary != NULL);
+    snprintf(temporary, path_length, "%s.tmp", path);
+
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL) {
+        free(temporary);
+        return false;
+    }
+
+    // The header is written again once the length of the grid is known
+    CheckpointHeader header = image->header;
+    header.flags = compress ? CHECKPOINT_COMPRESSED : 0;
+    header.grid_length = (uint64_t)image->words * sizeof(uint64_t);
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (written && compress) {
+        written = write_compressed(image, file, &header.grid_length) && fseek(file, 0, SEEK_SET) == 0 &&
+                  fwrite(&header, sizeof(header), 1, file) == 1;
+    } else if (written) {
+        written = fwrite(image->grid, sizeof(uint64_t), image->words, file) == image->words;
+    }
+    written = fclose(file) == 0 && written;
+
+    written = written && rename(temporary, path) == 0;
+    if (!written) remove(temporary);
+    free(temporary);
+    return written;
+}
+
+/**
+ * Saves the simulation to disk.
+ * @param env The environment to save
+ * @param cell_type The cell type being simulated
+ * @param path The path to write the checkpoint to
+ * @param compress Whether to leave out runs of empty words, which shrinks sparse grids
+ * @return true if the checkpoint was written, false otherwise
+ */
+bool checkpoint_save(Environment *env, CellType const *cell_type, char const *path, bool compress) {
+    CheckpointImage *image = checkpoint_capture(env, cell_type);
+    bool written = checkpoint_write(image, path, compress);
+    checkpoint_free(image);
+    return written;
+}
+
+/**
+ * Copies the grid of a checkpoint into the bit-packed grid.
+ * @param header The header of the checkpoint
+ * @param grid The grid following the header
+ * @param packed The bit-packed grid to fill
+ * @param words The number of words in the bit-packed grid
+ * @return true if the grid was copied, false if it is malformed
+ */
+static bool read_grid(CheckpointHeader const *header, char const *grid, uint64_t *packed, size_t words) {
+    if (!(header->flags & CHECKPOINT_COMPRESSED)) {
+        if (header->grid_length != (uint64_t)words * sizeof(uint64_t)) return false;
+        memcpy(packed, grid, words * sizeof(uint64_t));
+        return true;
+    }
+
+    size_t i = 0;
+    for (uint64_t offset = 0; offset < header->grid_length;) {
+        CheckpointBlock block;
+        if (header->grid_length - offset < sizeof(block)) return false;
+        memcpy(&block, grid + offset, sizeof(block));
+        offset += sizeof(block);
+        uint64_t length = (uint64_t)block.words * sizeof(uint64_t);
+        if ((uint64_t)block.empty + block.words > words - i || header->grid_length - offset < length) return false;
+
+        memset(&packed[i], 0, (size_t)block.empty * sizeof(uint64_t));
+        i += block.empty;
+        memcpy(&packed[i], grid + offset, (size_t)length);
+        i += block.words;
+        offset += length;
+    }
+    memset(&packed[i], 0, (words - i) * sizeof(uint64_t)); // Trailing empty words need no block
+    return true;
+}
+
+/**
+ * Restores the cell type of a checkpoint.
+ * @param header The header of the checkpoint
+ * @param cell_type Output for the cell type, which must be compiled before use
+ * @param rulestring Storage for the name and rulestring of a Life-like cell type
+ * @return true if the cell type was restored, false if it is unknown
+ */
+static bool restore_cell_type(CheckpointHeader const *header, CellType *cell_type,
+                              char rulestring[CHECKPOINT_NAME_LENGTH]) {
+    // Included cell types are restored as they are, as long as the checkpoint agrees with their rule
+    CellType const *named = cell_type_by_name(header->cell_type);
+    bool matches = false;
+    if (named != NULL && named->rulestring == NULL) {
+        matches = header->rulestring[0] == '\0';
+    } else if (named != NULL) {
+        matches = strcmp(named->rulestring, header->rulestring) == 0 &&
+                  named->neighbourhood == neighbourhood_by_name(header->neighbourhood);
+    }
+    if (matches) {
+        *cell_type = *named;
+        return true;
+    }
+    if (header->rulestring[0] == '\0') return false;
+
+    *cell_type = (CellType)ConwayCell;
+    memcpy(rulestring, header->rulestring, CHECKPOINT_NAME_LENGTH);
+    rulestring[CHECKPOINT_NAME_LENGTH - 1] = '\0';
+    cell_type->name = rulestring;
+    cell_type->rulestring = rulestring;
+    cell_type->neighbourhood = neighbourhood_by_name(header->neighbourhood);
+    return cell_type->neighbourhood != NULL;
+}
+
+/**
+ * Restores a simulation from a checkpoint, in a new environment the size of the saved grid.
+ * @param path The path of the checkpoint
+ * @param cell_type Output for the cell type being simulated, which must be compiled before use
+ * @param rulestring Storage for the name and rulestring of a Life-like cell type, which must outlive the cell type
+ * @return The restored environment, or NULL if the checkpoint could not be read or is malformed
+ */
+Environment *checkpoint_restore(char const *path, CellType *cell_type, char rulestring[CHECKPOINT_NAME_LENGTH]) {
+
+    char const *contents;
+    size_t size;
+    if (!map_file(path, &contents, &size)) return NULL;
+
+    CheckpointHeader header;
+    Environment *env = NULL;
+    if (size < sizeof(header)) goto done;
+    memcpy(&header, contents, sizeof(header));
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION ||
+        header.byte_order != CHECKPOINT_BYTE_ORDER || header.width == 0 || header.height == 0 ||
+        header.grid_length != size - sizeof(header) || !restore_cell_type(&header, cell_type, rulestring))
+        goto done;
+
+    env = env_init(header.width, header.height, header.generation_period);
+    if (!read_grid(&header, contents + sizeof(header), env->packed, (size_t)env->row_words * env->height)) {
+        env_destroy(env);
+        env = NULL;
+        goto done;
+    }
+    env_unpack(env);
+    env->data.initial_cells = header.initial_cells;
+    env->data.generations = header.generations;
+    env->data.stable_generation = header.stable_generation;
+    env->data.period = header.period;
+
+done:
+    unmap_file(contents, size);
+    return env;
+}
+
+/**
+ * Main loop of the checkpoint thread: wait for a checkpoint, write it, repeat.
+ * @param arg The Checkpointer
+ * @return NULL
+ */
+static void *checkpointer_main(void *arg) {
+    Checkpointer *checkpointer = (Checkpointer *)arg;
+    pthread_mutex_lock(&checkpointer->lock);
+    while (true) {
+        while (checkpointer->pending == NULL && !checkpointer->quit)
+            pthread_cond_wait(&checkpointer->wake, &checkpointer->lock);
+        if (checkpointer->pending == NULL) break; // Quitting with nothing left to write
+
+        CheckpointImage *image = checkpointer->pending;
+        checkpointer->pending = NULL;
+        pthread_mutex_unlock(&checkpointer->lock);
+        if (!checkpoint_write(image, checkpointer->path, true))
+            fprintf(stderr, "Could not write checkpoint '%s'.\n", checkpointer->path);
+        checkpoint_free(image);
+        pthread_mutex_lock(&checkpointer->lock);
+    }
+    pthread_mutex_unlock(&checkpointer->lock);
+    return NULL;
+}
+
+/**
+ * Starts a thread which writes checkpoints of a simulation periodically.
+ * @param path Where the checkpoints are written, each replacing the last
+ * @param interval The number of generations between checkpoints
+ * @return The checkpointer
+ */
+Checkpointer *checkpointer_init(char const *path, uint64_t interval) {
+    Checkpointer *checkpointer = malloc(sizeof(Checkpointer));
+    assert(checkpointer != NULL);
+    checkpointer->path = malloc(strlen(path) + 1);
+    assert(checkpointer->path != NULL);
+    strcpy(checkpointer->path, path);
+    checkpointer->interval = interval > 0 ? interval : 1;
+    checkpointer->last_generation = 0;
+    checkpointer->pending = NULL;
+    checkpointer->quit = false;
+    pthread_mutex_init(&checkpointer->lock, NULL);
+    pthread_cond_init(&checkpointer->wake, NULL);
+    int err = pthread_create(&checkpointer->thread, NULL, checkpointer_main, checkpointer);
+    assert(err == 0);
+    (void)err;
+    return checkpointer;
+}
+
+/**
+ * Stops the checkpoint thread once it has written any checkpoint still waiting, and frees the checkpointer.
+ * @param checkpointer The checkpointer to destroy
+ */
+void checkpointer_destroy(Checkpointer *checkpointer) {
+    pthread_mutex_lock(&checkpointer->lock);
+    checkpointer->quit = true;
+    pthread_cond_signal(&checkpointer->wake);
+    pthread_mutex_unlock(&checkpointer->lock);
+    pthread_join(checkpointer->thread, NULL);
+    pthread_mutex_destroy(&checkpointer->lock);
+    pthread_cond_destroy(&checkpointer->wake);
+    free(checkpointer->path);
+    free(checkpointer);
+}
+
+/**
+ * Hands a copy of the simulation to the checkpoint thread if enough generations have passed since the last
+ * checkpoint. Only the copy is made on the calling thread. If the thread is still busy with a checkpoint that has not
+ * started writing, the newer one replaces it.
+ * @param checkpointer The checkpointer
+ * @param env The environment being simulated
+ * @param cell_type The cell type being simulated
+ */
+void checkpointer_update(Checkpointer *checkpointer, Environment *env, CellType const *cell_type) {
+    uint64_t generation = env->data.generations;
+    if (generation < checkpointer->last_generation) checkpointer->last_generation = generation; // Cleared
+    if (generation - checkpointer->last_generation < checkpointer->interval) return;
+    checkpointer->last_generation = generation;
+
+    CheckpointImage *image = checkpoint_capture(env, cell_type);
+    pthread_mutex_lock(&checkpointer->lock);
+    if (checkpointer->pending != NULL) checkpoint_free(checkpointer->pending);
+    checkpointer->pending = image;
+    pthread_cond_signal(&checkpointer->wake);
+    pthread_mutex_unlock(&checkpointer->lock);
+}
@@ -0,0 +1,106 @@
+/**
+ * Contains the detection of simulations which have settled into a still life or oscillator. The grid is hashed by
+ * XORing together a random key for each living cell (Zobrist hashing), which lets the hash be updated from just the
+ * cells that changed. The hash of each generation is remembered, and a generation which hashes the same as an earlier
+ * one marks the start of a cycle once it repeats a second time.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/cycles.h"
+#include <assert.h>
+#include <stdlib.h>
+
+/**
+ * Creates an empty cycle detector.
+ * @param detector The detector to initialize
+ */
+void cycle_init(CycleDetector *detector) {
+    detector->history = (CycleEntry *)calloc(CYCLE_HISTORY, sizeof(CycleEntry));
+    assert(detector->history != NULL);
+    detector->epoch = 1; // Entries start in epoch 0, so the zeroed table is empty
+    detector->candidate_hash = 0;
+    detector->candidate_generation = 0;
+    detector->candidate_start = 0;
+    detector->confirmed = false;
+    detector->refining = false;
+    detector->last_generation = 0;
+}
+
+/**
+ * Frees the history of a cycle detector.
+ * @param detector The detector to destroy
+ */
+void cycle_destroy(CycleDetector *detector) { free(detector->history); }
+
+/**
+ * Forgets every generation seen so far. Must be called whenever the simulation changes other than by calculating the
+ * next generation with the same rule, since a repeat across such a change is not a cycle.
+ * @param detector The detector to reset
+ */
+void cycle_reset(CycleDetector *detector) {
+    detector->epoch++;
+    detector->candidate_generation = 0;
+    detector->confirmed = false;
+    detector->refining = false;
+}
+
+/**
+ * Records the hash of a generation, and checks whether the simulation is repeating itself. A generation which hashes
+ * the same as an earlier one is only a candidate, since different grids may share a hash; the cycle is confirmed once
+ * the same hash comes around again one period later.
+ *
+ * Generations may be recorded with gaps between them (see step_generations), in which case the period found is a
+ * multiple of the true period. It is narrowed down to the true period if the generations following the confirmation
+ * are recorded one after another.
+ * @param detector The detector
+ * @param hash The hash of the grid
+ * @param generation The generation of the grid
+ * @param start Output for the generation at which the cycle started, written once the cycle is confirmed
+ * @param period Output for the period of the cycle (1 for a still life), written once the cycle is confirmed
+ * @return true on the generation the cycle is confirmed, false otherwise
+ */
+bool cycle_record(CycleDetector *detector, uint64_t hash, uint64_t generation, uint64_t *start, uint32_t *period) {
+    bool consecutive = generation == detector->last_generation + 1;
+    detector->last_generation = generation;
+
+    // Nothing can break the cycle without a reset, but its grid may come around again sooner than the period found
+    if (detector->confirmed) {
+        if (!detector->refining) return false;
+        uint64_t distance = generation - detector->confirmed_generation;
+        if (!consecutive || distance >= *period) {
+            detector->refining = false;
+        } else if (hash == detector->confirmed_hash) {
+            *period = (uint32_t)distance;
+            detector->refining = false;
+        }
+        return false;
+    }
+
+    // Check a candidate once a whole period has passed since it was seen again
+    if (detector->candidate_generation != 0 &&
+        generation >= 2 * detector->candidate_generation - detector->candidate_start) {
+        if (generation == 2 * detector->candidate_generation - detector->candidate_start &&
+            hash == detector->candidate_hash) {
+            detector->confirmed = true;
+            detector->refining = true;
+            detector->confirmed_hash = hash;
+            detector->confirmed_generation = generation;
+            *start = detector->candidate_start;
+            *period = (uint32_t)(detector->candidate_generation - detector->candidate_start);
+            return true;
+        }
+        detector->candidate_generation = 0; // Two grids which happened to share a hash, or the check was skipped
+    }
+
+    CycleEntry *entry = &detector->history[hash & (CYCLE_HISTORY - 1)];
+    bool seen = entry->epoch == detector->epoch && entry->hash == hash;
+    if (seen && detector->candidate_generation == 0) {
+        detector->candidate_hash = hash;
+        detector->candidate_start = entry->generation;
+        detector->candidate_generation = generation;
+    }
+
+    // Keep the earliest generation with each hash, which is where a cycle through it starts
+    if (!seen) *entry = (CycleEntry){.hash = hash, .generation = generation, .epoch = detector->epoch};
+    return false;
+}
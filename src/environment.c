@@ -5,9 +5,29 @@
  * @version 1.0
  */
 #include "../include/environment.h"
+#include "../include/bitpack.h"
 #include <assert.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+/**
+ * @param env The environment
+ * @return The offset from the start of a grid allocation to cell (0, 0), past the halo.
+ */
+static inline uint64_t halo_offset(Environment const *env) { return (uint64_t)env->stride * ENV_HALO + ENV_HALO; }
+
+/**
+ * Marks the tile containing a cell as changed, so that it and its neighbouring tiles are recalculated next generation.
+ * @param env The environment
+ * @param x The x coordinate of the cell
+ * @param y The y coordinate of the cell
+ */
+static inline void mark_changed(Environment *env, uint32_t x, uint32_t y) {
+    size_t tile = (y / ENV_TILE_HEIGHT) * env->tiles_x + x / ENV_TILE_WIDTH;
+    env->tile_changed[tile] = true;
+    env->tile_dirty[tile] = true;
+}
 
 /**
  * Create the Environment (grid) for cell growth to occur in, starting with all
@@ -16,19 +36,56 @@
  * @param height The height of the environment
  * @return a flattened 2D array of booleans representing the environment
  */
-Environment *env_init(uint32_t width, uint32_t height, uint16_t generation_speed) {
+Environment *env_init(uint32_t width, uint32_t height, uint32_t generation_period) {
 
-    uint64_t size = width * height;
+    uint32_t stride = width + 2 * ENV_HALO;
+    uint64_t size = (uint64_t)stride * (height + 2 * ENV_HALO);
 
     // Create environment
     Environment *env = (Environment *)malloc(sizeof(Environment));
     assert(env != NULL);
 
-    // Create simulation grid and next generation grid
-    env->grid = (bool *)malloc(sizeof(bool) * size);
-    assert(env->grid != NULL);
-    env->_next_generation = (bool *)malloc(sizeof(bool) * size);
-    assert(env->_next_generation != NULL);
+    // Create simulation grid and next generation grid, each surrounded by a halo of wrapped cells
+    env->stride = stride;
+    bool *grid = (bool *)calloc(size, sizeof(bool));
+    assert(grid != NULL);
+    env->grid = grid + halo_offset(env);
+    bool *next_generation = (bool *)calloc(size, sizeof(bool));
+    assert(next_generation != NULL);
+    env->_next_generation = next_generation + halo_offset(env);
+
+    // Create bit-packed mirrors of both grids, 64 cells to a word
+    env->row_words = (width + 63) / 64;
+    env->packed = (uint64_t *)calloc((size_t)env->row_words * height, sizeof(uint64_t));
+    assert(env->packed != NULL);
+    env->_next_packed = (uint64_t *)calloc((size_t)env->row_words * height, sizeof(uint64_t));
+    assert(env->_next_packed != NULL);
+    env->packed_kernel = true;
+    env->analytics = true;
+
+    // Tiles for tracking which regions of the grid are changing
+    env->tiles_x = (width + ENV_TILE_WIDTH - 1) / ENV_TILE_WIDTH;
+    env->tiles_y = (height + ENV_TILE_HEIGHT - 1) / ENV_TILE_HEIGHT;
+    size_t tiles = (size_t)env->tiles_x * env->tiles_y;
+    env->tile_changed = (bool *)calloc(tiles, sizeof(bool));
+    assert(env->tile_changed != NULL);
+    env->_next_tile_changed = (bool *)calloc(tiles, sizeof(bool));
+    assert(env->_next_tile_changed != NULL);
+    env->tile_population = (uint32_t *)calloc(tiles, sizeof(uint32_t));
+    assert(env->tile_population != NULL);
+    env->tile_stale = (bool *)calloc(tiles, sizeof(bool));
+    assert(env->tile_stale != NULL);
+    env->tile_dirty = (bool *)calloc(tiles, sizeof(bool));
+    assert(env->tile_dirty != NULL);
+    env->stepped_packed = false;
+    env->_next_behind = false;
+    env->_step_signature = 0;
+    env->_block_scratch = NULL;
+    env->_block_scratch_size = 0;
+    cycle_init(&env->cycles);
+
+    // Worker threads for calculating generations, one per physical core
+    env->workers = workers_init(workers_default_count());
 
     env->height = height;
     env->width = width;
@@ -38,7 +95,8 @@ Environment *env_init(uint32_t width, uint32_t height, uint16_t generation_speed
     env->data.total_cells = 0;
     env->data.initial_cells = 0;
     env->data.generations = 0;
-    env->data.generation_speed = generation_speed;
+    env->data.generation_period = generation_period;
+    env->data.generation_rate = 0;
     return env;
 }
 
@@ -47,8 +105,18 @@ Environment *env_init(uint32_t width, uint32_t height, uint16_t generation_speed
  * @param env the environment to be freed.
  */
 void env_destroy(Environment *env) {
-    free(env->grid);
-    free(env->_next_generation);
+    workers_destroy(env->workers);
+    cycle_destroy(&env->cycles);
+    free(env->grid - halo_offset(env));
+    free(env->_next_generation - halo_offset(env));
+    free(env->packed);
+    free(env->_next_packed);
+    free(env->tile_changed);
+    free(env->_next_tile_changed);
+    free(env->tile_population);
+    free(env->tile_stale);
+    free(env->tile_dirty);
+    free(env->_block_scratch);
     free(env);
 }
 
@@ -57,28 +125,42 @@ void env_destroy(Environment *env) {
  * @param env The simulation environment to be cleared.
  */
 void env_clear(Environment *env) {
-    uint64_t size = env->width * env->height;
+    uint64_t size = (uint64_t)env->stride * (env->height + 2 * ENV_HALO);
+    bool *grid = env->grid - halo_offset(env);
     for (uint64_t i = 0; i < size; i++) {
-        env->grid[i] = false;
+        grid[i] = false;
+    }
+    env->packed_stale = true;
+    env->grid_stale = false;
+    env_mark_all_changed(env);
+    for (size_t i = 0; i < (size_t)env->tiles_x * env->tiles_y; i++) {
+        env->tile_population[i] = 0;
+        env->tile_stale[i] = false;
+        env->tile_dirty[i] = true;
     }
+    env->hash = 0;
+    env_forget_cycle(env);
 
     // Reset totals
     env->data.initial_cells = 0;
     env->data.total_cells = 0;
     env->data.generations = 0;
+    env->data.extended = false;
+    env->data.population.length = 0;
 }
 
 /* ENVIRONMENT ACCESS & MANIPULATION */
 
 /**
- * Allows indexing of the flattened 2D array environment. WARNING: assumes that coordinates are in bounds.
+ * Allows indexing of the flattened 2D array environment. WARNING: assumes that coordinates are in bounds, and that the
+ * byte-per-cell grid is not behind the bit-packed grid (see bitpack_unpack).
  * @param env The environment to be accessed
  * @param x The x coordinate of the desired cell
  * @param y The y coordinate of the desired cell
  * @return The state of the cell at the provided coordinates.
  */
 bool env_access(Environment const *env, unsigned int x, unsigned int y) {
-    uint64_t i = ((env->width) * y) + x; // Calculate index
+    uint64_t i = ((uint64_t)env->stride * y) + x; // Calculate index
     return env->grid[i];
 }
 
@@ -91,8 +173,46 @@ bool env_access(Environment const *env, unsigned int x, unsigned int y) {
  * @param value The value to be written to the (x, y) location
  */
 void env_write(Environment *env, uint32_t x, uint32_t y, bool value) {
-    uint64_t i = ((env->width) * y) + x; // Calculate index
+    bitpack_unpack(env);
+    uint64_t i = ((uint64_t)env->stride * y) + x; // Calculate index
+    if (env->grid[i] != value) {
+        env->hash ^= cycle_cell_key((uint64_t)env->width * y + x);
+        env_forget_cycle(env);
+    }
     env->grid[i] = value;
+    env->packed_stale = true;
+    mark_changed(env, x, y);
+}
+
+/**
+ * Brings a run of cells in a row to life. Cheaper than writing each cell of a long run with env_write.
+ * WARNING: Assumes that the whole run is in bounds.
+ * @param env The environment in which to fill the run
+ * @param x The x location of the first cell of the run
+ * @param y The y location of the run
+ * @param length The number of cells in the run
+ * @return The number of cells in the run which were dead before
+ */
+uint32_t env_fill_run(Environment *env, uint32_t x, uint32_t y, uint32_t length) {
+    bitpack_unpack(env);
+    bool *row = &env->grid[(uint64_t)env->stride * y];
+    uint64_t row_index = (uint64_t)env->width * y;
+    uint64_t hash = 0;
+    uint32_t born = 0;
+    for (uint32_t i = x; i < x + length; i++) {
+        if (row[i]) continue;
+        row[i] = true;
+        hash ^= cycle_cell_key(row_index + i);
+        born++;
+    }
+    if (born == 0) return 0;
+
+    env->hash ^= hash;
+    env_forget_cycle(env);
+    env->packed_stale = true;
+    for (uint32_t tx = x / ENV_TILE_WIDTH; tx <= (x + length - 1) / ENV_TILE_WIDTH; tx++)
+        mark_changed(env, tx * ENV_TILE_WIDTH, y);
+    return born;
 }
 
 /**
@@ -114,7 +234,8 @@ bool env_in_bounds(Environment const *env, uint32_t x, uint32_t y) {
  * @return The new cell state.
  */
 bool env_toggle_cell(Environment *env, uint32_t x, uint32_t y) {
-    uint64_t i = ((env->width) * y) + x; // Calculate index
+    bitpack_unpack(env);
+    uint64_t i = ((uint64_t)env->stride * y) + x; // Calculate index
 
     // Update stats
     if (env->grid[i]) {
@@ -123,5 +244,307 @@ bool env_toggle_cell(Environment *env, uint32_t x, uint32_t y) {
         env->data.initial_cells--;
     }
     env->grid[i] = !env->grid[i];
+    env->hash ^= cycle_cell_key((uint64_t)env->width * y + x);
+    env_forget_cycle(env);
+    env->packed_stale = true;
+    mark_changed(env, x, y);
     return env->grid[i];
 }
+
+/**
+ * Refreshes the halo around the grid with copies of the cells on the opposite edges, so that neighbours past the edge
+ * of the grid can be read at fixed offsets with the same toroidal wrapping as wrap(). Must be called after the grid
+ * changes and before neighbours are next read.
+ * @param env The environment whose halo should be refreshed
+ */
+void env_refresh_halo(Environment *env) {
+    int64_t width = env->width; // Signed, as grids narrower than the halo reach back past their first column
+
+    // Left and right edges of each row, where each copy may read one made before it when the grid is narrower than
+    // the halo, wrapping around it as many times as it takes
+    for (uint32_t y = 0; y < env->height; y++) {
+        bool *row = &env->grid[(uint64_t)env->stride * y];
+        for (int64_t i = 1; i <= ENV_HALO; i++) {
+            row[-i] = row[width - i];
+            row[width - 1 + i] = row[i - 1];
+        }
+    }
+
+    // Top and bottom rows, including the corners filled in above
+    size_t row_bytes = sizeof(bool) * env->stride;
+    for (int64_t i = 1; i <= ENV_HALO; i++) {
+        bool *top = env->grid - ENV_HALO - (int64_t)env->stride * i;
+        bool *bottom = env->grid - ENV_HALO + (int64_t)env->stride * (env->height - 1 + i);
+        memcpy(top, top + (int64_t)env->stride * env->height, row_bytes);
+        memcpy(bottom, bottom - (int64_t)env->stride * env->height, row_bytes);
+    }
+}
+
+/**
+ * Marks every tile as changed, so that the whole grid is recalculated next generation.
+ * @param env The environment
+ */
+void env_mark_all_changed(Environment *env) {
+    for (size_t i = 0; i < (size_t)env->tiles_x * env->tiles_y; i++) {
+        env->tile_changed[i] = true;
+    }
+}
+
+/**
+ * Checks whether a tile needs to be recalculated in the next generation. A tile whose own cells and whose neighbouring
+ * tiles' cells did not change last generation will calculate exactly the same states again, so it can be skipped.
+ * This relies on the neighbourhood radius being no larger than a tile.
+ * @param env The environment
+ * @param tx The column of the tile
+ * @param ty The row of the tile
+ * @return true if the tile or one of its neighbours (wrapping around the edges) changed in the last generation
+ */
+bool env_tile_active(Environment const *env, uint32_t tx, uint32_t ty) {
+    uint32_t columns[3] = {tx == 0 ? env->tiles_x - 1 : tx - 1, tx, tx + 1 == env->tiles_x ? 0 : tx + 1};
+    uint32_t rows[3] = {ty == 0 ? env->tiles_y - 1 : ty - 1, ty, ty + 1 == env->tiles_y ? 0 : ty + 1};
+    for (unsigned int j = 0; j < 3; j++) {
+        bool const *row = &env->tile_changed[(size_t)rows[j] * env->tiles_x];
+        if (row[columns[0]] || row[columns[1]] || row[columns[2]]) return true;
+    }
+    return false;
+}
+
+/**
+ * Forgets everything learned about the simulation repeating itself, for when it is edited.
+ * @param env The environment
+ */
+void env_forget_cycle(Environment *env) {
+    cycle_reset(&env->cycles);
+    env->data.stable_generation = 0;
+    env->data.period = 0;
+}
+
+/**
+ * Fills the byte-per-cell grid, hash and population of an environment from its bit-packed grid, for when the whole
+ * grid has been replaced. The simulation is treated as edited.
+ * @param env The environment, with its bit-packed grid filled in
+ */
+void env_unpack(Environment *env) {
+    uint64_t hash = 0;
+    uint32_t population = 0;
+    for (uint32_t y = 0; y < env->height; y++) {
+        bool *row = &env->grid[(uint64_t)env->stride * y];
+        uint64_t const *words = &env->packed[(uint64_t)env->row_words * y];
+        for (uint32_t i = 0; i < env->row_words; i++) {
+            uint32_t start = i * 64;
+            uint32_t end = start + 64 < env->width ? start + 64 : env->width;
+            for (uint32_t x = start; x < end; x++)
+                row[x] = (words[i] >> (x - start)) & 1;
+            population += (uint32_t)__builtin_popcountll(words[i]);
+            for (uint64_t cells = words[i]; cells != 0; cells &= cells - 1)
+                hash ^= cycle_cell_key((uint64_t)env->width * y + start + (uint32_t)__builtin_ctzll(cells));
+        }
+    }
+    env->hash = hash;
+    env->data.total_cells = population;
+    env->packed_stale = false;
+    env->grid_stale = false;
+    memset(env->tile_stale, false, (size_t)env->tiles_x * env->tiles_y * sizeof(bool));
+    memset(env->tile_dirty, true, (size_t)env->tiles_x * env->tiles_y * sizeof(bool));
+    env_forget_cycle(env);
+    env_mark_all_changed(env);
+}
+
+/**
+ * Calculates how the hash of a block of the grid changes in the next generation, from only the cells which change.
+ * @param env The environment, with the next generation of the block calculated
+ * @param first_row The first row of the block
+ * @param end_row One past the last row of the block
+ * @param first_col The first column of the block (a multiple of 64 if packed)
+ * @param end_col One past the last column of the block
+ * @param packed Whether to compare the bit-packed grids instead of the byte-per-cell grids
+ * @param changes If not NULL, the number of cells born and the number which die are added to it
+ * @return The keys of every cell which changes state XORed together
+ */
+uint64_t env_hash_changes(Environment const *env, uint32_t first_row, uint32_t end_row, uint32_t first_col,
+                          uint32_t end_col, bool packed, uint32_t changes[2]) {
+    uint64_t hash = 0;
+    uint32_t births = 0, deaths = 0;
+    for (uint32_t y = first_row; y < end_row; y++) {
+        uint64_t row_index = (uint64_t)env->width * y;
+
+        if (packed) {
+            // Each set bit of the difference between the words is a cell which changes
+            uint64_t const *words = &env->packed[(uint64_t)env->row_words * y];
+            uint64_t const *next_words = &env->_next_packed[(uint64_t)env->row_words * y];
+            for (uint32_t i = first_col / 64; i * 64 < end_col; i++) {
+                uint64_t difference = words[i] ^ next_words[i];
+                births += (uint32_t)__builtin_popcountll(difference & next_words[i]);
+                deaths += (uint32_t)__builtin_popcountll(difference & words[i]);
+                for (; difference != 0; difference &= difference - 1)
+                    hash ^= cycle_cell_key(row_index + i * 64 + (uint32_t)__builtin_ctzll(difference));
+            }
+            continue;
+        }
+
+        // Compare eight cells at a time, where each cell which changes sets the lowest bit of its byte
+        bool const *row = &env->grid[(uint64_t)env->stride * y];
+        bool const *next_row = &env->_next_generation[(uint64_t)env->stride * y];
+        uint32_t x = first_col;
+        for (; x + 8 <= end_col; x += 8) {
+            uint64_t cells, next_cells;
+            memcpy(&cells, &row[x], sizeof(cells));
+            memcpy(&next_cells, &next_row[x], sizeof(next_cells));
+            uint64_t difference = cells ^ next_cells;
+            births += (uint32_t)__builtin_popcountll(difference & next_cells);
+            deaths += (uint32_t)__builtin_popcountll(difference & cells);
+            for (; difference != 0; difference &= difference - 1)
+                hash ^= cycle_cell_key(row_index + x + (uint32_t)__builtin_ctzll(difference) / 8);
+        }
+        for (; x < end_col; x++) {
+            if (row[x] == next_row[x]) continue;
+            hash ^= cycle_cell_key(row_index + x);
+            births += next_row[x];
+            deaths += row[x];
+        }
+    }
+    if (changes != NULL) {
+        changes[0] += births;
+        changes[1] += deaths;
+    }
+    return hash;
+}
+
+/**
+ * Finds the first living cell in part of a row.
+ * @param row The row
+ * @param first_col The first column to look in
+ * @param end_col One past the last column to look in
+ * @return The column of the first living cell, or `end_col` if there is none
+ */
+static uint32_t first_alive(bool const *row, uint32_t first_col, uint32_t end_col) {
+    uint32_t x = first_col;
+    for (; x + 8 <= end_col; x += 8) {
+        uint64_t cells;
+        memcpy(&cells, &row[x], sizeof(cells));
+        if (cells != 0) return x + (uint32_t)__builtin_ctzll(cells) / 8;
+    }
+    for (; x < end_col; x++) {
+        if (row[x]) return x;
+    }
+    return end_col;
+}
+
+/**
+ * Finds the last living cell in part of a row.
+ * @param row The row
+ * @param first_col The first column to look in
+ * @param end_col One past the last column to look in
+ * @return One past the column of the last living cell, or `first_col` if there is none
+ */
+static uint32_t end_alive(bool const *row, uint32_t first_col, uint32_t end_col) {
+    uint32_t x = end_col;
+    for (; x >= first_col + 8; x -= 8) {
+        uint64_t cells;
+        memcpy(&cells, &row[x - 8], sizeof(cells));
+        if (cells != 0) return x - (uint32_t)__builtin_clzll(cells) / 8;
+    }
+    for (; x > first_col; x--) {
+        if (row[x - 1]) return x;
+    }
+    return first_col;
+}
+
+/**
+ * Finds the smallest rectangle holding every living cell. The population of each tile narrows it down to the tiles on
+ * its edges, and only the cells of those tiles are searched.
+ * @param env The environment, with the population of each tile up to date
+ * @param first_tx The first column of tiles with a living cell
+ * @param end_tx One past the last column of tiles with a living cell
+ * @param first_ty The first row of tiles with a living cell
+ * @param end_ty One past the last row of tiles with a living cell
+ */
+static void find_box(Environment *env, uint32_t first_tx, uint32_t end_tx, uint32_t first_ty, uint32_t end_ty) {
+    bitpack_unpack_tiles(env, first_tx, end_tx, first_ty, first_ty + 1); // Only the tiles on the edges are read
+    bitpack_unpack_tiles(env, first_tx, end_tx, end_ty - 1, end_ty);
+    bitpack_unpack_tiles(env, first_tx, first_tx + 1, first_ty, end_ty);
+    bitpack_unpack_tiles(env, end_tx - 1, end_tx, first_ty, end_ty);
+    uint32_t first_col = first_tx * ENV_TILE_WIDTH;
+    uint32_t end_col = end_tx * ENV_TILE_WIDTH < env->width ? end_tx * ENV_TILE_WIDTH : env->width;
+    uint32_t top = first_ty * ENV_TILE_HEIGHT;
+    uint32_t bottom = end_ty * ENV_TILE_HEIGHT < env->height ? end_ty * ENV_TILE_HEIGHT : env->height;
+    while (top < bottom && first_alive(&env->grid[(uint64_t)env->stride * top], first_col, end_col) == end_col)
+        top++;
+    while (bottom > top && first_alive(&env->grid[(uint64_t)env->stride * (bottom - 1)], first_col, end_col) == end_col)
+        bottom--;
+
+    // The edge columns are narrowed down row by row, each row only searching past the best found so far
+    uint32_t left = first_col + ENV_TILE_WIDTH < end_col ? first_col + ENV_TILE_WIDTH : end_col;
+    uint32_t right = (end_tx - 1) * ENV_TILE_WIDTH;
+    for (uint32_t y = top; y < bottom; y++) {
+        bool const *row = &env->grid[(uint64_t)env->stride * y];
+        if (left > first_col) left = first_alive(row, first_col, left);
+        if (right < end_col) {
+            uint32_t end = end_alive(row, right, end_col);
+            if (end > right) right = end;
+        }
+    }
+    env->data.box_x = left;
+    env->data.box_y = top;
+    env->data.box_width = right > left ? right - left : 0;
+    env->data.box_height = bottom - top;
+}
+
+/**
+ * Collects the extended analytics of the generation just calculated: the cells born and died, which are counted while
+ * hashing the cells which change, and the regions alive and bounding box, which are found from the population of each
+ * tile. Costs a pass over the tiles and the cells of the tiles on the edge of the bounding box.
+ * @param env The environment, with the population of each tile up to date
+ * @param births The number of cells born in the step
+ * @param deaths The number of cells which died in the step
+ * @param step The number of generations in the step
+ */
+void env_collect_analytics(Environment *env, uint32_t births, uint32_t deaths, uint32_t step) {
+    SimulationAnalytics *data = &env->data;
+    data->extended = true;
+    data->births = births;
+    data->deaths = deaths;
+    data->step = step;
+
+    // The regions alive, and the tiles on the edges of the bounding box
+    uint32_t first_tx = env->tiles_x, end_tx = 0, first_ty = env->tiles_y, end_ty = 0;
+    data->regions = env->tiles_x * env->tiles_y;
+    data->live_regions = 0;
+    data->densest_region = 0;
+    data->densest_area = ENV_TILE_WIDTH * ENV_TILE_HEIGHT;
+    for (uint32_t ty = 0; ty < env->tiles_y; ty++) {
+        uint32_t const *populations = &env->tile_population[(size_t)ty * env->tiles_x];
+        uint32_t first_row = ty * ENV_TILE_HEIGHT;
+        uint32_t end_row = first_row + ENV_TILE_HEIGHT < env->height ? first_row + ENV_TILE_HEIGHT : env->height;
+        for (uint32_t tx = 0; tx < env->tiles_x; tx++) {
+            if (populations[tx] == 0) continue;
+            data->live_regions++;
+
+            // Compared by the share of cells alive, since the tiles on the right and bottom edges may be cut short
+            uint32_t first_col = tx * ENV_TILE_WIDTH;
+            uint32_t end_col = first_col + ENV_TILE_WIDTH < env->width ? first_col + ENV_TILE_WIDTH : env->width;
+            uint32_t area = (end_col - first_col) * (end_row - first_row);
+            if ((uint64_t)populations[tx] * data->densest_area > (uint64_t)data->densest_region * area) {
+                data->densest_region = populations[tx];
+                data->densest_area = area;
+            }
+            if (tx < first_tx) first_tx = tx;
+            if (tx >= end_tx) end_tx = tx + 1;
+            if (ty < first_ty) first_ty = ty;
+            end_ty = ty + 1;
+        }
+    }
+    if (data->live_regions == 0) {
+        data->box_x = data->box_y = data->box_width = data->box_height = 0;
+    } else {
+        find_box(env, first_tx, end_tx, first_ty, end_ty);
+    }
+
+    // The oldest population is shifted out once there is no room for the newest
+    PopulationHistory *population = &data->population;
+    if (population->length == ANALYTICS_HISTORY) {
+        memmove(population->counts, population->counts + 1, (ANALYTICS_HISTORY - 1) * sizeof(uint32_t));
+        population->length--;
+    }
+    population->counts[population->length++] = data->total_cells;
+}
@@ -0,0 +1,193 @@
+/**
+ * Contains the drawing of text from a glyph atlas. Rasterising a string with SDL_ttf and uploading it as a new texture
+ * every frame costs milliseconds, so instead each glyph is rasterised once at startup into one white texture. Text is
+ * laid out as a quad per character, coloured through its vertices, and the whole string is drawn with a single
+ * geometry call. The quads are only rebuilt when the text, its position or its colour change.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/glyphs.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The number of characters in the atlas. */
+#define GLYPH_COUNT (GLYPHS_LAST - GLYPHS_FIRST + 1)
+/** Empty pixels left between glyphs in the atlas, so that scaling never blends in a neighbouring glyph. */
+#define GLYPH_PADDING 1
+
+struct glyph_atlas {
+    SDL_Renderer *renderer;       /**< The renderer drawn with. */
+    SDL_Texture *texture;         /**< Every glyph, white on transparent, side by side. */
+    int width;                    /**< The width of the texture. */
+    int height;                   /**< The height of the texture. */
+    SDL_Rect glyphs[GLYPH_COUNT]; /**< Where each glyph is in the texture. */
+    int advances[GLYPH_COUNT];    /**< How far each glyph moves the pen along. */
+    int line_skip;                /**< The distance between lines of text. */
+    SDL_Vertex *vertices;         /**< Four corners for each character laid out. */
+    int *indices;                 /**< Two triangles for each character laid out. */
+    size_t capacity;              /**< The number of characters `vertices` and `indices` have room for. */
+    size_t count;                 /**< The number of characters laid out. */
+    char *text;                   /**< The text laid out, or NULL. */
+    int x;                        /**< Where the text laid out starts. */
+    int y;                        /**< Where the text laid out starts. */
+    int wrap_width;               /**< The width the text laid out wraps at. */
+    SDL_Color colour;             /**< The colour of the text laid out. */
+};
+
+/**
+ * Finds a character's place in the atlas.
+ * @param c The character
+ * @return The index of the character's glyph
+ */
+static inline unsigned int glyph_index(char c) {
+    if (c < GLYPHS_FIRST || c > GLYPHS_LAST) c = GLYPHS_MISSING;
+    return (unsigned int)(c - GLYPHS_FIRST);
+}
+
+/**
+ * Rasterises every glyph of a font into an atlas texture.
+ * @param renderer The renderer to draw with
+ * @param font The font, which is not needed after the atlas is built
+ * @return The glyph atlas, which must be freed with glyphs_destroy, or NULL if it could not be built
+ */
+GlyphAtlas *glyphs_init(SDL_Renderer *renderer, TTF_Font *font) {
+    GlyphAtlas *atlas = calloc(1, sizeof(GlyphAtlas));
+    assert(atlas != NULL);
+    atlas->renderer = renderer;
+    atlas->line_skip = TTF_FontLineSkip(font);
+
+    // Rasterise every glyph first to find the size of the atlas
+    SDL_Color white = {255, 255, 255, 255};
+    SDL_Surface *surfaces[GLYPH_COUNT];
+    for (unsigned int i = 0; i < GLYPH_COUNT; i++) {
+        surfaces[i] = TTF_RenderGlyph_Solid(font, (Uint16)(GLYPHS_FIRST + i), white);
+        if (TTF_GlyphMetrics(font, (Uint16)(GLYPHS_FIRST + i), NULL, NULL, NULL, NULL, &atlas->advances[i]) != 0)
+            atlas->advances[i] = surfaces[i] != NULL ? surfaces[i]->w : 0;
+        int w = surfaces[i] != NULL ? surfaces[i]->w : 0;
+        int h = surfaces[i] != NULL ? surfaces[i]->h : 0;
+        atlas->glyphs[i] = (SDL_Rect){atlas->width, 0, w, h};
+        atlas->width += w + GLYPH_PADDING;
+        if (h > atlas->height) atlas->height = h;
+    }
+
+    // Copy them side by side into one surface, which becomes the texture
+    SDL_Surface *sheet = SDL_CreateRGBSurfaceWithFormat(0, atlas->width, atlas->height, 32, SDL_PIXELFORMAT_RGBA32);
+    for (unsigned int i = 0; i < GLYPH_COUNT; i++) {
+        if (surfaces[i] == NULL) continue;
+        if (sheet != NULL) SDL_BlitSurface(surfaces[i], NULL, sheet, &atlas->glyphs[i]);
+        SDL_FreeSurface(surfaces[i]);
+    }
+    if (sheet == NULL) {
+        free(atlas);
+        return NULL;
+    }
+    atlas->texture = SDL_CreateTextureFromSurface(renderer, sheet);
+    SDL_FreeSurface(sheet);
+    if (atlas->texture == NULL) {
+        free(atlas);
+        return NULL;
+    }
+    SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+    return atlas;
+}
+
+/**
+ * Frees a glyph atlas and its texture.
+ * @param atlas The glyph atlas to destroy
+ */
+void glyphs_destroy(GlyphAtlas *atlas) {
+    SDL_DestroyTexture(atlas->texture);
+    free(atlas->vertices);
+    free(atlas->indices);
+    free(atlas->text);
+    free(atlas);
+}
+
+/**
+ * Adds a quad for a glyph to the text laid out.
+ * @param atlas The glyph atlas
+ * @param glyph The index of the glyph
+ * @param x The x position of the glyph's top left corner
+ * @param y The y position of the glyph's top left corner
+ */
+static void add_quad(GlyphAtlas *atlas, unsigned int glyph, int x, int y) {
+    SDL_Rect const *source = &atlas->glyphs[glyph];
+    float left = (float)source->x / (float)atlas->width;
+    float right = (float)(source->x + source->w) / (float)atlas->width;
+    float bottom = (float)source->h / (float)atlas->height;
+    float x0 = (float)x, y0 = (float)y, x1 = (float)(x + source->w), y1 = (float)(y + source->h);
+
+    SDL_Vertex *corners = &atlas->vertices[atlas->count * 4];
+    corners[0] = (SDL_Vertex){{x0, y0}, atlas->colour, {left, 0.0f}};
+    corners[1] = (SDL_Vertex){{x1, y0}, atlas->colour, {right, 0.0f}};
+    corners[2] = (SDL_Vertex){{x1, y1}, atlas->colour, {right, bottom}};
+    corners[3] = (SDL_Vertex){{x0, y1}, atlas->colour, {left, bottom}};
+
+    static int const TRIANGLES[6] = {0, 1, 2, 0, 2, 3};
+    int *indices = &atlas->indices[atlas->count * 6];
+    for (unsigned int i = 0; i < 6; i++)
+        indices[i] = (int)atlas->count * 4 + TRIANGLES[i];
+    atlas->count++;
+}
+
+/**
+ * Lays out text to be drawn by glyphs_draw. Nothing is done if the same text was last laid out in the same place.
+ * @param atlas The glyph atlas
+ * @param text The text, which wraps at new lines and at the wrap width
+ * @param x The x position of the top left corner of the text
+ * @param y The y position of the top left corner of the text
+ * @param wrap_width The widest a line can be before wrapping
+ * @param colour The colour of the text
+ */
+void glyphs_layout(GlyphAtlas *atlas, char const *text, int x, int y, int wrap_width, SDL_Color colour) {
+    bool same_colour = atlas->colour.r == colour.r && atlas->colour.g == colour.g && atlas->colour.b == colour.b &&
+                       atlas->colour.a == colour.a;
+    if (atlas->text != NULL && same_colour && atlas->x == x && atlas->y == y && atlas->wrap_width == wrap_width &&
+        strcmp(atlas->text, text) == 0)
+        return; // Already laid out
+
+    size_t length = strlen(text);
+    if (atlas->capacity < length) {
+        atlas->vertices = realloc(atlas->vertices, length * 4 * sizeof(SDL_Vertex));
+        atlas->indices = realloc(atlas->indices, length * 6 * sizeof(int));
+        assert(atlas->vertices != NULL && atlas->indices != NULL);
+        atlas->capacity = length;
+    }
+    free(atlas->text);
+    atlas->text = malloc(length + 1);
+    assert(atlas->text != NULL);
+    memcpy(atlas->text, text, length + 1);
+    atlas->x = x;
+    atlas->y = y;
+    atlas->wrap_width = wrap_width;
+    atlas->colour = colour;
+
+    atlas->count = 0;
+    int pen_x = x, pen_y = y;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            pen_x = x;
+            pen_y += atlas->line_skip;
+            continue;
+        }
+        unsigned int glyph = glyph_index(text[i]);
+        if (pen_x > x && pen_x + atlas->advances[glyph] > x + wrap_width) {
+            pen_x = x; // Too wide for the line
+            pen_y += atlas->line_skip;
+        }
+        if (text[i] != ' ') add_quad(atlas, glyph, pen_x, pen_y);
+        pen_x += atlas->advances[glyph];
+    }
+}
+
+/**
+ * Draws the text last laid out, in a single batch. The current render scale applies.
+ * @param atlas The glyph atlas
+ */
+void glyphs_draw(GlyphAtlas const *atlas) {
+    if (atlas->count == 0) return;
+    SDL_RenderGeometry(atlas->renderer, atlas->texture, atlas->vertices, (int)atlas->count * 4, atlas->indices,
+                       (int)atlas->count * 6);
+}
@@ -0,0 +1,512 @@
+/**
+ * Contains a HashLife engine for Conway's Game of Life (B3/S23 in the Moore neighbourhood), which jumps the simulation
+ * forward by exponentially many generations at a time using a memoised quadtree.
+ *
+ * The universe is a quadtree of canonical nodes: every distinct square of cells is stored exactly once, found through
+ * a hash table keyed on its four quadrants. Each node memoises its successor (its centre half, advanced by some power
+ * of two generations), so repeated structure in space and time is only ever calculated once. Unlike the Environment,
+ * the HashLife universe is an unbounded plane rather than a torus.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/hashlife.h"
+#include "../include/bitpack.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** The number of nodes allocated at once when the free list runs dry. */
+#define SLAB_NODES 4096
+/** The initial number of buckets in the node hash table (must be a power of 2). */
+#define INITIAL_BUCKETS (1 << 16)
+/** The number of nodes which triggers the first garbage collection. */
+#define INITIAL_GC_THRESHOLD (1 << 20)
+/** The highest level a node can have, keeping all coordinates well within 64 bits. */
+#define MAX_LEVEL 60
+
+typedef struct node Node;
+
+/** A square of 2^level by 2^level cells. Level 0 nodes are single cells. */
+struct node {
+    Node *nw, *ne, *sw, *se; /**< The four quadrants of the node, or NULL for a single cell. */
+    Node *result;            /**< The memoised successor of the node, or NULL. */
+    Node *next;              /**< The next node in the hash bucket, or in the free list. */
+    uint64_t population;     /**< The number of living cells in the node. */
+    uint8_t level;           /**< The level of the node. */
+    int8_t result_step;      /**< The step (as a power of 2) the memoised successor is for. */
+    bool marked;             /**< Used to mark reachable nodes during garbage collection. */
+};
+
+/** A block of allocated nodes. */
+typedef struct slab {
+    struct slab *next;      /**< The next slab. */
+    Node nodes[SLAB_NODES]; /**< The nodes in this slab. */
+} Slab;
+
+struct hashlife {
+    Node **buckets;             /**< The hash table of canonical nodes. */
+    size_t bucket_count;        /**< The number of buckets in the hash table. */
+    size_t node_count;          /**< The number of nodes in the hash table. */
+    size_t gc_threshold;        /**< The node count at which the next garbage collection happens. */
+    Slab *slabs;                /**< All allocated slabs. */
+    Node *free_list;            /**< Nodes which can be reused. */
+    Node dead;                  /**< The dead cell. */
+    Node alive;                 /**< The living cell. */
+    Node *empty[MAX_LEVEL + 1]; /**< Canonical empty nodes of each level. */
+    Node *root;                 /**< The universe, centred on the origin. */
+    int64_t origin_x;           /**< The x coordinate of the imported environment's cell (0, 0). */
+    int64_t origin_y;           /**< The y coordinate of the imported environment's cell (0, 0). */
+};
+
+/* NODE STORAGE */
+
+/**
+ * @param nw The north-west quadrant
+ * @param ne The north-east quadrant
+ * @param sw The south-west quadrant
+ * @param se The south-east quadrant
+ * @return The hash of a node with these quadrants
+ */
+static inline size_t node_hash(Node const *nw, Node const *ne, Node const *sw, Node const *se) {
+    uint64_t hash = (uint64_t)(uintptr_t)nw;
+    hash = hash * 0x9E3779B97F4A7C15ULL + (uint64_t)(uintptr_t)ne;
+    hash = hash * 0x9E3779B97F4A7C15ULL + (uint64_t)(uintptr_t)sw;
+    hash = hash * 0x9E3779B97F4A7C15ULL + (uint64_t)(uintptr_t)se;
+    return (size_t)(hash ^ (hash >> 29));
+}
+
+/**
+ * Doubles the number of buckets in the hash table.
+ * @param hl The HashLife universe
+ */
+static void grow_table(HashLife *hl) {
+    size_t bucket_count = hl->bucket_count * 2;
+    Node **buckets = (Node **)calloc(bucket_count, sizeof(Node *));
+    assert(buckets != NULL);
+
+    for (size_t i = 0; i < hl->bucket_count; i++) {
+        Node *node = hl->buckets[i];
+        while (node != NULL) {
+            Node *next = node->next;
+            size_t bucket = node_hash(node->nw, node->ne, node->sw, node->se) & (bucket_count - 1);
+            node->next = buckets[bucket];
+            buckets[bucket] = node;
+            node = next;
+        }
+    }
+    free(hl->buckets);
+    hl->buckets = buckets;
+    hl->bucket_count = bucket_count;
+}
+
+/**
+ * Finds the canonical node with the given quadrants, creating it if it does not exist yet.
+ * @param hl The HashLife universe
+ * @param nw The north-west quadrant
+ * @param ne The north-east quadrant
+ * @param sw The south-west quadrant
+ * @param se The south-east quadrant
+ * @return The canonical node
+ */
+static Node *join(HashLife *hl, Node *nw, Node *ne, Node *sw, Node *se) {
+    size_t bucket = node_hash(nw, ne, sw, se) & (hl->bucket_count - 1);
+    for (Node *node = hl->buckets[bucket]; node != NULL; node = node->next) {
+        if (node->nw == nw && node->ne == ne && node->sw == sw && node->se == se) return node;
+    }
+
+    // Allocate a new node, refilling the free list a slab at a time
+    if (hl->free_list == NULL) {
+        Slab *slab = (Slab *)malloc(sizeof(Slab));
+        assert(slab != NULL);
+        slab->next = hl->slabs;
+        hl->slabs = slab;
+        for (size_t i = 0; i < SLAB_NODES; i++) {
+            slab->nodes[i].next = hl->free_list;
+            hl->free_list = &slab->nodes[i];
+        }
+    }
+    Node *node = hl->free_list;
+    hl->free_list = node->next;
+
+    *node = (Node){.nw = nw, .ne = ne, .sw = sw, .se = se, .result = NULL, .result_step = -1, .marked = false};
+    node->level = nw->level + 1;
+    node->population = nw->population + ne->population + sw->population + se->population;
+    node->next = hl->buckets[bucket];
+    hl->buckets[bucket] = node;
+
+    if (++hl->node_count > hl->bucket_count) grow_table(hl);
+    return node;
+}
+
+/**
+ * @param hl The HashLife universe
+ * @param level The level of the empty node
+ * @return The canonical empty node of the given level
+ */
+static Node *empty(HashLife *hl, unsigned int level) {
+    if (hl->empty[level] == NULL) {
+        Node *quadrant = empty(hl, level - 1);
+        hl->empty[level] = join(hl, quadrant, quadrant, quadrant, quadrant);
+    }
+    return hl->empty[level];
+}
+
+/* GARBAGE COLLECTION */
+
+/**
+ * Marks a node and everything reachable from it (quadrants and memoised results) as in use.
+ * @param node The node to mark
+ */
+static void mark(Node *node) {
+    if (node == NULL || node->marked || node->level == 0) return;
+    node->marked = true;
+    mark(node->nw);
+    mark(node->ne);
+    mark(node->sw);
+    mark(node->se);
+    mark(node->result);
+}
+
+/**
+ * Frees every node which is not reachable from the root or the empty nodes.
+ * @param hl The HashLife universe
+ */
+static void collect_garbage(HashLife *hl) {
+    mark(hl->root);
+    for (unsigned int level = 0; level <= MAX_LEVEL; level++)
+        mark(hl->empty[level]);
+
+    hl->node_count = 0;
+    for (size_t i = 0; i < hl->bucket_count; i++) {
+        Node **link = &hl->buckets[i];
+        while (*link != NULL) {
+            Node *node = *link;
+            if (node->marked) {
+                node->marked = false;
+                hl->node_count++;
+                link = &node->next;
+            } else {
+                *link = node->next;
+                node->next = hl->free_list;
+                hl->free_list = node;
+            }
+        }
+    }
+
+    // Leave plenty of room before collecting again
+    if (hl->gc_threshold < hl->node_count * 2) hl->gc_threshold = hl->node_count * 2;
+}
+
+/* EVOLUTION */
+
+/**
+ * @param hl The HashLife universe
+ * @param node A node of level 2 or higher
+ * @return The centre half of the node, without advancing it
+ */
+static Node *centre(HashLife *hl, Node const *node) {
+    return join(hl, node->nw->se, node->ne->sw, node->sw->ne, node->se->nw);
+}
+
+/**
+ * Advances a 4x4 node by one generation.
+ * @param hl The HashLife universe
+ * @param node A node of level 2
+ * @return The centre 2x2 cells of the node, one generation later
+ */
+static Node *successor_4x4(HashLife *hl, Node const *node) {
+
+    // Unpack the 16 cells into a bitmap, row by row
+    Node const *quadrants[4] = {node->nw, node->ne, node->sw, node->se};
+    uint16_t cells = 0;
+    for (unsigned int q = 0; q < 4; q++) {
+        Node const *cell[4] = {quadrants[q]->nw, quadrants[q]->ne, quadrants[q]->sw, quadrants[q]->se};
+        for (unsigned int c = 0; c < 4; c++) {
+            unsigned int x = (q % 2) * 2 + c % 2;
+            unsigned int y = (q / 2) * 2 + c / 2;
+            cells |= (uint16_t)(cell[c]->population << (y * 4 + x));
+        }
+    }
+
+    // Apply B3/S23 to the four centre cells
+    Node *next[4];
+    for (unsigned int c = 0; c < 4; c++) {
+        unsigned int x = 1 + c % 2;
+        unsigned int y = 1 + c / 2;
+        unsigned int neighbours = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                if (dx != 0 || dy != 0) neighbours += (cells >> ((y + dy) * 4 + (x + dx))) & 1;
+            }
+        }
+        bool alive = (cells >> (y * 4 + x)) & 1;
+        next[c] = neighbours == 3 || (alive && neighbours == 2) ? &hl->alive : &hl->dead;
+    }
+    return join(hl, next[0], next[1], next[2], next[3]);
+}
+
+/**
+ * Calculates the successor of a node: its centre half advanced by 2^step generations.
+ * @param hl The HashLife universe
+ * @param node A node of level 2 or higher
+ * @param step The number of generations to advance as a power of 2, at most the node's level - 2
+ * @return The successor, one level lower than the node
+ */
+static Node *successor(HashLife *hl, Node *node, unsigned int step) {
+    if (node->result != NULL && node->result_step == (int8_t)step) return node->result;
+    if (node->population == 0) return empty(hl, node->level - 1);
+
+    Node *result;
+    if (node->level == 2) {
+        result = successor_4x4(hl, node);
+    } else {
+
+        // Nine overlapping sub-squares, each half the size of the node
+        Node *n00 = node->nw, *n02 = node->ne, *n20 = node->sw, *n22 = node->se;
+        Node *n01 = join(hl, node->nw->ne, node->ne->nw, node->nw->se, node->ne->sw);
+        Node *n10 = join(hl, node->nw->sw, node->nw->se, node->sw->nw, node->sw->ne);
+        Node *n11 = join(hl, node->nw->se, node->ne->sw, node->sw->ne, node->se->nw);
+        Node *n12 = join(hl, node->ne->sw, node->ne->se, node->se->nw, node->se->ne);
+        Node *n21 = join(hl, node->sw->ne, node->se->nw, node->sw->se, node->se->sw);
+        Node *squares[9] = {n00, n01, n02, n10, n11, n12, n20, n21, n22};
+
+        // At full speed both halves of the step advance time, otherwise only the second half does
+        bool full_speed = step == node->level - 2u;
+        Node *c[9];
+        for (unsigned int i = 0; i < 9; i++)
+            c[i] = full_speed ? successor(hl, squares[i], step - 1) : centre(hl, squares[i]);
+
+        unsigned int second_step = full_speed ? step - 1 : step;
+        result = join(hl, successor(hl, join(hl, c[0], c[1], c[3], c[4]), second_step),
+                      successor(hl, join(hl, c[1], c[2], c[4], c[5]), second_step),
+                      successor(hl, join(hl, c[3], c[4], c[6], c[7]), second_step),
+                      successor(hl, join(hl, c[4], c[5], c[7], c[8]), second_step));
+    }
+
+    node->result = result;
+    node->result_step = (int8_t)step;
+    return result;
+}
+
+/**
+ * Surrounds the root with empty space, doubling its size while keeping it centred on the origin.
+ * @param hl The HashLife universe
+ */
+static void expand(HashLife *hl) {
+    Node *root = hl->root;
+    Node *e = empty(hl, root->level - 1);
+    hl->root = join(hl, join(hl, e, e, e, root->nw), join(hl, e, e, root->ne, e), join(hl, e, root->sw, e, e),
+                    join(hl, root->se, e, e, e));
+}
+
+/* PUBLIC INTERFACE */
+
+/**
+ * Creates an empty HashLife universe.
+ * @return The HashLife universe
+ */
+HashLife *hashlife_init(void) {
+    HashLife *hl = (HashLife *)malloc(sizeof(HashLife));
+    assert(hl != NULL);
+
+    hl->bucket_count = INITIAL_BUCKETS;
+    hl->buckets = (Node **)calloc(hl->bucket_count, sizeof(Node *));
+    assert(hl->buckets != NULL);
+    hl->node_count = 0;
+    hl->gc_threshold = INITIAL_GC_THRESHOLD;
+    hl->slabs = NULL;
+    hl->free_list = NULL;
+
+    hl->dead = (Node){.level = 0, .population = 0, .result_step = -1};
+    hl->alive = (Node){.level = 0, .population = 1, .result_step = -1};
+    for (unsigned int level = 0; level <= MAX_LEVEL; level++)
+        hl->empty[level] = NULL;
+    hl->empty[0] = &hl->dead;
+
+    hl->root = empty(hl, 3);
+    hl->origin_x = 0;
+    hl->origin_y = 0;
+    return hl;
+}
+
+/**
+ * Destroys a HashLife universe.
+ * @param hl The HashLife universe to be freed
+ */
+void hashlife_destroy(HashLife *hl) {
+    while (hl->slabs != NULL) {
+        Slab *next = hl->slabs->next;
+        free(hl->slabs);
+        hl->slabs = next;
+    }
+    free(hl->buckets);
+    free(hl);
+}
+
+/**
+ * Builds the node covering a square of the environment.
+ * @param hl The HashLife universe
+ * @param env The environment being imported
+ * @param level The level of the node to build
+ * @param x The x coordinate of the square's top left corner in the environment
+ * @param y The y coordinate of the square's top left corner in the environment
+ * @return The node
+ */
+static Node *build(HashLife *hl, Environment const *env, unsigned int level, int64_t x, int64_t y) {
+    int64_t size = (int64_t)1 << level;
+    if (x >= env->width || y >= env->height || x + size <= 0 || y + size <= 0) return empty(hl, level);
+    if (level == 0) return env_access(env, (uint32_t)x, (uint32_t)y) ? &hl->alive : &hl->dead;
+
+    int64_t half = size / 2;
+    return join(hl, build(hl, env, level - 1, x, y), build(hl, env, level - 1, x + half, y),
+                build(hl, env, level - 1, x, y + half), build(hl, env, level - 1, x + half, y + half));
+}
+
+/**
+ * Replaces the universe with the contents of an environment, centred on the origin.
+ * @param hl The HashLife universe
+ * @param env The environment to import, with its byte-per-cell grid up to date (see bitpack_unpack)
+ */
+void hashlife_import(HashLife *hl, Environment const *env) {
+    uint32_t size = env->width > env->height ? env->width : env->height;
+    unsigned int level = 3;
+    while (((uint64_t)1 << level) < size)
+        level++;
+
+    int64_t half = (int64_t)1 << (level - 1);
+    hl->origin_x = -half;
+    hl->origin_y = -half;
+    hl->root = build(hl, env, level, 0, 0);
+}
+
+/**
+ * Advances the universe by 2^log2_generations generations.
+ * @param hl The HashLife universe
+ * @param log2_generations The number of generations to advance, as a power of 2
+ */
+void hashlife_step(HashLife *hl, unsigned int log2_generations) {
+    assert(log2_generations <= HASHLIFE_MAX_STEP_LOG2);
+
+    // Grow until the pattern sits in the middle quarter of a root big enough to take the step in one successor, so
+    // nothing can travel out of the successor's square
+    while (hl->root->level < log2_generations + 3 ||
+           centre(hl, centre(hl, hl->root))->population != hl->root->population)
+        expand(hl);
+
+    hl->root = successor(hl, hl->root, log2_generations);
+    if (hl->node_count > hl->gc_threshold) collect_garbage(hl);
+}
+
+/**
+ * @param hl The HashLife universe
+ * @return The number of living cells in the universe
+ */
+uint64_t hashlife_population(HashLife const *hl) { return hl->root->population; }
+
+/**
+ * Writes the living cells of a node into the environment, skipping those which fall outside of it.
+ * @param node The node to write
+ * @param env The environment to write into
+ * @param x The x coordinate of the node's top left corner in the environment
+ * @param y The y coordinate of the node's top left corner in the environment
+ * @return The number of living cells written
+ */
+static uint32_t write_node(Node const *node, Environment *env, int64_t x, int64_t y) {
+    int64_t size = (int64_t)1 << node->level;
+    if (node->population == 0) return 0;
+    if (x >= env->width || y >= env->height || x + size <= 0 || y + size <= 0) return 0;
+    if (node->level == 0) {
+        env_write(env, (uint32_t)x, (uint32_t)y, true);
+        return 1;
+    }
+
+    int64_t half = size / 2;
+    return write_node(node->nw, env, x, y) + write_node(node->ne, env, x + half, y) +
+           write_node(node->sw, env, x, y + half) + write_node(node->se, env, x + half, y + half);
+}
+
+/**
+ * Replaces the cells of an environment with the universe, at the position it was imported from. Cells which have
+ * travelled outside of the environment are not written.
+ * @param hl The HashLife universe
+ * @param env The environment to write to
+ * @return The number of living cells written to the environment
+ */
+uint32_t hashlife_export(HashLife const *hl, Environment *env) {
+
+    // Clear the cells but not the analytics
+    SimulationAnalytics data = env->data;
+    env_clear(env);
+    env->data = data;
+
+    int64_t half = (int64_t)1 << (hl->root->level - 1);
+    return write_node(hl->root, env, -half - hl->origin_x, -half - hl->origin_y);
+}
+
+/**
+ * Finds the smallest rectangle holding every living cell of a node, skipping nodes which cannot widen it.
+ * @param node The node to search
+ * @param x The x coordinate of the node's top left corner
+ * @param y The y coordinate of the node's top left corner
+ * @param bounds The left, top, right and bottom edges found so far (right and bottom exclusive), which are widened
+ */
+static void find_bounds(Node const *node, int64_t x, int64_t y, int64_t bounds[4]) {
+    int64_t size = (int64_t)1 << node->level;
+    if (node->population == 0) return;
+    if (x >= bounds[0] && y >= bounds[1] && x + size <= bounds[2] && y + size <= bounds[3]) return;
+    if (node->level == 0) {
+        if (x < bounds[0]) bounds[0] = x;
+        if (y < bounds[1]) bounds[1] = y;
+        if (x + 1 > bounds[2]) bounds[2] = x + 1;
+        if (y + 1 > bounds[3]) bounds[3] = y + 1;
+        return;
+    }
+
+    int64_t half = size / 2;
+    find_bounds(node->nw, x, y, bounds);
+    find_bounds(node->ne, x + half, y, bounds);
+    find_bounds(node->sw, x, y + half, bounds);
+    find_bounds(node->se, x + half, y + half, bounds);
+}
+
+/**
+ * Jumps an environment forward by a number of generations of Conway's Game of Life, updating its analytics. HashLife
+ * simulates an unbounded plane rather than the environment's torus, so each jump only goes as far as nothing can reach
+ * the edges of the grid: no cell travels faster than one cell a generation, so the bounding box of the living cells
+ * grown by the number of generations jumped must stay inside the grid. The largest power of 2 generations which fits
+ * is jumped, over and over, until the generations are done or the living cells are too close to an edge to jump.
+ * @param hl The HashLife universe to calculate the jumps in
+ * @param env The environment to advance
+ * @param generations The number of generations to advance
+ * @return The number of generations jumped, which the caller must calculate the rest of
+ */
+uint64_t hashlife_jump(HashLife *hl, Environment *env, uint64_t generations) {
+    uint64_t jumped = 0;
+    while (jumped < generations) {
+        bitpack_unpack(env);
+        hashlife_import(hl, env);
+
+        // The largest step which fits in the generations left and in the room around the living cells
+        uint64_t left = generations - jumped;
+        int64_t room = INT64_MAX;
+        if (hl->root->population != 0) {
+            int64_t bounds[4] = {INT64_MAX, INT64_MAX, INT64_MIN, INT64_MIN};
+            find_bounds(hl->root, 0, 0, bounds); // The root was built with its corner on the environment's
+            int64_t margins[4] = {bounds[0], bounds[1], env->width - bounds[2], env->height - bounds[3]};
+            for (unsigned int i = 0; i < 4; i++)
+                if (margins[i] < room) room = margins[i];
+        }
+        if (room < 1) break;
+        unsigned int log2_generations = 0;
+        while (log2_generations < HASHLIFE_MAX_STEP_LOG2 && ((uint64_t)2 << log2_generations) <= left &&
+               ((int64_t)2 << log2_generations) <= room)
+            log2_generations++;
+
+        hashlife_step(hl, log2_generations);
+        env->data.total_cells = hashlife_export(hl, env);
+        env->data.generations += (uint64_t)1 << log2_generations;
+        jumped += (uint64_t)1 << log2_generations;
+    }
+    return jumped;
+}
@@ -0,0 +1,208 @@
+/**
+ * Runs a simulation without a display, for batch runs and throughput measurements. A pattern is loaded into the middle
+ * of the grid, advanced by a number of generations as fast as possible, and the final grid is written out along with
+ * its simulation analytics.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/patterns.h"
+#include "../include/rules.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_SIZE 1024
+#define DEFAULT_GENERATIONS 1000
+
+/** Options for a headless run. */
+typedef struct {
+    uint32_t width;       /**< The width of the grid. */
+    uint32_t height;      /**< The height of the grid. */
+    uint64_t generations; /**< The number of generations to advance by. */
+    CellType cell_type;   /**< The cell type to simulate. */
+    char const *pattern;  /**< The path of the pattern to start from. */
+    char const *output;   /**< The path to write the final grid to, or NULL for standard output. */
+    bool packed_kernel;   /**< Whether to use the bit-packed kernel where possible. */
+    bool analytics;       /**< Whether to collect the extended analytics. */
+} HeadlessOptions;
+
+static HeadlessOptions options = {
+    .width = DEFAULT_SIZE,
+    .height = DEFAULT_SIZE,
+    .generations = DEFAULT_GENERATIONS,
+    .cell_type = ConwayCell,
+    .pattern = NULL,
+    .output = NULL,
+    .packed_kernel = true,
+    .analytics = true,
+};
+
+// Helper functions
+bool parse_arguments(int argc, char *argv[]);
+bool write_grid(Environment const *env, CellType const *cell_type, char const *path);
+
+int main(int argc, char *argv[]) {
+
+    if (!parse_arguments(argc, argv)) return EXIT_FAILURE;
+    if (!cell_type_compile(&options.cell_type)) {
+        fprintf(stderr, "Invalid rule '%s'.\n", options.cell_type.rulestring);
+        return EXIT_FAILURE;
+    }
+
+    Environment *env = env_init(options.width, options.height, 0);
+    env->packed_kernel = options.packed_kernel;
+    env->analytics = options.analytics;
+    if (!pattern_load(env, options.pattern)) {
+        fprintf(stderr, "Could not load pattern '%s'.\n", options.pattern);
+        env_destroy(env);
+        return EXIT_FAILURE;
+    }
+
+    // Run as fast as possible. The pattern starts with no history, so the generations up to the first repeat are
+    // calculated, and the whole periods after it are skipped
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t skipped = fast_forward(env, &options.cell_type, options.generations);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1000000000;
+
+    bitpack_unpack(env); // The bit-packed kernel leaves the byte-per-cell grid behind
+    bool written = write_grid(env, &options.cell_type, options.output);
+    fprintf(stderr,
+            "%" PRIu64 " generations of %" PRIu32 "x%" PRIu32 " cells in %.3fs (%.1f generations/s), %" PRIu64
+            " skipped as repeats\n",
+            options.generations, options.width, options.height, seconds,
+            seconds > 0 ? (double)options.generations / seconds : 0, skipped);
+
+    env_destroy(env);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Writes the grid in the plaintext format, with the simulation analytics as comments at the top.
+ * @param env The environment to write
+ * @param cell_type The cell type that was simulated
+ * @param path The path to write to, or NULL for standard output
+ * @return true if the grid was written, false otherwise
+ */
+bool write_grid(Environment const *env, CellType const *cell_type, char const *path) {
+
+    FILE *file = path == NULL ? stdout : fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open output '%s'.\n", path);
+        return false;
+    }
+
+    // One comment line per line of analytics
+    char *analytics = NULL;
+    populate_analytics_string(&analytics, env, cell_type);
+    for (char *line = strtok(analytics, "\n"); line != NULL; line = strtok(NULL, "\n"))
+        fprintf(file, "!%s\n", line);
+    free(analytics);
+
+    char *row = malloc((size_t)env->width + 1);
+    assert(row != NULL);
+    row[env->width] = '\n';
+    for (uint32_t y = 0; y < env->height; y++) {
+        for (uint32_t x = 0; x < env->width; x++)
+            row[x] = env_access(env, x, y) ? 'O' : '.';
+        fwrite(row, 1, (size_t)env->width + 1, file);
+    }
+    free(row);
+
+    bool written = !ferror(file);
+    if (file != stdout) written = fclose(file) == 0 && written;
+    if (!written) fprintf(stderr, "Could not write output '%s'.\n", path == NULL ? "-" : path);
+    return written;
+}
+
+/**
+ * Parses the command line options. `--size <width>x<height>` sets the size of the grid, `--generations <n>` the number
+ * of generations to advance by, `--cell-type <name>` picks one of the included cell types, `--rule <rulestring>` and
+ * `--neighbourhood <name>` simulate a Life-like rule instead, `--pattern <path>` (required) is the pattern to start
+ * from (plaintext, RLE or Macrocell), `--output <path>` is where the final grid is written (standard output by
+ * default), `--no-packed` turns off the bit-packed kernel and `--no-analytics` stops the extended analytics being
+ * collected.
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return true if the options were valid, false otherwise
+ */
+bool parse_arguments(int argc, char *argv[]) {
+
+    bool rule = false, neighbourhood = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--no-packed") == 0) {
+            options.packed_kernel = false;
+            continue;
+        }
+        if (strcmp(argv[i], "--no-analytics") == 0) {
+            options.analytics = false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for option '%s'.\n", argv[i]);
+            return false;
+        }
+
+        char const *value = argv[i + 1];
+        if (strcmp(argv[i], "--size") == 0) {
+            if (sscanf(value, "%" SCNu32 "x%" SCNu32, &options.width, &options.height) != 2 || options.width == 0 ||
+                options.height == 0) {
+                fprintf(stderr, "Invalid size '%s', expected <width>x<height>.\n", value);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--generations") == 0) {
+            char *end;
+            options.generations = strtoull(value, &end, 10);
+            if (*end != '\0' || end == value || value[0] == '-') { // strtoull accepts and negates a minus sign
+                fprintf(stderr, "Invalid generation count '%s'.\n", value);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--cell-type") == 0) {
+            CellType const *cell_type = cell_type_by_name(value);
+            if (cell_type == NULL) {
+                fprintf(stderr, "Unknown cell type '%s'.\n", value);
+                return false;
+            }
+            options.cell_type = *cell_type;
+        } else if (strcmp(argv[i], "--rule") == 0) {
+            options.cell_type.name = value;
+            options.cell_type.rulestring = value;
+            options.cell_type.calculator = NULL;
+            options.cell_type.split.next_state = NULL;
+            rule = true;
+        } else if (strcmp(argv[i], "--neighbourhood") == 0) {
+            neighbourhood = true;
+            options.cell_type.neighbourhood = neighbourhood_by_name(value);
+            if (options.cell_type.neighbourhood == NULL) {
+                fprintf(stderr, "Unknown neighbourhood '%s'.\n", value);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--pattern") == 0) {
+            options.pattern = value;
+        } else if (strcmp(argv[i], "--output") == 0) {
+            options.output = value;
+        } else {
+            fprintf(stderr, "Unknown option '%s'.\n", argv[i]);
+            return false;
+        }
+        i++;
+    }
+
+    if (neighbourhood && !rule) {
+        fprintf(stderr, "A neighbourhood can only be chosen for a rule given with '--rule'.\n");
+        return false;
+    }
+    if (options.pattern == NULL) {
+        fprintf(stderr, "Usage: %s --pattern <path> [--size <width>x<height>] [--generations <n>] "
+                        "[--cell-type <name> | --rule <rulestring> [--neighbourhood <name>]] [--output <path>] "
+                        "[--no-packed] [--no-analytics]\n",
+                argv[0]);
+        return false;
+    }
+    return true;
+}
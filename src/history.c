@@ -0,0 +1,392 @@
+/**
+ * Contains the history of recent generations, for stepping the simulation backwards. Calculating a generation swaps
+ * the grids and overwrites the older one, so after each generation the cells which differ between the two grids are
+ * collected from the tiles which changed. Toggling the same cells again steps back (or forward) a generation, so a
+ * generation costs memory in proportion to how much of the grid changed rather than to the size of the grid.
+ *
+ * Generations are kept in a ring buffer, and the oldest are dropped once the buffer is full or the memory budget is
+ * spent. Every HISTORY_KEYFRAME_INTERVAL generations a bit-packed copy of the whole grid is kept as well, which seeking
+ * restores instead of replaying long runs of changes.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/history.h"
+#include "../include/bitpack.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Replaying a changed cell costs about as much as restoring this many cells of a copy of the grid. */
+#define KEYFRAME_CELL_COST 16
+
+/** A generation remembered by the history. */
+typedef struct {
+    uint64_t generation; /**< The generation. */
+    uint64_t hash;       /**< The hash of the grid at the generation. */
+    uint32_t population; /**< The number of living cells at the generation. */
+    uint32_t changes;    /**< The number of cells which changed since the generation before. */
+    uint32_t *cells;     /**< The index (y * width + x) of each cell which changed since the generation before. */
+    uint64_t *keyframe;  /**< A bit-packed copy of the grid at the generation, or NULL if none was kept. */
+} HistoryEntry;
+
+/** The generations remembered, in a ring buffer. */
+struct history {
+    HistoryEntry *entries;   /**< The ring buffer of generations. */
+    uint32_t first;          /**< The position of the oldest generation in the ring buffer. */
+    uint32_t count;          /**< The number of generations remembered, which follow one another. */
+    uint32_t cursor;         /**< The generation the environment is at, counted from the oldest. */
+    uint32_t width;          /**< The width of the grid the generations belong to. */
+    uint32_t height;         /**< The height of the grid the generations belong to. */
+    size_t keyframe_size;    /**< The number of bytes in a copy of the grid. */
+    size_t memory;           /**< The number of bytes of changed cells and grid copies held. */
+    size_t budget;           /**< The number of bytes held before the oldest generations are dropped. */
+    uint32_t *scratch;       /**< Collects the cells which changed in the newest generation. */
+    size_t scratch_capacity; /**< The number of cells the scratch buffer has room for. */
+};
+
+/**
+ * Creates an empty history.
+ * @param memory The number of bytes of changed cells and grid copies to hold before dropping the oldest generations
+ * @return The history, which must be freed with history_destroy
+ */
+History *history_init(size_t memory) {
+    History *history = (History *)calloc(1, sizeof(History));
+    assert(history != NULL);
+    history->entries = (HistoryEntry *)calloc(HISTORY_GENERATIONS, sizeof(HistoryEntry));
+    assert(history->entries != NULL);
+    history->budget = memory;
+    return history;
+}
+
+/**
+ * Finds a remembered generation.
+ * @param history The history
+ * @param i The generation, counted from the oldest
+ * @return The generation's entry in the ring buffer
+ */
+static inline HistoryEntry *entry(History const *history, uint32_t i) {
+    return &history->entries[(history->first + i) & (HISTORY_GENERATIONS - 1)];
+}
+
+/**
+ * Frees the changed cells and grid copy of a generation.
+ * @param history The history
+ * @param entry The generation
+ */
+static void release(History *history, HistoryEntry *entry) {
+    history->memory -= (size_t)entry->changes * sizeof(uint32_t);
+    if (entry->keyframe != NULL) history->memory -= history->keyframe_size;
+    free(entry->cells);
+    free(entry->keyframe);
+    entry->cells = NULL;
+    entry->keyframe = NULL;
+    entry->changes = 0;
+}
+
+/**
+ * Forgets the oldest generation. The changes leading to the generation after it are freed too, since there is no
+ * longer a generation to step back to with them.
+ * @param history The history, which must hold more than one generation
+ */
+static void drop_oldest(History *history) {
+    release(history, entry(history, 0));
+    history->first = (history->first + 1) & (HISTORY_GENERATIONS - 1);
+    history->count--;
+    history->cursor--;
+
+    HistoryEntry *oldest = entry(history, 0);
+    history->memory -= (size_t)oldest->changes * sizeof(uint32_t);
+    free(oldest->cells);
+    oldest->cells = NULL;
+    oldest->changes = 0;
+}
+
+/**
+ * Keeps a copy of the grid with a generation, if the copy is small enough next to the memory budget.
+ * @param history The history
+ * @param env The environment at the generation
+ * @param entry The generation
+ */
+static void keep_keyframe(History *history, Environment *env, HistoryEntry *entry) {
+    if (history->keyframe_size > history->budget / 8) return; // Would crowd out the changes
+    bitpack_sync(env);
+    entry->keyframe = (uint64_t *)malloc(history->keyframe_size);
+    assert(entry->keyframe != NULL);
+    memcpy(entry->keyframe, env->packed, history->keyframe_size);
+    history->memory += history->keyframe_size;
+}
+
+/**
+ * Forgets every generation, and starts the history over from the environment's current generation.
+ * @param history The history
+ * @param env The environment
+ */
+static void restart(History *history, Environment *env) {
+    for (uint32_t i = 0; i < history->count; i++)
+        release(history, entry(history, i));
+    history->first = 0;
+    history->count = 1;
+    history->cursor = 0;
+    history->width = env->width;
+    history->height = env->height;
+    history->keyframe_size = (size_t)env->row_words * env->height * sizeof(uint64_t);
+
+    HistoryEntry *present = entry(history, 0);
+    present->generation = env->data.generations;
+    present->hash = env->hash;
+    present->population = env->data.total_cells;
+    keep_keyframe(history, env, present);
+}
+
+/**
+ * Frees a history and every generation it remembers.
+ * @param history The history to destroy
+ */
+void history_destroy(History *history) {
+    for (uint32_t i = 0; i < history->count; i++)
+        release(history, entry(history, i));
+    free(history->entries);
+    free(history->scratch);
+    free(history);
+}
+
+/**
+ * Adds a changed cell to the scratch buffer, growing it if needed.
+ * @param history The history
+ * @param changes The number of cells collected so far
+ * @param index The index of the changed cell
+ */
+static inline void collect(History *history, uint32_t changes, uint32_t index) {
+    if (changes == history->scratch_capacity) {
+        history->scratch_capacity = history->scratch_capacity == 0 ? 1024 : history->scratch_capacity * 2;
+        history->scratch = (uint32_t *)realloc(history->scratch, history->scratch_capacity * sizeof(uint32_t));
+        assert(history->scratch != NULL);
+    }
+    history->scratch[changes] = index;
+}
+
+/**
+ * Collects the cells which changed in the last generation into the scratch buffer, by comparing the grid with the
+ * grid it was calculated from (the bit-packed grids if the generation was calculated on them). Only the tiles which
+ * changed are compared.
+ * @param history The history
+ * @param env The environment, just after calculating a generation
+ * @param hash Output for the keys of the changed cells XORed together
+ * @return The number of cells which changed
+ */
+static uint32_t collect_changes(History *history, Environment const *env, uint64_t *hash) {
+    uint32_t changes = 0;
+    *hash = 0;
+    for (uint32_t ty = 0; ty < env->tiles_y; ty++) {
+        uint32_t first_row = ty * ENV_TILE_HEIGHT;
+        uint32_t end_row = first_row + ENV_TILE_HEIGHT < env->height ? first_row + ENV_TILE_HEIGHT : env->height;
+        for (uint32_t tx = 0; tx < env->tiles_x; tx++) {
+            if (!env->tile_changed[(size_t)ty * env->tiles_x + tx]) continue;
+            uint32_t first_col = tx * ENV_TILE_WIDTH;
+            uint32_t end_col = first_col + ENV_TILE_WIDTH < env->width ? first_col + ENV_TILE_WIDTH : env->width;
+
+            for (uint32_t y = first_row; y < end_row; y++) {
+                uint32_t row_index = env->width * y;
+                if (env->stepped_packed) {
+                    uint64_t word = env->packed[(uint64_t)env->row_words * y + tx];
+                    uint64_t previous_word = env->_next_packed[(uint64_t)env->row_words * y + tx];
+                    for (uint64_t difference = word ^ previous_word; difference != 0; difference &= difference - 1) {
+                        uint32_t index = row_index + first_col + (uint32_t)__builtin_ctzll(difference);
+                        collect(history, changes++, index);
+                        *hash ^= cycle_cell_key(index);
+                    }
+                    continue;
+                }
+                bool const *row = &env->grid[(uint64_t)env->stride * y];
+                bool const *previous_row = &env->_next_generation[(uint64_t)env->stride * y];
+
+                // Compare eight cells at a time, where each cell which changed sets the lowest bit of its byte
+                uint32_t x = first_col;
+                for (; x + 8 <= end_col; x += 8) {
+                    uint64_t cells, previous_cells;
+                    memcpy(&cells, &row[x], sizeof(cells));
+                    memcpy(&previous_cells, &previous_row[x], sizeof(previous_cells));
+                    for (uint64_t difference = cells ^ previous_cells; difference != 0; difference &= difference - 1) {
+                        uint32_t index = row_index + x + (uint32_t)__builtin_ctzll(difference) / 8;
+                        collect(history, changes++, index);
+                        *hash ^= cycle_cell_key(index);
+                    }
+                }
+                for (; x < end_col; x++) {
+                    if (row[x] == previous_row[x]) continue;
+                    collect(history, changes++, row_index + x);
+                    *hash ^= cycle_cell_key(row_index + x);
+                }
+            }
+        }
+    }
+    return changes;
+}
+
+/**
+ * Remembers the environment's current generation. Call after each generation is calculated. A generation which does
+ * not follow on from the one the history is at (such as after an edit, or after several generations were calculated
+ * at once) starts the history over. Generations which were stepped back over are forgotten.
+ * @param history The history
+ * @param env The environment
+ */
+void history_record(History *history, Environment *env) {
+    if ((uint64_t)env->width * env->height > UINT32_MAX) return; // Cells could not be indexed
+    HistoryEntry *present = history->count > 0 ? entry(history, history->cursor) : NULL;
+    if (present != NULL && present->generation == env->data.generations && present->hash == env->hash) return;
+
+    // The changes must lead from the generation the history is at
+    uint64_t hash = 0;
+    uint32_t changes = 0;
+    bool follows = present != NULL && env->width == history->width && env->height == history->height &&
+                   env->data.generations == present->generation + 1;
+    if (follows) changes = collect_changes(history, env, &hash);
+    if (!follows || (env->hash ^ hash) != present->hash) {
+        restart(history, env);
+        return;
+    }
+
+    while (history->count > history->cursor + 1) {
+        release(history, entry(history, history->count - 1)); // Replaced by the new generation
+        history->count--;
+    }
+    if (history->count == HISTORY_GENERATIONS) drop_oldest(history);
+
+    HistoryEntry *next = entry(history, history->count);
+    next->generation = env->data.generations;
+    next->hash = env->hash;
+    next->population = env->data.total_cells;
+    next->changes = changes;
+    next->cells = NULL;
+    if (changes > 0) {
+        next->cells = (uint32_t *)malloc(changes * sizeof(uint32_t));
+        assert(next->cells != NULL);
+        memcpy(next->cells, history->scratch, changes * sizeof(uint32_t));
+        history->memory += changes * sizeof(uint32_t);
+    }
+    if (next->generation % HISTORY_KEYFRAME_INTERVAL == 0) keep_keyframe(history, env, next);
+    history->count++;
+    history->cursor++;
+
+    while (history->memory > history->budget && history->count > 1)
+        drop_oldest(history);
+}
+
+/**
+ * Checks that the environment is still at the generation the history is at, and has not been edited since.
+ * @param history The history
+ * @param env The environment
+ * @return true if the history can step the environment
+ */
+static bool in_step(History const *history, Environment const *env) {
+    if (history->count == 0 || env->width != history->width || env->height != history->height) return false;
+    HistoryEntry const *present = entry(history, history->cursor);
+    return present->generation == env->data.generations && present->hash == env->hash;
+}
+
+/**
+ * Toggles the cells which changed between two consecutive generations, taking the environment from one to the other.
+ * @param env The environment
+ * @param changes The later of the two generations, which holds the cells which changed
+ * @param destination The generation the environment is taken to
+ */
+static void toggle_changes(Environment *env, HistoryEntry const *changes, HistoryEntry const *destination) {
+    bitpack_unpack(env);
+    for (uint32_t i = 0; i < changes->changes; i++) {
+        uint32_t x = changes->cells[i] % env->width;
+        uint32_t y = changes->cells[i] / env->width;
+        env_write(env, x, y, !env_access(env, x, y));
+    }
+    env->data.generations = destination->generation;
+    env->data.total_cells = destination->population;
+}
+
+/**
+ * Steps the environment back a generation.
+ * @param history The history
+ * @param env The environment
+ * @return true if the environment was stepped back, false if the generation before is not remembered
+ */
+bool history_back(History *history, Environment *env) {
+    if (!in_step(history, env) || history->cursor == 0) return false;
+    toggle_changes(env, entry(history, history->cursor), entry(history, history->cursor - 1));
+    history->cursor--;
+    return true;
+}
+
+/**
+ * Steps the environment forward to a generation which was stepped back over.
+ * @param history The history
+ * @param env The environment
+ * @return true if the environment was stepped forward, false if it is at the newest generation remembered (in which
+ * case the next generation must be calculated)
+ */
+bool history_forward(History *history, Environment *env) {
+    if (!in_step(history, env) || history->cursor + 1 >= history->count) return false;
+    toggle_changes(env, entry(history, history->cursor + 1), entry(history, history->cursor + 1));
+    history->cursor++;
+    return true;
+}
+
+/**
+ * Counts the changed cells toggled to step between two generations.
+ * @param history The history
+ * @param from The generation stepped from, counted from the oldest
+ * @param to The generation stepped to, counted from the oldest
+ * @return The number of cells toggled
+ */
+static uint64_t replay_cost(History const *history, uint32_t from, uint32_t to) {
+    uint64_t cost = 0;
+    for (uint32_t i = (from < to ? from : to) + 1; i <= (from < to ? to : from); i++)
+        cost += entry(history, i)->changes;
+    return cost;
+}
+
+/**
+ * Takes the environment to a remembered generation, starting from a copy of the grid if that is cheaper than
+ * stepping there from the current generation.
+ * @param history The history
+ * @param env The environment
+ * @param generation The generation to go to, which is clamped to the generations remembered
+ * @return true if the environment was taken to the generation, false if the environment was edited since it was last
+ * recorded
+ */
+bool history_seek(History *history, Environment *env, uint64_t generation) {
+    if (!in_step(history, env)) return false;
+    uint64_t oldest = entry(history, 0)->generation;
+    if (generation < oldest) generation = oldest;
+    if (generation > oldest + history->count - 1) generation = oldest + history->count - 1;
+    uint32_t target = (uint32_t)(generation - oldest);
+
+    // Replaying changes gets dearer with distance, so only the nearest copy of the grid on either side can be cheaper
+    uint32_t start = history->cursor;
+    uint64_t best = replay_cost(history, history->cursor, target);
+    uint64_t restore_cost = (uint64_t)env->width * env->height / KEYFRAME_CELL_COST;
+    for (uint32_t i = target + 1; i-- > 0;) {
+        if (entry(history, i)->keyframe == NULL) continue;
+        uint64_t cost = restore_cost + replay_cost(history, i, target);
+        if (cost < best) {
+            best = cost;
+            start = i;
+        }
+        break;
+    }
+    for (uint32_t i = target + 1; i < history->count; i++) {
+        if (entry(history, i)->keyframe == NULL) continue;
+        if (restore_cost + replay_cost(history, i, target) < best) start = i;
+        break;
+    }
+
+    if (start != history->cursor) {
+        HistoryEntry const *keyframe = entry(history, start);
+        memcpy(env->packed, keyframe->keyframe, history->keyframe_size);
+        env_unpack(env);
+        env->data.generations = keyframe->generation;
+        history->cursor = start;
+    }
+    while (history->cursor < target)
+        history_forward(history, env);
+    while (history->cursor > target)
+        history_back(history, env);
+    return true;
+}
@@ -3,15 +3,25 @@
  * @author Matteo Golin
  * @version 1.1
  */
+#include "../include/checkpoint.h"
+#include "../include/glyphs.h"
 #include "../include/palettes.h"
+#include "../include/patterns.h"
+#include "../include/profile.h"
+#include "../include/recorder.h"
+#include "../include/render.h"
 #include "../include/rules.h"
+#include "../include/simulation.h"
 #include "SDL_events.h"
 #include "SDL_keycode.h"
 #include "SDL_render.h"
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
+#include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 typedef enum {
     DRAW_STATE_NONE = 0,
@@ -22,11 +32,24 @@ typedef enum {
 typedef struct {
     int x_offset;
     int y_offset;
-    unsigned int zoom;
+    unsigned int scale;
+    unsigned int lod;
     bool running;
     bool playing;
     bool dark_mode;
     bool analytics_on;
+    bool collect_analytics;
+    bool profile_on;
+    char const *profile_path;
+    bool unbounded;
+    CycleAction on_cycle;
+    char const *pattern;
+    char const *checkpoint_path;
+    uint64_t checkpoint_interval;
+    char const *restore_path;
+    size_t history_memory;
+    char const *record_path;
+    bool recording;
     DrawState draw_state;
     CellType cell_type;
     char *analytics_string;
@@ -42,18 +65,22 @@ typedef struct {
 #define DEFAULT_SCALE 6
 #define MAX_SCALE 14
 #define ZOOM_STEP 1
+#define MAX_LOD PYRAMID_LEVELS
 #define MOVEMENT_STEP 5
-#define DEFAULT_FRAME_DELAY 100
-#define MAX_FRAME_DELAY 1000
-#define FRAME_DELAY_STEP 10
+#define DEFAULT_GENERATION_PERIOD 100000 // Microseconds
+#define MAX_GENERATION_PERIOD 1000000
+#define MIN_GENERATION_PERIOD 10
+#define IDLE_TIMEOUT_MS 1000 // The longest the display sleeps before checking for a frame it was not woken for
+#define DEFAULT_CHECKPOINT_PATH "conway.checkpoint"
+#define DEFAULT_PROFILE_PATH "conway-profile.csv"
 
 const char WINDOW_NAME[] = "Conway's Game of Life Analyzer";
 
 /** All of the possible colour palettes. */
 const Palette GAME_PALETTES[] = {Casio,   MonitorGlow, Nokia3310, EndGame,   PaperAndDust,
                                  IBM8503, OngBit,      PaperBack, IronBlues, SpriteZero};
-/** Maps digit keys to cell types. */
-const CellType CELL_MAP[10] = {
+/** Maps digit keys to cell types. Key 0 is replaced by the rule passed on the command line, if any. */
+static CellType CELL_MAP[10] = {
     ConwayCell,        ConwayCell,  LesseConwayCell, VonNeumannR2ConwayCell, TripleMooreConwayCell, MazeCell,
     FractalCornerCell, FractalCell, NoiseCell,       ConwayCancerCell,
 };
@@ -61,22 +88,55 @@ const CellType CELL_MAP[10] = {
 static GameState game_state = {
     .x_offset = 0,
     .y_offset = 0,
-    .zoom = 0,                      // No zoom by default
-    .running = true,                // For quitting the animation
-    .playing = false,               // For play and pause
-    .dark_mode = true,              // Simulation runs in dark mode
-    .analytics_on = true,           // Shows analytics by default
-    .draw_state = DRAW_STATE_UNSET, // For drawing a cohesive line on drag
-    .cell_type = ConwayCell,        // Initialize starting game cell to classic Conway cell
-    .analytics_string = NULL,       // String for analytics text
-    .palette = 0,                   // Controls game palette
+    .scale = DEFAULT_SCALE,           // Pixels per cell
+    .lod = 0,                         // Zoomed out to 2^lod cells per pixel once the scale is 1
+    .running = true,                  // For quitting the animation
+    .playing = false,                 // For play and pause
+    .dark_mode = true,                // Simulation runs in dark mode
+    .analytics_on = true,             // Shows analytics by default
+    .collect_analytics = true,        // Collects births, deaths and so on unless --no-analytics is passed
+    .profile_on = false,              // Hides the times of each phase (only built in with make PROFILE=1)
+    .profile_path = NULL,             // Times are dumped to DEFAULT_PROFILE_PATH unless --profile is passed
+    .unbounded = false,               // Simulates the screen-sized torus unless --unbounded is passed
+    .on_cycle = CYCLE_CONTINUE,       // Keeps simulating a repeating grid unless --on-cycle is passed
+    .pattern = NULL,                  // Starts from an empty grid unless --pattern is passed
+    .checkpoint_path = NULL,          // Saved to DEFAULT_CHECKPOINT_PATH unless --checkpoint is passed
+    .checkpoint_interval = 0,         // No periodic checkpoints unless --checkpoint-every is passed
+    .restore_path = NULL,             // Starts a new simulation unless --restore is passed
+    .history_memory = HISTORY_MEMORY, // Remembers generations to step back to in this much memory
+    .record_path = NULL,              // Nothing is recorded unless --record is passed
+    .recording = true,                // Recording starts straight away when --record is passed
+    .draw_state = DRAW_STATE_UNSET,   // For drawing a cohesive line on drag
+    .cell_type = ConwayCell,          // Starting game cell is the classic Conway cell (compiled in main)
+    .analytics_string = NULL,         // String for analytics text
+    .palette = 0,                     // Controls game palette
 };
 
 // Helper functions
 void set_draw_colour(SDL_Renderer *renderer, Palette const *palette, bool light);
+uint32_t colour_rgb(SDL_Color colour);
+void wake_display(void *context);
+bool parse_arguments(int argc, char *argv[]);
+#ifdef CONWAY_PROFILE
+void append_profile_string(char **string);
+#endif // CONWAY_PROFILE
 
 int main(int argc, char *argv[]) {
 
+    // Command line options
+    if (!parse_arguments(argc, argv)) return EXIT_FAILURE;
+    if (game_state.checkpoint_path == NULL) game_state.checkpoint_path = DEFAULT_CHECKPOINT_PATH;
+    if (game_state.profile_path == NULL) game_state.profile_path = DEFAULT_PROFILE_PATH;
+
+    // Compile the rulestrings of all the cell types up front
+    for (unsigned int i = 0; i < sizeof(CELL_MAP) / sizeof(CELL_MAP[0]); i++) {
+        if (!cell_type_compile(&CELL_MAP[i])) {
+            printf("Invalid rule '%s'.\n", CELL_MAP[i].rulestring);
+            return EXIT_FAILURE;
+        }
+    }
+    game_state.cell_type = CELL_MAP[1];
+
     // OpenGL params
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
@@ -106,13 +166,13 @@ int main(int argc, char *argv[]) {
     // Determine simulation size from window size
     unsigned int game_width = initial_display_mode.w / DEFAULT_SCALE;
     unsigned int game_height = initial_display_mode.h / DEFAULT_SCALE;
-    SDL_Point *points = malloc(sizeof(SDL_Point) * game_width * game_height);
 
     // Create renderer
     SDL_Renderer *renderer = SDL_CreateRenderer(
         window, -1,
         SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC // Accelerated and in sync with monitor refresh rate
     );
+    CellRenderer *cells = render_init(renderer); // Draws the grid through a texture
 
     // Load font
     TTF_Font *font = TTF_OpenFont(FONT_PATH, FONT_SIZE);
@@ -120,18 +180,82 @@ int main(int argc, char *argv[]) {
         printf("Font could not be loaded.");
         return EXIT_FAILURE;
     }
+    GlyphAtlas *glyphs = glyphs_init(renderer, font); // Text is drawn from glyphs rasterised once, here
+    if (glyphs == NULL) {
+        printf("Could not build glyph atlas: %s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
 
     // Runtime variables
-    unsigned int generation_timer = SDL_GetTicks(); // Slow generations without slowing animation
-    SDL_Event event;                                // For capturing events
+    SDL_Event event; // For capturing events
 
     // Simulation assets
-    Environment *environment = env_init(game_width, game_height, DEFAULT_FRAME_DELAY);
+    Environment *environment = env_init(game_width, game_height, DEFAULT_GENERATION_PERIOD);
+    HashLife *hashlife = hashlife_init();
+    World *world = game_state.unbounded ? world_init(DEFAULT_GENERATION_PERIOD) : NULL;
+    char restored_rule[CHECKPOINT_NAME_LENGTH]; // Names the restored cell type if it is a custom rule
+    if (game_state.restore_path != NULL) {
+        env_destroy(environment);
+        environment = checkpoint_restore(game_state.restore_path, &game_state.cell_type, restored_rule);
+        if (environment == NULL || !cell_type_compile(&game_state.cell_type)) {
+            printf("Could not restore checkpoint '%s'.\n", game_state.restore_path);
+            return EXIT_FAILURE;
+        }
+        game_width = environment->width; // The grid is the size it was saved at, not the size of the screen
+        game_height = environment->height;
+    }
+    environment->analytics = game_state.collect_analytics;
+    History *history = world == NULL && game_state.history_memory > 0 ? history_init(game_state.history_memory) : NULL;
+    Checkpointer *checkpointer = game_state.checkpoint_interval > 0
+                                     ? checkpointer_init(game_state.checkpoint_path, game_state.checkpoint_interval)
+                                     : NULL;
+    Recorder *recorder = NULL;
+    if (game_state.record_path != NULL) {
+        recorder = recorder_init(game_state.record_path, game_width, game_height, RECORDER_MEMORY);
+        if (recorder == NULL) {
+            printf("Could not start recording to '%s'.\n", game_state.record_path);
+            return EXIT_FAILURE;
+        }
+    }
+    if (game_state.pattern != NULL && !pattern_load(environment, game_state.pattern)) {
+        printf("Could not load pattern '%s'.\n", game_state.pattern);
+        return EXIT_FAILURE;
+    }
+
+    // Generations are calculated on their own thread from here on, which owns the simulation assets until it stops
+    Uint32 frame_event = SDL_RegisterEvents(1); // Queued by the simulation thread when a new frame is ready
+    bool can_wait = frame_event != (Uint32)-1;
+    SimulationSetup setup = {
+        .env = environment,
+        .world = world,
+        .hashlife = hashlife,
+        .history = history,
+        .checkpointer = checkpointer,
+        .checkpoint_path = game_state.checkpoint_path,
+        .cell_type = game_state.cell_type,
+        .on_cycle = game_state.on_cycle,
+        .playing = game_state.playing,
+        .view_width = game_width,
+        .view_height = game_height,
+        .on_publish = can_wait ? wake_display : NULL,
+        .publish_context = &frame_event,
+    };
+    Simulation *simulation = simulation_start(&setup);
+    SimulationCommand command = {0};
+    SimulationCommand shown = {.width = game_width, .height = game_height}; // The part of the grid last shown
+    uint64_t drawn = 0; // The frame last drawn
+    bool redraw = true; // Whether something besides a new frame needs drawing
 
     while (game_state.running) {
+        SimulationFrame const *frame = simulation_frame(simulation); // The latest generation
 
-        // Handle events
-        while (SDL_PollEvent(&event)) {
+        // Handle events, sleeping until the next one or the next frame if there is nothing new to draw
+        bool idle = can_wait && !redraw && frame->serial == drawn;
+        int pending = idle ? SDL_WaitEventTimeout(&event, IDLE_TIMEOUT_MS) : SDL_PollEvent(&event);
+        for (; pending; pending = SDL_PollEvent(&event)) {
+            if (event.type == frame_event) continue; // Drawn below
+            PROFILE_SCOPE(PROFILE_EVENTS);
+            redraw = true;
 
             // Quit program (esc)
             if (event.type == SDL_QUIT) game_state.running = false;
@@ -139,6 +263,8 @@ int main(int argc, char *argv[]) {
             // Keypress events
             if (event.type == SDL_KEYDOWN) {
                 SDL_KeyCode key = event.key.keysym.sym;
+                uint32_t period = frame->data.generation_period;
+                command = (SimulationCommand){.type = SIMULATION_SET_SPEED, .value = period};
 
                 switch (key) {
                 case SDLK_ESCAPE:
@@ -146,21 +272,24 @@ int main(int argc, char *argv[]) {
                     game_state.running = false;
                     break;
                 case SDLK_SPACE:
-                    game_state.playing = !game_state.playing;
+                    command.type = SIMULATION_TOGGLE_PLAYING;
+                    simulation_command(simulation, &command);
                     break;
                 case SDLK_MINUS:
                 case SDLK_KP_MINUS:
-                    if (environment->data.generation_speed <= MAX_FRAME_DELAY - FRAME_DELAY_STEP)
-                        environment->data.generation_speed += FRAME_DELAY_STEP; // Speed up
+                    command.value = period == 0 ? MIN_GENERATION_PERIOD : period * 2; // Slow down
+                    if (command.value > MAX_GENERATION_PERIOD) command.value = MAX_GENERATION_PERIOD;
+                    simulation_command(simulation, &command);
                     break;
                 case SDLK_PLUS:
                 case SDLK_EQUALS:
                 case SDLK_KP_PLUS:
-                    if (environment->data.generation_speed >= FRAME_DELAY_STEP)
-                        environment->data.generation_speed -= FRAME_DELAY_STEP; // Speed up
+                    if (period / 2 >= MIN_GENERATION_PERIOD) command.value = period / 2; // Speed up
+                    simulation_command(simulation, &command);
                     break;
                 case SDLK_m:
-                    environment->data.generation_speed = 0; // Max speed
+                    command.value = 0; // Max speed
+                    simulation_command(simulation, &command);
                     break;
                 case SDLK_d:
                     game_state.dark_mode = !game_state.dark_mode;
@@ -168,14 +297,59 @@ int main(int argc, char *argv[]) {
                 case SDLK_a:
                     game_state.analytics_on = !game_state.analytics_on;
                     break;
+#ifdef CONWAY_PROFILE
+                case SDLK_p:
+                    game_state.profile_on = !game_state.profile_on;
+                    break;
+#endif // CONWAY_PROFILE
                 case SDLK_c:
-                    env_clear(environment);
+                    command.type = SIMULATION_CLEAR;
+                    simulation_command(simulation, &command);
+                    break;
+                case SDLK_s:
+                    command.type = SIMULATION_SAVE;
+                    simulation_command(simulation, &command);
+                    break;
+                case SDLK_LEFTBRACKET:
+                case SDLK_RIGHTBRACKET:
+                    // Step through the history one generation at a time, or a keyframe interval at a time with shift
+                    command.type = SIMULATION_REWIND;
+                    command.value = event.key.keysym.mod & KMOD_SHIFT ? HISTORY_KEYFRAME_INTERVAL : 1;
+                    if (key == SDLK_LEFTBRACKET) command.value = -command.value;
+                    simulation_command(simulation, &command);
+                    break;
+                case SDLK_r:
+                    game_state.recording = !game_state.recording;
                     break;
                 case SDLK_t:
                     game_state.palette = (game_state.palette + 1) % NUM_PALETTES;
                     break;
+                case SDLK_b:
+                    command.type = SIMULATION_TOGGLE_PACKED;
+                    simulation_command(simulation, &command);
+                    break;
+                case SDLK_j:
+                    command.type = SIMULATION_JUMP; // Jump ahead with HashLife, which only simulates Conway's rules
+                    simulation_command(simulation, &command);
+                    break;
+                case SDLK_LEFT:
+                    game_state.x_offset += MOVEMENT_STEP << game_state.lod;
+                    break;
+                case SDLK_RIGHT:
+                    game_state.x_offset -= MOVEMENT_STEP << game_state.lod;
+                    break;
+                case SDLK_UP:
+                    game_state.y_offset += MOVEMENT_STEP << game_state.lod;
+                    break;
+                case SDLK_DOWN:
+                    game_state.y_offset -= MOVEMENT_STEP << game_state.lod;
+                    break;
                 default:
-                    if (0x30 <= key && key <= 0x39) game_state.cell_type = CELL_MAP[key - 48];
+                    if (0x30 <= key && key <= 0x39) {
+                        command.type = SIMULATION_CELL_TYPE;
+                        command.cell_type = &CELL_MAP[key - 48];
+                        simulation_command(simulation, &command);
+                    }
                     break;
                 }
             }
@@ -183,87 +357,134 @@ int main(int argc, char *argv[]) {
             // Mouse click or click and drag
             if ((event.type == SDL_MOUSEBUTTONDOWN && event.button.state == SDL_PRESSED) ||
                 (event.type == SDL_MOUSEMOTION && event.motion.state)) {
-                unsigned int x = event.button.x / (DEFAULT_SCALE + game_state.zoom) - game_state.x_offset;
-                unsigned int y = event.button.y / (DEFAULT_SCALE + game_state.zoom) - game_state.y_offset;
-                if (env_in_bounds(environment, x, y)) {
-                    if (game_state.draw_state == DRAW_STATE_UNSET) {
-                        game_state.draw_state = env_toggle_cell(environment, x, y) ? DRAW_STATE_CELL : DRAW_STATE_NONE;
-                    } else {
-                        env_write(environment, x, y, game_state.draw_state);
-                    }
+                command.x = ((int64_t)event.button.x << game_state.lod) / game_state.scale - game_state.x_offset;
+                command.y = ((int64_t)event.button.y << game_state.lod) / game_state.scale - game_state.y_offset;
+                if (game_state.draw_state == DRAW_STATE_UNSET) {
+                    // The cell is toggled, and the rest of the stroke draws in the state it was toggled to
+                    command.type = SIMULATION_TOGGLE_CELL;
+                    game_state.draw_state =
+                        simulation_frame_cell(frame, command.x, command.y) ? DRAW_STATE_NONE : DRAW_STATE_CELL;
+                } else {
+                    command.type = SIMULATION_WRITE_CELL;
+                    command.value = game_state.draw_state;
                 }
+                simulation_command(simulation, &command);
             } else if (event.button.state == SDL_RELEASED) {
                 game_state.draw_state = DRAW_STATE_UNSET;
             }
 
-            // Scroll to zoom
+            // Scroll to zoom, halving the detail for each step out past one pixel per cell
             if (event.type == SDL_MOUSEWHEEL) {
-                if (event.wheel.y > 0 && DEFAULT_SCALE + game_state.zoom + ZOOM_STEP <= MAX_SCALE) {
-                    game_state.zoom += ZOOM_STEP;
-                } else if (event.wheel.y < 0 && DEFAULT_SCALE + game_state.zoom - ZOOM_STEP >= DEFAULT_SCALE) {
-                    game_state.zoom -= ZOOM_STEP;
+                if (event.wheel.y > 0 && game_state.lod > 0) {
+                    game_state.lod--;
+                } else if (event.wheel.y > 0 && game_state.scale + ZOOM_STEP <= MAX_SCALE) {
+                    game_state.scale += ZOOM_STEP;
+                } else if (event.wheel.y < 0 && game_state.scale > ZOOM_STEP) {
+                    game_state.scale -= ZOOM_STEP;
+                } else if (event.wheel.y < 0 && game_state.lod < MAX_LOD) {
+                    game_state.lod++;
                 }
             }
         }
 
+        // Only the cells on screen are copied, except for the whole grid while it is being recorded
+        int window_width, window_height;
+        SDL_GetWindowSize(window, &window_width, &window_height);
+        int64_t cells_per_pixel = (int64_t)1 << game_state.lod;
+        SimulationCommand view = {
+            .type = SIMULATION_VIEW,
+            .x = -game_state.x_offset,
+            .y = -game_state.y_offset,
+            .value = game_state.lod,
+            .width = (uint32_t)((window_width * cells_per_pixel + game_state.scale - 1) / game_state.scale),
+            .height = (uint32_t)((window_height * cells_per_pixel + game_state.scale - 1) / game_state.scale),
+        };
+        if (recorder != NULL && game_state.recording) {
+            view.x = world != NULL ? view.x : 0;
+            view.y = world != NULL ? view.y : 0;
+            view.value = 0;
+            view.width = game_width;
+            view.height = game_height;
+        }
+        if (view.x != shown.x || view.y != shown.y || view.value != shown.value || view.width != shown.width ||
+            view.height != shown.height) {
+            shown = view;
+            simulation_command(simulation, &view);
+        }
+
+        // Nothing is drawn until there is input, a window event or a new frame
+        frame = simulation_frame(simulation);
+        if (!redraw && frame->serial == drawn) continue;
+        redraw = false;
+        drawn = frame->serial;
+        PROFILE_SCOPE(PROFILE_FRAME);
+
         // Clear screen
-        SDL_RenderSetScale(renderer, (DEFAULT_SCALE + game_state.zoom), (DEFAULT_SCALE + game_state.zoom));
+        float scale = game_state.lod > 0 ? 1.0f / (float)(1u << game_state.lod) : (float)game_state.scale;
+        SDL_RenderSetScale(renderer, scale, scale);
         set_draw_colour(renderer, &GAME_PALETTES[game_state.palette], !game_state.dark_mode); // Dead cell colour
         SDL_RenderClear(renderer);
-        set_draw_colour(renderer, &GAME_PALETTES[game_state.palette], game_state.dark_mode); // Living cell colour
 
         // Draw cells
-        unsigned int count = 0;
-        for (unsigned int x = 0; x < game_width; x++) {
-            for (unsigned int y = 0; y < game_height; y++) {
-                if (env_access(environment, x, y) == true) {
-                    points[count].x = x + game_state.x_offset;
-                    points[count].y = y + game_state.y_offset;
-                    count++;
-                }
-            }
-        }
-        SDL_RenderDrawPoints(renderer, points, count);
-
-        // Create analytics
-        populate_analytics_string(&game_state.analytics_string, environment,
-                                  &game_state.cell_type); // Create analytics string
-        SDL_DisplayMode display_mode;
-        SDL_GetCurrentDisplayMode(0, &display_mode); // Get current width and height for text wrapping
-        SDL_Surface *analytics_surface = TTF_RenderText_Solid_Wrapped(
-            font, game_state.analytics_string,
-            game_state.dark_mode ? GAME_PALETTES[game_state.palette].light
-                                 : GAME_PALETTES[game_state.palette].dark, // Switch colour with toggle
-            display_mode.w // Wrap on \n or when width is larger than window width
-        );
-        // Display text in top left corner
-        SDL_Texture *analytics_texture = SDL_CreateTextureFromSurface(renderer, analytics_surface);
-        SDL_Rect analytics_rect = {5, 0, analytics_surface->w, analytics_surface->h};
-        SDL_FreeSurface(analytics_surface); // No longer needed after being added to texture
-
-        // If analytics are turned on, draw them
-        if (game_state.analytics_on) {
-            SDL_RenderSetScale(renderer, FONT_SCALE, FONT_SCALE); // Text scale back to 1
-            SDL_RenderCopy(renderer, analytics_texture, NULL, &analytics_rect);
+        Palette const *palette = &GAME_PALETTES[game_state.palette];
+        SDL_Color alive = game_state.dark_mode ? palette->light : palette->dark;
+        SDL_Color dead = game_state.dark_mode ? palette->dark : palette->light;
+        render_frame(cells, frame, game_state.x_offset, game_state.y_offset, alive, dead);
+
+        // Record what was drawn, in the colours it was drawn in, whenever it is the whole grid cell for cell. The world
+        // has no fixed origin, so it is recorded wherever it has been panned to.
+        if (recorder != NULL && game_state.recording) {
+            int64_t x0 = world != NULL ? 0 : frame->x0, y0 = world != NULL ? 0 : frame->y0;
+            recorder_capture(recorder, frame->lod == 0 ? frame->cells : NULL, x0, y0, frame->width, frame->height,
+                             frame->data.generations, frame->hash, colour_rgb(alive), colour_rgb(dead));
         }
-        SDL_DestroyTexture(analytics_texture);
 
-        // Calculate the next generation if playing and enough time has passed since last generation
-        if (game_state.playing && (SDL_GetTicks() - generation_timer) >= environment->data.generation_speed) {
-            next_generation(environment, &game_state.cell_type);
-            generation_timer = SDL_GetTicks();
+        // If analytics or times are turned on, draw them, laid out again only when they have changed
+        if (game_state.analytics_on || game_state.profile_on) {
+            PROFILE_SCOPE(PROFILE_TEXT);
+            game_state.analytics_string = NULL;
+            if (game_state.analytics_on)
+                format_analytics_string(&game_state.analytics_string, &frame->data, frame->area, &frame->cell_type);
+#ifdef CONWAY_PROFILE
+            if (game_state.profile_on) append_profile_string(&game_state.analytics_string);
+#endif // CONWAY_PROFILE
+            SDL_DisplayMode display_mode;
+            SDL_GetCurrentDisplayMode(0, &display_mode); // Get current width and height for text wrapping
+            glyphs_layout(glyphs, game_state.analytics_string, 5, 0, display_mode.w,
+                          alive); // Wrap on \n or at the window width, in the colour of living cells
+            free(game_state.analytics_string);
+            SDL_RenderSetScale(renderer, FONT_SCALE, FONT_SCALE); // Text scale back to 1
+            glyphs_draw(glyphs);                                 // Display text in top left corner
         }
 
         // Show what was drawn
-        SDL_RenderPresent(renderer);
-
-        // Clean up
-        free(game_state.analytics_string);
+        {
+            PROFILE_SCOPE(PROFILE_PRESENT);
+            SDL_RenderPresent(renderer);
+        }
     }
 
     // Release simulation assets
+    simulation_stop(simulation); // Hands the simulation assets back
+#ifdef CONWAY_PROFILE
+    if (!profile_dump(game_state.profile_path)) printf("Could not write times to '%s'.\n", game_state.profile_path);
+#endif // CONWAY_PROFILE
+    if (checkpointer != NULL) checkpointer_destroy(checkpointer); // Finishes writing any checkpoint in progress
+    if (recorder != NULL) {
+        if (recorder_dropped(recorder) > 0)
+            printf("Recording dropped %" PRIu64 " frames which could not be written in time.\n",
+                   recorder_dropped(recorder));
+        if (recorder_skipped(recorder) > 0)
+            printf("Recording skipped %" PRIu64 " generations which were not shown cell for cell.\n",
+                   recorder_skipped(recorder));
+        recorder_destroy(recorder); // Finishes writing the frames captured
+    }
+    if (history != NULL) history_destroy(history);
     env_destroy(environment);
-    free(points);
+    hashlife_destroy(hashlife);
+    if (world != NULL) world_destroy(world);
+    render_destroy(cells);
+    glyphs_destroy(glyphs);
     TTF_CloseFont(font);
 
     // Release resources
@@ -290,3 +511,141 @@ void set_draw_colour(SDL_Renderer *renderer, Palette const *palette, bool light)
         colour = palette->dark;
     SDL_SetRenderDrawColor(renderer, colour.r, colour.g, colour.b, 255);
 }
+
+/**
+ * Wakes the display for a new frame, from the simulation thread.
+ * @param context The type of the event registered for new frames
+ */
+void wake_display(void *context) {
+    SDL_Event frame = {.type = *(Uint32 *)context};
+    SDL_PushEvent(&frame);
+}
+
+/**
+ * Packs a colour into the 0xRRGGBB form used by the recorder.
+ * @param colour The colour
+ * @return The packed colour
+ */
+uint32_t __attribute__((const)) colour_rgb(SDL_Color colour) {
+    return (uint32_t)colour.r << 16 | (uint32_t)colour.g << 8 | colour.b;
+}
+
+/**
+ * Parses the command line options. `--rule <rulestring>` replaces the cell type on key 0 with a Life-like rule,
+ * `--neighbourhood <name>` chooses the neighbourhood it counts neighbours in (Moore by default, and only together with
+ * `--rule`), `--unbounded` simulates an unbounded plane instead of a screen-sized torus, `--on-cycle
+ * <pause|fast-forward>` chooses what happens once the simulation starts repeating itself and `--pattern <path>` loads
+ * a plaintext, RLE or Macrocell pattern into the middle of the grid. `--restore <path>` resumes a simulation from a
+ * checkpoint, `--checkpoint <path>` sets where checkpoints are saved and `--checkpoint-every <n>` saves one in the
+ * background every n generations.
+ * `--history <megabytes>` sets how much memory is spent remembering generations to step back to (0 turns it off), and
+ * `--record <path>` records each generation shown to a Y4M video (a path ending in .y4m) or to numbered PNG images.
+ * `--no-analytics` stops births, deaths, the bounding box and so on being collected, for the fastest simulation, and
+ * `--profile <path>` sets where the times of each phase are written on exit when built with `make PROFILE=1`.
+ * @param argc The number of arguments
+ * @param argv The arguments
+ * @return true if the options were valid, false otherwise
+ */
+bool parse_arguments(int argc, char *argv[]) {
+
+    bool rule = false, neighbourhood = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--unbounded") == 0) {
+            game_state.unbounded = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--no-analytics") == 0) {
+            game_state.collect_analytics = false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            printf("Missing value for option '%s'.\n", argv[i]);
+            return false;
+        }
+
+        if (strcmp(argv[i], "--rule") == 0) {
+            CELL_MAP[0].name = argv[i + 1];
+            CELL_MAP[0].rulestring = argv[i + 1];
+            CELL_MAP[0].calculator = NULL;
+            rule = true;
+        } else if (strcmp(argv[i], "--neighbourhood") == 0) {
+            neighbourhood = true;
+            CELL_MAP[0].neighbourhood = neighbourhood_by_name(argv[i + 1]);
+            if (CELL_MAP[0].neighbourhood == NULL) {
+                printf("Unknown neighbourhood '%s'.\n", argv[i + 1]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--pattern") == 0) {
+            game_state.pattern = argv[i + 1];
+        } else if (strcmp(argv[i], "--checkpoint") == 0) {
+            game_state.checkpoint_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            game_state.profile_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--checkpoint-every") == 0) {
+            char *end;
+            game_state.checkpoint_interval = strtoull(argv[i + 1], &end, 10);
+            if (*end != '\0' || game_state.checkpoint_interval == 0) {
+                printf("Invalid checkpoint interval '%s'.\n", argv[i + 1]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--history") == 0) {
+            char *end;
+            game_state.history_memory = (size_t)strtoull(argv[i + 1], &end, 10) << 20;
+            if (*end != '\0' || argv[i + 1][0] == '\0') {
+                printf("Invalid history size '%s'.\n", argv[i + 1]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--record") == 0) {
+            game_state.record_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--restore") == 0) {
+            game_state.restore_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--on-cycle") == 0) {
+            if (strcmp(argv[i + 1], "pause") == 0) {
+                game_state.on_cycle = CYCLE_PAUSE;
+            } else if (strcmp(argv[i + 1], "fast-forward") == 0) {
+                game_state.on_cycle = CYCLE_FAST_FORWARD;
+            } else {
+                printf("Unknown cycle action '%s'.\n", argv[i + 1]);
+                return false;
+            }
+        } else {
+            printf("Unknown option '%s'.\n", argv[i]);
+            return false;
+        }
+        i++;
+    }
+    if (neighbourhood && !rule) {
+        printf("A neighbourhood can only be chosen for a rule given with '--rule'.\n");
+        return false;
+    }
+    if (game_state.pattern != NULL && game_state.unbounded) {
+        printf("Patterns can only be loaded into the wrapping grid, not the unbounded world.\n");
+        return false;
+    }
+    if ((game_state.restore_path != NULL || game_state.checkpoint_interval > 0) && game_state.unbounded) {
+        printf("Checkpoints can only be taken of the wrapping grid, not the unbounded world.\n");
+        return false;
+    }
+    return true;
+}
+
+#ifdef CONWAY_PROFILE
+/**
+ * Appends the recent times of each phase to the overlay text, on the lines below it.
+ * @param string Pointer to the overlay text, which must be freed, or to NULL if there is none yet
+ */
+void append_profile_string(char **string) {
+    char *times;
+    profile_format(&times);
+    if (*string == NULL) {
+        *string = times;
+        return;
+    }
+    size_t length = strlen(*string), extra = strlen(times);
+    *string = realloc(*string, length + extra + 2);
+    assert(*string != NULL);
+    (*string)[length] = '\n';
+    memcpy(*string + length + 1, times, extra + 1);
+    free(times);
+}
+#endif // CONWAY_PROFILE
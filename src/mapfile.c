@@ -0,0 +1,82 @@
+/**
+ * Contains a helper for reading whole files through a memory mapping, for the loaders which parse a file in one pass.
+ * Where there is no mmap (Windows), the file is read into memory in whole instead.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/mapfile.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Maps a file into memory for reading front to back. The contents must be released with unmap_file.
+ * @param path The path of the file
+ * @param contents Output for the contents of the file, which are NULL if the file is empty
+ * @param length Output for the length of the file in bytes
+ * @return true if the file was mapped, false if it could not be read
+ */
+bool map_file(char const *path, char const **contents, size_t *length) {
+
+#ifdef _WIN32
+    // No mmap, so the file is read in whole instead
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *text = malloc(size > 0 ? (size_t)size : 1);
+    assert(text != NULL);
+    bool read = size >= 0 && fread(text, 1, (size_t)size, file) == (size_t)size;
+    fclose(file);
+    if (!read) {
+        free(text);
+        return false;
+    }
+    *contents = text;
+    *length = (size_t)size;
+#else
+    int file = open(path, O_RDONLY);
+    if (file < 0) return false;
+    struct stat status;
+    if (fstat(file, &status) != 0) {
+        close(file);
+        return false;
+    }
+    *length = (size_t)status.st_size;
+    *contents = NULL;
+    if (*length > 0) {
+        void *mapping = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping == MAP_FAILED) {
+            close(file);
+            return false;
+        }
+        madvise(mapping, *length, MADV_SEQUENTIAL); // Read front to back exactly once
+        *contents = mapping;
+    }
+    close(file); // The mapping stays valid without the file descriptor
+#endif
+    return true;
+}
+
+/**
+ * Releases the contents of a file mapped by map_file.
+ * @param contents The contents of the file
+ * @param length The length of the file in bytes
+ */
+void unmap_file(char const *contents, size_t length) {
+#ifdef _WIN32
+    (void)length;
+    free((void *)(uintptr_t)contents);
+#else
+    if (length > 0) munmap((void *)(uintptr_t)contents, length);
+#endif
+}
@@ -7,6 +7,7 @@
 #include "../include/neighbourhoods.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* NEIGHBOURHOODS */
 const Neighbourhood VON_NEUMANN = {4, {VonNeumann}};
@@ -17,6 +18,58 @@ const Neighbourhood VON_NEUMANN_R2 = {12, {VonNeumannR2}};
 const Neighbourhood TRIPLE_MOORE = {20, {TripleMoore}};
 const Neighbourhood TRIPLE_MOORE_CORNER = {24, {TripleMooreCorner}};
 
+/** Names for the included neighbourhoods. */
+static const struct {
+    char const *name;
+    Neighbourhood const *neighbourhood;
+} NEIGHBOURHOOD_NAMES[] = {
+    {"von-neumann", &VON_NEUMANN},
+    {"von-neumann-corners", &VON_NEUMANN_CORNERS},
+    {"lesse", &LESSE},
+    {"moore", &MOORE},
+    {"von-neumann-r2", &VON_NEUMANN_R2},
+    {"triple-moore", &TRIPLE_MOORE},
+    {"triple-moore-corner", &TRIPLE_MOORE_CORNER},
+};
+
+/**
+ * Looks up one of the included neighbourhoods by name.
+ * @param name The name of the neighbourhood in lowercase, with words separated by dashes (i.e. "von-neumann-r2")
+ * @return The neighbourhood, or NULL if there is no neighbourhood with that name
+ */
+Neighbourhood const *neighbourhood_by_name(char const *name) {
+    for (size_t i = 0; i < sizeof(NEIGHBOURHOOD_NAMES) / sizeof(NEIGHBOURHOOD_NAMES[0]); i++) {
+        if (strcmp(NEIGHBOURHOOD_NAMES[i].name, name) == 0) return NEIGHBOURHOOD_NAMES[i].neighbourhood;
+    }
+    return NULL;
+}
+
+/**
+ * @param neighbourhood One of the included neighbourhoods
+ * @return The name of the neighbourhood (see neighbourhood_by_name), or NULL if it is not one of the included ones
+ */
+char const *__attribute__((const)) neighbourhood_name(Neighbourhood const *neighbourhood) {
+    for (size_t i = 0; i < sizeof(NEIGHBOURHOOD_NAMES) / sizeof(NEIGHBOURHOOD_NAMES[0]); i++) {
+        if (NEIGHBOURHOOD_NAMES[i].neighbourhood == neighbourhood) return NEIGHBOURHOOD_NAMES[i].name;
+    }
+    return NULL;
+}
+
+/**
+ * @param neighbourhood A neighbourhood
+ * @return The distance of the furthest neighbour from the cell, along either axis
+ */
+uint32_t neighbourhood_radius(Neighbourhood const *neighbourhood) {
+    uint32_t radius = 0;
+    for (unsigned int i = 0; i < neighbourhood->size; i++) {
+        Coordinate position = neighbourhood->neighbours[i];
+        uint32_t x = (uint32_t)abs(position.x), y = (uint32_t)abs(position.y);
+        if (x > radius) radius = x;
+        if (y > radius) radius = y;
+    }
+    return radius;
+}
+
 /* COORDINATE MANIPULATION */
 
 /**
@@ -64,7 +117,7 @@ Coordinate wrap(Environment const *env, Coordinate coord) {
 
 /**
  * Returns an array of 8 booleans representing the state of each of a cells 8
- * neighbours (in order of the NEIGHBOURS constant)
+ * neighbours (in order of the NEIGHBOURS constant). The environment's halo must be up to date (see env_refresh_halo).
  * @param env The environment where the cell lives
  * @param x The x coordinate of the cell being examined
  * @param y The y coordinate of the cell being examined
@@ -75,14 +128,13 @@ Coordinate wrap(Environment const *env, Coordinate coord) {
 bool *neighbours(Environment const *env, uint32_t x, uint32_t y, Neighbourhood const *neighbourhood,
                  bool *neighbour_states) {
 
+    // Neighbours past the grid edges land in the halo, so each neighbour is a fixed offset from the cell
+    bool const *cell = &env->grid[(uint64_t)env->stride * y + x];
+    int32_t stride = (int32_t)env->stride;
+
     for (unsigned int i = 0; i < neighbourhood->size; i++) {
-        // Calculate position of current neighbour in each of the 8 surrounding cells
         Coordinate position = neighbourhood->neighbours[i];
-        Coordinate neighbour = {(int32_t)x + position.x, (int32_t)y + position.y};
-        neighbour = wrap(env, neighbour); // If neighbour out of bounds, wrap around
-
-        // Store states
-        neighbour_states[i] = env_access(env, neighbour.x, neighbour.y);
+        neighbour_states[i] = cell[position.y * stride + position.x]; // Store states
     }
     return neighbour_states;
 }
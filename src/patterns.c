@@ -0,0 +1,404 @@
+/**
+ * Contains logic for loading patterns from disk into the simulation environment. Files are memory mapped and parsed in
+ * a single pass which writes living cells into the grid in batches, so even very large patterns are never copied.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/patterns.h"
+#include "../include/mapfile.h"
+#include "../include/neighbourhoods.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Cells of a pattern being collected for the grid, along with where the pattern is placed. */
+typedef struct {
+    Environment *env;                /**< The environment the pattern is placed in. */
+    int32_t x;                       /**< The x coordinate the pattern's top left corner is placed at. */
+    int32_t y;                       /**< The y coordinate the pattern's top left corner is placed at. */
+    int64_t left;                    /**< The first column of the pattern which lands inside the grid. */
+    int64_t right;                   /**< One past the last column of the pattern which lands inside the grid. */
+    int64_t top;                     /**< The first row of the pattern which lands inside the grid. */
+    int64_t bottom;                  /**< One past the last row of the pattern which lands inside the grid. */
+    Coordinate batch[PATTERN_BATCH]; /**< The first cell of each run waiting to be placed, relative to the pattern. */
+    uint32_t lengths[PATTERN_BATCH]; /**< The number of living cells in each run waiting to be placed. */
+    size_t count;                    /**< The number of runs in the batch. */
+    uint32_t placed;                 /**< The number of cells brought to life so far. */
+} Placement;
+
+/** A node of a Macrocell quadtree. */
+typedef struct {
+    uint8_t level;        /**< The node covers a square 2^level cells wide. */
+    bool is_leaf;         /**< Whether the node lists its cells, rather than four quadrants. Leaves are level 3. */
+    uint64_t children[4]; /**< The north west, north east, south west and south east quadrants (0 if empty). */
+    uint64_t leaf;        /**< The cells of a leaf, one bit per cell in row-major order. */
+} MacrocellNode;
+
+/**
+ * @param text The contents of a file
+ * @param end The end of the contents
+ * @return The end of the line starting at text, which is either a newline or the end of the contents
+ */
+static char const *line_end(char const *text, char const *end) {
+    char const *newline = memchr(text, '\n', (size_t)(end - text));
+    return newline != NULL ? newline : end;
+}
+
+/**
+ * Parses a decimal number, stopping at the end of the contents since they need not be NUL-terminated.
+ * @param text Pointer to where the number starts, moved past the number and any spaces before it
+ * @param end The end of the contents
+ * @param value Output for the number
+ * @return true if there was a number, false otherwise
+ */
+static bool parse_number(char const **text, char const *end, uint64_t *value) {
+    char const *c = *text;
+    while (c < end && (*c == ' ' || *c == '\t'))
+        c++;
+    if (c == end || *c < '0' || *c > '9') return false;
+    *value = 0;
+    for (; c < end && *c >= '0' && *c <= '9'; c++)
+        *value = *value * 10 + (uint64_t)(*c - '0');
+    *text = c;
+    return true;
+}
+
+/**
+ * Places the batch of collected runs into the grid.
+ * @param placement The placement
+ */
+static void flush(Placement *placement) {
+    translate_coordinates(placement->batch, placement->count, placement->x, placement->y);
+    for (size_t i = 0; i < placement->count; i++) {
+        Coordinate start = placement->batch[i];
+        placement->placed += env_fill_run(placement->env, (uint32_t)start.x, (uint32_t)start.y, placement->lengths[i]);
+    }
+    placement->count = 0;
+}
+
+/**
+ * Adds a run of living cells in a row of the pattern, dropping the cells which fall outside the grid.
+ * @param placement The placement
+ * @param x The column of the first cell in the run, relative to the pattern
+ * @param y The row of the run, relative to the pattern
+ * @param length The number of cells in the run
+ */
+static void place_run(Placement *placement, int64_t x, int64_t y, uint64_t length) {
+    if (y < placement->top || y >= placement->bottom || x >= placement->right) return;
+    int64_t first = x > placement->left ? x : placement->left;
+    int64_t end = length < (uint64_t)(placement->right - x) ? x + (int64_t)length : placement->right;
+    if (first >= end) return;
+    placement->batch[placement->count] = (Coordinate){(int32_t)first, (int32_t)y};
+    placement->lengths[placement->count] = (uint32_t)(end - first);
+    if (++placement->count == PATTERN_BATCH) flush(placement);
+}
+
+/**
+ * Places a plaintext pattern, whose rows are lines of '.' for dead cells and 'O' (or '*') for living ones.
+ * @param pattern The pattern
+ * @param placement Where to place it
+ */
+static void place_plaintext(Pattern const *pattern, Placement *placement) {
+    char const *end = pattern->text + pattern->length;
+    int64_t y = 0;
+    for (char const *line = pattern->text + pattern->body; line < end; line = line_end(line, end) + 1) {
+        if (*line == '!') continue;
+        char const *stop = line_end(line, end);
+        for (char const *cell = line; cell < stop;) {
+            char const *run = cell;
+            while (cell < stop && (*cell == 'O' || *cell == '*'))
+                cell++;
+            if (cell != run) place_run(placement, run - line, y, (uint64_t)(cell - run));
+            else cell++;
+        }
+        y++;
+    }
+}
+
+/**
+ * Places an RLE pattern. Runs are a count (1 if left out) followed by 'b' for dead cells, '$' for the end of a row or
+ * any other letter for living cells, and '!' ends the pattern. States of multi-state rules count as living.
+ * @param pattern The pattern
+ * @param placement Where to place it
+ */
+static void place_rle(Pattern const *pattern, Placement *placement) {
+    char const *c = pattern->text + pattern->body, *end = pattern->text + pattern->length;
+    int64_t x = 0, y = 0;
+    while (c < end) {
+        uint64_t run = 0;
+        for (; c < end && (unsigned char)(*c - '0') < 10; c++)
+            run = run * 10 + (uint64_t)(*c - '0');
+        if (c == end) break;
+        char tag = *c++;
+        run += run == 0; // A run without a count is a single cell
+
+        if (tag == 'b' || tag == '.') {
+            x += (int64_t)run;
+        } else if (tag == 'o' || (tag >= 'A' && tag <= 'Z') || (tag >= 'a' && tag <= 'o')) {
+            place_run(placement, x, y, run);
+            x += (int64_t)run;
+        } else if (tag == '$') {
+            y += (int64_t)run;
+            x = 0;
+        } else if (tag == '!') {
+            break;
+        } else if (tag >= 'p' && tag <= 'y' && c < end) {
+            // Prefix of a multi-state cell, which is alive
+            place_run(placement, x, y, run);
+            x += (int64_t)run;
+            c++;
+        }
+        // Line breaks and other whitespace may appear anywhere, but not within a run
+    }
+}
+
+/**
+ * Places a node of a Macrocell quadtree, skipping quadrants which fall outside the grid.
+ * @param nodes The nodes of the quadtree
+ * @param index The index of the node to place
+ * @param x The column of the node's top left corner, relative to the pattern
+ * @param y The row of the node's top left corner, relative to the pattern
+ * @param placement Where to place it
+ */
+static void place_node(MacrocellNode const *nodes, uint64_t index, int64_t x, int64_t y, Placement *placement) {
+    if (index == 0) return; // Empty
+    MacrocellNode const *node = &nodes[index];
+    int64_t size = (int64_t)1 << node->level;
+    if (x >= placement->right || y >= placement->bottom || x + size <= placement->left || y + size <= placement->top)
+        return;
+
+    if (node->is_leaf) {
+        for (uint64_t cells = node->leaf; cells != 0; cells &= cells - 1) {
+            unsigned int bit = (unsigned int)__builtin_ctzll(cells);
+            place_run(placement, x + bit % 8, y + bit / 8, 1);
+        }
+    } else if (node->level == 1) {
+        for (unsigned int i = 0; i < 4; i++) {
+            if (node->children[i] != 0) place_run(placement, x + i % 2, y + i / 2, 1); // Children are cell states
+        }
+    } else {
+        int64_t half = size / 2;
+        for (unsigned int i = 0; i < 4; i++)
+            place_node(nodes, node->children[i], x + half * (i % 2), y + half * (i / 2), placement);
+    }
+}
+
+/**
+ * Parses a Macrocell pattern into its nodes. Each line is either a level 3 leaf, with rows of '.' and '*' ended by
+ * '$', or a level followed by the indices of the node's four quadrants. Nodes are numbered from 1 and may only refer
+ * to nodes before them.
+ * @param pattern The pattern
+ * @param count Output for the number of nodes (including the empty node 0)
+ * @return The nodes, or NULL if the pattern is malformed
+ */
+static MacrocellNode *parse_macrocell(Pattern const *pattern, uint64_t *count) {
+    char const *end = pattern->text + pattern->length;
+    size_t capacity = 1024;
+    MacrocellNode *nodes = malloc(capacity * sizeof(MacrocellNode));
+    assert(nodes != NULL);
+    *count = 1;
+
+    for (char const *line = pattern->text + pattern->body; line < end; line = line_end(line, end) + 1) {
+        if (*line == '#' || *line == '\n' || *line == '\r') continue;
+        if (*count == capacity) {
+            capacity *= 2;
+            nodes = realloc(nodes, capacity * sizeof(MacrocellNode));
+            assert(nodes != NULL);
+        }
+        MacrocellNode *node = &nodes[*count];
+
+        char const *c = line, *stop = line_end(line, end);
+        uint64_t level;
+        if (*c == '.' || *c == '*' || *c == '$') {
+            node->level = 3;
+            node->is_leaf = true;
+            node->leaf = 0;
+            for (unsigned int row = 0, column = 0; c < stop && row < 8; c++) {
+                if (*c == '$') {
+                    row++;
+                    column = 0;
+                } else if (column < 8) {
+                    if (*c == '*') node->leaf |= (uint64_t)1 << (row * 8 + column);
+                    column++;
+                }
+            }
+        } else if (parse_number(&c, stop, &level) && level >= 1 && level <= PATTERN_MAX_LEVEL) {
+            node->level = (uint8_t)level;
+            node->is_leaf = false; // Level 3 nodes may also be made of four level 2 quadrants
+            for (unsigned int i = 0; i < 4; i++) {
+                if (!parse_number(&c, stop, &node->children[i])) goto malformed;
+                if (level == 1 || node->children[i] == 0) continue;
+                if (node->children[i] >= *count || nodes[node->children[i]].level != level - 1) goto malformed;
+            }
+        } else {
+            goto malformed;
+        }
+        (*count)++;
+    }
+    if (*count > 1) return nodes;
+
+malformed:
+    free(nodes);
+    return NULL;
+}
+
+/**
+ * Finds the size of a plaintext pattern.
+ * @param pattern The pattern, whose width and height are filled in
+ */
+static void measure_plaintext(Pattern *pattern) {
+    char const *end = pattern->text + pattern->length;
+    pattern->width = 0;
+    pattern->height = 0;
+    for (char const *line = pattern->text; line < end; line = line_end(line, end) + 1) {
+        if (*line == '!') continue;
+        char const *stop = line_end(line, end);
+        if (stop > line && stop[-1] == '\r') stop--;
+        if ((uint64_t)(stop - line) > pattern->width) pattern->width = (uint64_t)(stop - line);
+        pattern->height++;
+    }
+}
+
+/**
+ * Works out the format and size of a pattern from its contents.
+ * @param pattern The pattern, whose format, body, width and height are filled in
+ * @return true if the pattern is well formed, false otherwise
+ */
+static bool identify(Pattern *pattern) {
+    char const *text = pattern->text, *end = text + pattern->length;
+    pattern->body = 0;
+
+    // Macrocell files start with their version, and their last node is the root of the quadtree
+    if (pattern->length >= 3 && strncmp(text, "[M2", 3) == 0) {
+        pattern->format = PATTERN_MACROCELL;
+        pattern->body = (size_t)(line_end(text, end) - text);
+        char const *last = end;
+        while (last > text + pattern->body && (last[-1] == '\n' || last[-1] == '\r'))
+            last--;
+        while (last > text + pattern->body && last[-1] != '\n')
+            last--;
+        uint64_t level = 3;
+        if (*last != '.' && *last != '*' && *last != '$' && !parse_number(&last, end, &level)) return false;
+        if (level < 1 || level > PATTERN_MAX_LEVEL) return false;
+        pattern->width = pattern->height = (uint64_t)1 << level;
+        return true;
+    }
+
+    // RLE files have a header line after their comments
+    char const *line = text;
+    while (line < end && *line == '#')
+        line = line_end(line, end) + 1;
+    char const *c = line;
+    while (c < end && *c == ' ')
+        c++;
+    if (c < end && *c == 'x') {
+        pattern->format = PATTERN_RLE;
+        pattern->body = (size_t)(line_end(line, end) - text);
+        char const *stop = text + pattern->body;
+        char const *width = memchr(c, '=', (size_t)(stop - c));
+        if (width == NULL) return false;
+        width++;
+        char const *height = memchr(width, 'y', (size_t)(stop - width));
+        if (height == NULL || (height = memchr(height, '=', (size_t)(stop - height))) == NULL) return false;
+        height++;
+        return parse_number(&width, stop, &pattern->width) && parse_number(&height, stop, &pattern->height);
+    }
+
+    pattern->format = PATTERN_PLAINTEXT;
+    measure_plaintext(pattern);
+    return true;
+}
+
+/**
+ * Opens a pattern file, mapping it into memory.
+ * @param pattern The pattern to open
+ * @param path The path of the pattern file
+ * @return true if the pattern was opened, false if it could not be read or is malformed
+ */
+bool pattern_open(Pattern *pattern, char const *path) {
+    if (!map_file(path, &pattern->text, &pattern->length)) return false;
+    if (!identify(pattern)) {
+        pattern_close(pattern);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Unmaps a pattern file.
+ * @param pattern The pattern to close
+ */
+void pattern_close(Pattern *pattern) {
+    unmap_file(pattern->text, pattern->length);
+    pattern->text = NULL;
+    pattern->length = 0;
+}
+
+/**
+ * Brings the living cells of a pattern to life in the grid. Cells which fall outside the grid are dropped, and cells
+ * already alive are left as they are.
+ * @param pattern The pattern to place
+ * @param env The environment to place the pattern in
+ * @param x The x coordinate to place the pattern's top left corner at
+ * @param y The y coordinate to place the pattern's top left corner at
+ * @return true if the pattern was placed, false if it is malformed
+ */
+bool pattern_place(Pattern const *pattern, Environment *env, int32_t x, int32_t y) {
+
+    Placement *placement = malloc(sizeof(Placement));
+    assert(placement != NULL);
+    placement->env = env;
+    placement->x = x;
+    placement->y = y;
+    placement->left = -(int64_t)x;
+    placement->right = (int64_t)env->width - x;
+    placement->top = -(int64_t)y;
+    placement->bottom = (int64_t)env->height - y;
+    placement->count = 0;
+    placement->placed = 0;
+
+    bool placed = true;
+    switch (pattern->format) {
+    case PATTERN_PLAINTEXT:
+        place_plaintext(pattern, placement);
+        break;
+    case PATTERN_RLE:
+        place_rle(pattern, placement);
+        break;
+    case PATTERN_MACROCELL: {
+        uint64_t count;
+        MacrocellNode *nodes = parse_macrocell(pattern, &count);
+        placed = nodes != NULL;
+        if (placed) place_node(nodes, count - 1, 0, 0, placement); // The root is the last node
+        free(nodes);
+        break;
+    }
+    }
+    flush(placement);
+
+    // Placed cells count as drawn by the user
+    env->data.initial_cells += placement->placed;
+    env->data.total_cells += placement->placed;
+    free(placement);
+    return placed;
+}
+
+/**
+ * Loads a pattern file into the middle of the grid.
+ * @param env The environment to load the pattern into
+ * @param path The path of the pattern file
+ * @return true if the pattern was loaded, false if it could not be read or is malformed
+ */
+bool pattern_load(Environment *env, char const *path) {
+    Pattern pattern;
+    if (!pattern_open(&pattern, path)) return false;
+
+    // Centre the pattern, clamping the offset of patterns far larger than the grid
+    int64_t x = ((int64_t)env->width - (int64_t)pattern.width) / 2;
+    int64_t y = ((int64_t)env->height - (int64_t)pattern.height) / 2;
+    x = x < INT32_MIN ? INT32_MIN : x;
+    y = y < INT32_MIN ? INT32_MIN : y;
+    bool loaded = pattern_place(&pattern, env, (int32_t)x, (int32_t)y);
+    pattern_close(&pattern);
+    return loaded;
+}
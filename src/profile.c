@@ -0,0 +1,158 @@
+/**
+ * Contains the instrumentation of the hot paths. Each phase keeps its most recent times in a ring, along with running
+ * totals. A phase is only ever timed from one thread, so recording a time is a handful of relaxed atomic stores with
+ * no locks or read-modify-writes, and the overlay and the dump on exit read the rings while they are being written.
+ * Percentiles are found by sorting a copy of the ring, which is only done when they are shown.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/profile.h"
+
+#ifdef CONWAY_PROFILE
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** The room left for each phase's line of the overlay. */
+#define PROFILE_LINE 96
+
+/** The times of one phase. */
+typedef struct {
+    _Atomic uint64_t samples[PROFILE_WINDOW]; /**< The most recent times in nanoseconds, as a ring. */
+    _Atomic uint64_t count;                   /**< The number of times recorded, where the next one goes in the ring. */
+    _Atomic uint64_t total;                   /**< The sum of every time recorded. */
+    _Atomic uint64_t longest;                 /**< The longest time recorded. */
+} PhaseTimes;
+
+/** The summary of the times of one phase. */
+typedef struct {
+    uint64_t count;   /**< The number of times recorded. */
+    uint64_t total;   /**< The sum of every time recorded, in nanoseconds. */
+    uint64_t longest; /**< The longest time recorded. */
+    uint64_t p50;     /**< The median of the recent times. */
+    uint64_t p99;     /**< The 99th percentile of the recent times. */
+} PhaseSummary;
+
+/** The names of the phases, as shown and dumped. */
+static char const *const PHASE_NAMES[PROFILE_PHASES] = {
+    "events", "upload", "text", "present", "frame", "commands", "generation", "publish",
+};
+
+static PhaseTimes phases[PROFILE_PHASES];
+
+/**
+ * Reads the monotonic clock.
+ * @return The time in nanoseconds
+ */
+uint64_t profile_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Records a time of a phase. Must only be called from the one thread which times the phase.
+ * @param phase The phase
+ * @param nanoseconds How long the phase took
+ */
+void profile_record(ProfilePhase phase, uint64_t nanoseconds) {
+    PhaseTimes *times = &phases[phase];
+    uint64_t count = atomic_load_explicit(&times->count, memory_order_relaxed);
+    atomic_store_explicit(&times->samples[count % PROFILE_WINDOW], nanoseconds, memory_order_relaxed);
+    atomic_store_explicit(&times->total, atomic_load_explicit(&times->total, memory_order_relaxed) + nanoseconds,
+                          memory_order_relaxed);
+    if (nanoseconds > atomic_load_explicit(&times->longest, memory_order_relaxed))
+        atomic_store_explicit(&times->longest, nanoseconds, memory_order_relaxed);
+    atomic_store_explicit(&times->count, count + 1, memory_order_release);
+}
+
+/**
+ * Orders two times for qsort.
+ * @param a The first time
+ * @param b The second time
+ * @return Negative, zero or positive as the first time is shorter, the same or longer
+ */
+static int compare_times(void const *a, void const *b) {
+    uint64_t x = *(uint64_t const *)a, y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Summarises the times of a phase, while they may still be being recorded.
+ * @param phase The phase
+ * @param summary Filled with the summary
+ */
+static void summarise(ProfilePhase phase, PhaseSummary *summary) {
+    PhaseTimes *times = &phases[phase];
+    summary->count = atomic_load_explicit(&times->count, memory_order_acquire);
+    summary->total = atomic_load_explicit(&times->total, memory_order_relaxed);
+    summary->longest = atomic_load_explicit(&times->longest, memory_order_relaxed);
+
+    size_t recent = summary->count < PROFILE_WINDOW ? (size_t)summary->count : PROFILE_WINDOW;
+    uint64_t sorted[PROFILE_WINDOW];
+    for (size_t i = 0; i < recent; i++)
+        sorted[i] = atomic_load_explicit(&times->samples[i], memory_order_relaxed);
+    qsort(sorted, recent, sizeof(uint64_t), compare_times);
+    summary->p50 = recent > 0 ? sorted[(recent - 1) / 2] : 0;
+    summary->p99 = recent > 0 ? sorted[(recent - 1) * 99 / 100] : 0;
+}
+
+/**
+ * Formats the recent times of every phase for the overlay, one line per phase.
+ * @param string Pointer to the string that will contain the times, which must be freed
+ */
+void profile_format(char **string) {
+    size_t size = PROFILE_PHASES * PROFILE_LINE, length = 0;
+    *string = malloc(size);
+    assert(*string != NULL);
+    for (unsigned int phase = 0; phase < PROFILE_PHASES; phase++) {
+        PhaseSummary summary;
+        summarise((ProfilePhase)phase, &summary);
+        int written = snprintf(*string + length, size - length, "%s%s: p50 %.3fms, p99 %.3fms, max %.3fms",
+                               phase > 0 ? "\n" : "", PHASE_NAMES[phase], (double)summary.p50 / 1000000,
+                               (double)summary.p99 / 1000000, (double)summary.longest / 1000000);
+        if (written > 0) length += (size_t)written < size - length ? (size_t)written : size - length - 1;
+    }
+}
+
+/**
+ * Writes a summary of every phase to a file, as JSON if the path ends in .json and as CSV otherwise. Times are in
+ * microseconds.
+ * @param path The path to write to
+ * @return true if the summary was written, false otherwise
+ */
+bool profile_dump(char const *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    size_t length = strlen(path);
+    bool json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+    fprintf(file, json ? "[\n" : "phase,count,total_us,mean_us,p50_us,p99_us,max_us\n");
+    for (unsigned int phase = 0; phase < PROFILE_PHASES; phase++) {
+        PhaseSummary summary;
+        summarise((ProfilePhase)phase, &summary);
+        double mean = summary.count > 0 ? (double)summary.total / (double)summary.count / 1000 : 0;
+        if (json) {
+            fprintf(file,
+                    "  {\"phase\": \"%s\", \"count\": %" PRIu64 ", \"total_us\": %.1f, \"mean_us\": %.1f, "
+                    "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}%s\n",
+                    PHASE_NAMES[phase], summary.count, (double)summary.total / 1000, mean, (double)summary.p50 / 1000,
+                    (double)summary.p99 / 1000, (double)summary.longest / 1000, phase + 1 < PROFILE_PHASES ? "," : "");
+        } else {
+            fprintf(file, "%s,%" PRIu64 ",%.1f,%.1f,%.1f,%.1f,%.1f\n", PHASE_NAMES[phase], summary.count,
+                    (double)summary.total / 1000, mean, (double)summary.p50 / 1000, (double)summary.p99 / 1000,
+                    (double)summary.longest / 1000);
+        }
+    }
+    if (json) fprintf(file, "]\n");
+
+    bool written = !ferror(file);
+    return fclose(file) == 0 && written;
+}
+
+#endif // CONWAY_PROFILE
@@ -0,0 +1,232 @@
+/**
+ * Contains the density pyramid of a grid. Each level is a byte per block of cells, 0 for an empty block and otherwise
+ * the share of the block alive scaled up to 255, rounded up so that a single living cell still shows at the top
+ * level. Rebuilding the pyramid would scan the whole grid, so instead the tiles which changed are collected from the
+ * environment after every change and only their blocks are recalculated when the pyramid is next needed. The levels
+ * whose blocks fit inside a tile are recalculated in parallel by the environment's workers, and the few blocks of
+ * the levels above them afterwards.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/pyramid.h"
+#include "../include/bitpack.h"
+#include "../include/workers.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The levels whose blocks never straddle two tiles. */
+#define TILE_LEVELS 5
+
+_Static_assert(ENV_TILE_HEIGHT >> TILE_LEVELS == 1 && ENV_TILE_WIDTH % ENV_TILE_HEIGHT == 0,
+               "Blocks of the tile levels must fit inside a tile");
+
+/** The density of a 2x2 block, indexed by the number of living cells in it. */
+static uint8_t const DENSITY[5] = {0, 64, 128, 192, 255};
+
+struct density_pyramid {
+    uint32_t widths[PYRAMID_LEVELS + 1];  /**< The number of blocks across each level, starting with the grid. */
+    uint32_t heights[PYRAMID_LEVELS + 1]; /**< The number of blocks down each level, starting with the grid. */
+    uint8_t *levels[PYRAMID_LEVELS + 1];  /**< The densities of each level, row by row (NULL for the grid). */
+    uint32_t tiles_x;                     /**< The number of columns of tiles in the grid. */
+    uint32_t tiles_y;                     /**< The number of rows of tiles in the grid. */
+    bool *dirty;                          /**< Whether each tile has changed since the pyramid was last updated. */
+};
+
+/**
+ * Creates the density pyramid of an environment. It starts out of date, and is filled in by its first update.
+ * @param env The environment
+ * @return The density pyramid, which must be freed with pyramid_destroy
+ */
+DensityPyramid *pyramid_init(Environment const *env) {
+    DensityPyramid *pyramid = malloc(sizeof(DensityPyramid));
+    assert(pyramid != NULL);
+    pyramid->widths[0] = env->width;
+    pyramid->heights[0] = env->height;
+    pyramid->levels[0] = NULL;
+    for (unsigned int level = 1; level <= PYRAMID_LEVELS; level++) {
+        pyramid->widths[level] = (pyramid->widths[level - 1] + 1) / 2;
+        pyramid->heights[level] = (pyramid->heights[level - 1] + 1) / 2;
+        pyramid->levels[level] = calloc((size_t)pyramid->widths[level] * pyramid->heights[level], sizeof(uint8_t));
+        assert(pyramid->levels[level] != NULL);
+    }
+    pyramid->tiles_x = env->tiles_x;
+    pyramid->tiles_y = env->tiles_y;
+    pyramid->dirty = malloc((size_t)env->tiles_x * env->tiles_y * sizeof(bool));
+    assert(pyramid->dirty != NULL);
+    memset(pyramid->dirty, true, (size_t)env->tiles_x * env->tiles_y * sizeof(bool));
+    return pyramid;
+}
+
+/**
+ * Frees a density pyramid.
+ * @param pyramid The density pyramid to destroy
+ */
+void pyramid_destroy(DensityPyramid *pyramid) {
+    for (unsigned int level = 1; level <= PYRAMID_LEVELS; level++)
+        free(pyramid->levels[level]);
+    free(pyramid->dirty);
+    free(pyramid);
+}
+
+/**
+ * Collects the tiles of an environment which have changed since they were last collected (see
+ * Environment.tile_dirty). Must be called before the environment's changed tiles are cleared for the pyramid to stay
+ * correct.
+ * @param pyramid The density pyramid of the environment
+ * @param env The environment
+ */
+void pyramid_mark(DensityPyramid *pyramid, Environment const *env) {
+    for (size_t i = 0; i < (size_t)pyramid->tiles_x * pyramid->tiles_y; i++)
+        pyramid->dirty[i] |= env->tile_dirty[i];
+}
+
+/**
+ * Recalculates the first level of a tile from the cells of the grid.
+ * @param pyramid The density pyramid
+ * @param env The environment
+ * @param tx The column of the tile
+ * @param ty The row of the tile
+ */
+static void update_cells(DensityPyramid *pyramid, Environment const *env, uint32_t tx, uint32_t ty) {
+    uint32_t first_col = tx * ENV_TILE_WIDTH, first_row = ty * ENV_TILE_HEIGHT;
+    uint32_t end_col = first_col + ENV_TILE_WIDTH < env->width ? first_col + ENV_TILE_WIDTH : env->width;
+    uint32_t end_row = first_row + ENV_TILE_HEIGHT < env->height ? first_row + ENV_TILE_HEIGHT : env->height;
+    static bool const EMPTY[ENV_TILE_WIDTH] = {false};
+
+    uint32_t width = end_col - first_col;
+    for (uint32_t y = first_row; y < end_row; y += 2) {
+        bool const *top = &env->grid[(uint64_t)env->stride * y + first_col];
+        bool const *bottom = y + 1 < end_row ? top + env->stride : EMPTY; // The last row of an odd height grid
+        uint8_t *blocks = &pyramid->levels[1][(uint64_t)pyramid->widths[1] * (y / 2) + first_col / 2];
+
+        // Eight cells of both rows are added at once, each byte holding the count of one column
+        uint32_t x = 0;
+        for (; x + 8 <= width; x += 8) {
+            uint64_t upper, lower;
+            memcpy(&upper, &top[x], sizeof(upper));
+            memcpy(&lower, &bottom[x], sizeof(lower));
+            uint64_t sum = upper + lower;
+            uint8_t columns[8];
+            memcpy(columns, &sum, sizeof(columns));
+            for (unsigned int i = 0; i < 4; i++)
+                blocks[x / 2 + i] = DENSITY[columns[2 * i] + columns[2 * i + 1]];
+        }
+        for (; x < width; x += 2) {
+            unsigned int count = top[x] + bottom[x];
+            if (x + 1 < width) count += top[x + 1] + bottom[x + 1]; // Past the edge is the halo, not empty
+            blocks[x / 2] = DENSITY[count];
+        }
+    }
+}
+
+/**
+ * Recalculates a rectangle of blocks of a level from the level below.
+ * @param pyramid The density pyramid
+ * @param level The level, from 2
+ * @param first_col The first column of blocks
+ * @param end_col One past the last column of blocks
+ * @param first_row The first row of blocks
+ * @param end_row One past the last row of blocks
+ */
+static void update_blocks(DensityPyramid *pyramid, unsigned int level, uint32_t first_col, uint32_t end_col,
+                          uint32_t first_row, uint32_t end_row) {
+    uint32_t below_width = pyramid->widths[level - 1], below_height = pyramid->heights[level - 1];
+    uint8_t const *below = pyramid->levels[level - 1];
+    for (uint32_t y = first_row; y < end_row; y++) {
+        uint8_t const *upper = &below[(uint64_t)below_width * (2 * y)];
+        uint8_t const *lower = 2 * y + 1 < below_height ? upper + below_width : NULL;
+        uint8_t *blocks = &pyramid->levels[level][(uint64_t)pyramid->widths[level] * y];
+        for (uint32_t x = first_col; x < end_col; x++) {
+            bool right = 2 * x + 1 < below_width; // Blocks past the edge are empty
+            unsigned int sum = upper[2 * x] + (right ? upper[2 * x + 1] : 0u);
+            if (lower != NULL) sum += lower[2 * x] + (right ? lower[2 * x + 1] : 0u);
+            blocks[x] = (uint8_t)((sum + 3) / 4); // Rounded up, so that no living cell disappears
+        }
+    }
+}
+
+/**
+ * Finds the blocks of a level which cover a tile, clipped to the level.
+ * @param pyramid The density pyramid
+ * @param level The level
+ * @param tx The column of the tile
+ * @param ty The row of the tile
+ * @param bounds Filled with the first column, end column, first row and end row of the blocks
+ */
+static void tile_blocks(DensityPyramid const *pyramid, unsigned int level, uint32_t tx, uint32_t ty,
+                        uint32_t bounds[4]) {
+    uint64_t width = ENV_TILE_WIDTH, height = ENV_TILE_HEIGHT;
+    bounds[0] = (uint32_t)((tx * width) >> level);
+    bounds[1] = (uint32_t)(((tx + 1) * width + ((uint64_t)1 << level) - 1) >> level);
+    bounds[2] = (uint32_t)((ty * height) >> level);
+    bounds[3] = (uint32_t)(((ty + 1) * height + ((uint64_t)1 << level) - 1) >> level);
+    if (bounds[1] > pyramid->widths[level]) bounds[1] = pyramid->widths[level];
+    if (bounds[3] > pyramid->heights[level]) bounds[3] = pyramid->heights[level];
+}
+
+/** The pyramid and environment shared with the workers updating the tile levels. */
+typedef struct {
+    DensityPyramid *pyramid; /**< The density pyramid being updated. */
+    Environment const *env;  /**< The environment it is the pyramid of. */
+} PyramidJob;
+
+/**
+ * Recalculates the tile levels of the changed tiles in a row of tiles.
+ * @param context The PyramidJob
+ * @param band The row of tiles
+ * @param worker The worker (unused)
+ */
+static void pyramid_band(void *context, uint32_t band, unsigned int worker) {
+    (void)worker;
+    PyramidJob *job = (PyramidJob *)context;
+    DensityPyramid *pyramid = job->pyramid;
+    for (uint32_t tx = 0; tx < pyramid->tiles_x; tx++) {
+        if (!pyramid->dirty[(size_t)band * pyramid->tiles_x + tx]) continue;
+        update_cells(pyramid, job->env, tx, band);
+        for (unsigned int level = 2; level <= TILE_LEVELS; level++) {
+            uint32_t bounds[4];
+            tile_blocks(pyramid, level, tx, band, bounds);
+            update_blocks(pyramid, level, bounds[0], bounds[1], bounds[2], bounds[3]);
+        }
+    }
+}
+
+/**
+ * Brings a density pyramid up to date with the changes collected since it was last updated.
+ * @param pyramid The density pyramid
+ * @param env The environment it is the pyramid of
+ */
+void pyramid_update(DensityPyramid *pyramid, Environment *env) {
+    bitpack_unpack(env); // The cells of the tiles left behind by the bit-packed kernel are read
+    PyramidJob job = {.pyramid = pyramid, .env = env};
+    workers_run(env->workers, pyramid_band, &job, pyramid->tiles_y);
+
+    // The blocks above the tile levels cover several tiles, so are recalculated one level at a time
+    for (unsigned int level = TILE_LEVELS + 1; level <= PYRAMID_LEVELS; level++) {
+        for (uint32_t ty = 0; ty < pyramid->tiles_y; ty++) {
+            for (uint32_t tx = 0; tx < pyramid->tiles_x; tx++) {
+                if (!pyramid->dirty[(size_t)ty * pyramid->tiles_x + tx]) continue;
+                uint32_t bounds[4];
+                tile_blocks(pyramid, level, tx, ty, bounds);
+                update_blocks(pyramid, level, bounds[0], bounds[1], bounds[2], bounds[3]);
+            }
+        }
+    }
+    memset(pyramid->dirty, false, (size_t)pyramid->tiles_x * pyramid->tiles_y * sizeof(bool));
+}
+
+/**
+ * Gets a level of a density pyramid.
+ * @param pyramid The density pyramid, which should be up to date
+ * @param level The level, from 1 to PYRAMID_LEVELS
+ * @param width Filled with the number of blocks across the level
+ * @param height Filled with the number of blocks down the level
+ * @return The densities of the blocks, row by row
+ */
+uint8_t const *pyramid_level(DensityPyramid const *pyramid, unsigned int level, uint32_t *width, uint32_t *height) {
+    *width = pyramid->widths[level];
+    *height = pyramid->heights[level];
+    return pyramid->levels[level];
+}
@@ -0,0 +1,412 @@
+/**
+ * Contains the recorder, which saves each generation shown to a Y4M video or a sequence of PNG images.
+ *
+ * Capturing a frame only copies the bit-packed grid into a slot of a single-producer single-consumer ring buffer, and
+ * a background thread encodes and writes the frames in order. The ring buffer is sized to a memory budget, and a
+ * frame which arrives while it is full is dropped (and counted) instead of waiting for the writer to catch up. PNG
+ * images are written with 1 bit per cell and stored (uncompressed) deflate blocks, so no compression library is needed.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/recorder.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** How long the writer sleeps between checks of an empty queue, in case a wake up was missed. */
+#define WRITER_POLL_NS 50000000L
+/** The largest block of a stored deflate stream. */
+#define DEFLATE_BLOCK 65535
+
+/** A frame waiting to be written. */
+typedef struct {
+    uint64_t generation; /**< The generation shown in the frame. */
+    uint32_t alive;      /**< The colour of living cells, as 0xRRGGBB. */
+    uint32_t dead;       /**< The colour of dead cells, as 0xRRGGBB. */
+    uint64_t *grid;      /**< The bit-packed grid. */
+} Frame;
+
+struct recorder {
+    RecordFormat format;      /**< The format frames are written in. */
+    char *path;               /**< The Y4M file, or the prefix of the PNG files. */
+    FILE *video;              /**< The open Y4M file. */
+    uint32_t width;           /**< The width of each frame. */
+    uint32_t height;          /**< The height of each frame. */
+    uint32_t row_words;       /**< The number of words in each row of a bit-packed frame. */
+    Frame *frames;            /**< The ring buffer of frames. */
+    uint32_t capacity;        /**< The number of frames in the ring buffer. */
+    _Atomic uint64_t head;    /**< The number of frames captured, written only by the capturing thread. */
+    _Atomic uint64_t tail;    /**< The number of frames written, written only by the writer thread. */
+    _Atomic bool quit;        /**< Set to make the writer exit once the queue is empty. */
+    _Atomic bool failed;      /**< Set by the writer if a frame could not be written, after which none are. */
+    uint64_t dropped;         /**< The number of frames dropped because the queue was full. */
+    uint64_t skipped;         /**< The number of generations skipped because the whole grid was not shown. */
+    uint64_t last_skipped;    /**< The generation last skipped. */
+    uint64_t last_generation; /**< The generation of the last frame captured. */
+    uint64_t last_hash;       /**< The hash of the grid in the last frame captured. */
+    bool captured;            /**< Whether any frame has been captured. */
+    pthread_t thread;         /**< The writer thread. */
+    pthread_mutex_t lock;     /**< Held by the writer while it waits for frames. */
+    pthread_cond_t wake;      /**< Signalled when a frame is captured or the writer should quit. */
+    uint8_t *buffer;          /**< The writer's buffer for encoding a frame. */
+    uint32_t crc_table[256];  /**< The CRC-32 of each byte, for PNG chunks. */
+};
+
+/**
+ * Fills the table of CRC-32 remainders used to checksum PNG chunks.
+ * @param table The table
+ */
+static void crc_init(uint32_t table[256]) {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+    }
+}
+
+/**
+ * Continues a CRC-32.
+ * @param table The table of remainders
+ * @param crc The CRC of the bytes before, inverted (start from 0xFFFFFFFF)
+ * @param bytes The bytes
+ * @param length The number of bytes
+ * @return The CRC including the bytes, inverted
+ */
+static uint32_t crc_update(uint32_t const table[256], uint32_t crc, uint8_t const *bytes, size_t length) {
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+/**
+ * Writes a 32-bit integer in big-endian (network) byte order, as PNG requires.
+ * @param out Where to write the integer
+ * @param value The integer
+ */
+static void put_be32(uint8_t *out, uint32_t value) {
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
+
+/**
+ * Writes a PNG chunk.
+ * @param recorder The recorder
+ * @param file The PNG file
+ * @param type The four letter type of the chunk
+ * @param data The contents of the chunk
+ * @param length The length of the contents
+ * @return true if the chunk was written
+ */
+static bool write_chunk(Recorder const *recorder, FILE *file, char const type[4], uint8_t const *data, size_t length) {
+    uint8_t header[8], footer[4];
+    put_be32(header, (uint32_t)length);
+    memcpy(&header[4], type, 4);
+    uint32_t crc = crc_update(recorder->crc_table, 0xFFFFFFFFu, &header[4], 4);
+    crc = crc_update(recorder->crc_table, crc, data, length);
+    put_be32(footer, crc ^ 0xFFFFFFFFu);
+    return fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+           (length == 0 || fwrite(data, 1, length, file) == length) &&
+           fwrite(footer, 1, sizeof(footer), file) == sizeof(footer);
+}
+
+/**
+ * Writes a frame as a 1-bit PNG image with a two colour palette.
+ * @param recorder The recorder
+ * @param frame The frame
+ * @return true if the image was written
+ */
+static bool write_png(Recorder *recorder, Frame const *frame) {
+    char *path = malloc(strlen(recorder->path) + 32);
+    assert(path != NULL);
+    sprintf(path, "%s%08" PRIu64 ".png", recorder->path, frame->generation);
+    FILE *file = fopen(path, "wb");
+    free(path);
+    if (file == NULL) return false;
+
+    // Each row is a filter byte (none) followed by the cells, most significant bit first, 1 for living cells
+    size_t row_bytes = 1 + (recorder->width + 7) / 8;
+    size_t raw_length = row_bytes * recorder->height;
+    size_t blocks = raw_length / DEFLATE_BLOCK + 1;
+    uint8_t *raw = recorder->buffer + 2 + 5 * blocks; // The raw rows are moved into their blocks as they are framed
+    for (uint32_t y = 0; y < recorder->height; y++) {
+        uint8_t *row = &raw[row_bytes * y];
+        uint64_t const *words = &frame->grid[(uint64_t)recorder->row_words * y];
+        row[0] = 0;
+        for (size_t i = 0; i + 1 < row_bytes; i++) {
+            uint8_t byte = (uint8_t)(words[i / 8] >> (i % 8 * 8)); // Bit-packed cells are least significant bit first
+            byte = (uint8_t)((byte & 0xF0) >> 4 | (byte & 0x0F) << 4);
+            byte = (uint8_t)((byte & 0xCC) >> 2 | (byte & 0x33) << 2);
+            row[1 + i] = (uint8_t)((byte & 0xAA) >> 1 | (byte & 0x55) << 1);
+        }
+        if (recorder->width % 8 != 0) row[row_bytes - 1] &= (uint8_t)(0xFF << (8 - recorder->width % 8));
+    }
+
+    // A zlib stream of stored deflate blocks, each a 5 byte header followed by up to DEFLATE_BLOCK raw bytes
+    uint8_t *zlib = recorder->buffer;
+    zlib[0] = 0x78;
+    zlib[1] = 0x01;
+    size_t length = 2;
+    uint32_t adler_a = 1, adler_b = 0;
+    for (size_t offset = 0;; offset += DEFLATE_BLOCK) {
+        uint16_t size = (uint16_t)(raw_length - offset < DEFLATE_BLOCK ? raw_length - offset : DEFLATE_BLOCK);
+        uint8_t *block = &zlib[length];
+        memmove(&block[5], &raw[offset], size);
+        block[0] = offset + size >= raw_length; // Final block flag
+        block[1] = (uint8_t)size;
+        block[2] = (uint8_t)(size >> 8);
+        block[3] = (uint8_t)~size;
+        block[4] = (uint8_t)(~size >> 8);
+        for (uint16_t i = 0; i < size; i++) {
+            adler_a = (adler_a + block[5 + i]) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+        length += 5 + size;
+        if (offset + size >= raw_length) break;
+    }
+    put_be32(&zlib[length], adler_b << 16 | adler_a);
+    length += 4;
+
+    static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    uint8_t header[13] = {0};
+    put_be32(&header[0], recorder->width);
+    put_be32(&header[4], recorder->height);
+    header[8] = 1; // Bit depth
+    header[9] = 3; // Palette colour type
+    uint8_t palette[6] = {(uint8_t)(frame->dead >> 16),  (uint8_t)(frame->dead >> 8),  (uint8_t)frame->dead,
+                          (uint8_t)(frame->alive >> 16), (uint8_t)(frame->alive >> 8), (uint8_t)frame->alive};
+    bool written = fwrite(SIGNATURE, 1, sizeof(SIGNATURE), file) == sizeof(SIGNATURE) &&
+                   write_chunk(recorder, file, "IHDR", header, sizeof(header)) &&
+                   write_chunk(recorder, file, "PLTE", palette, sizeof(palette)) &&
+                   write_chunk(recorder, file, "IDAT", zlib, length) && write_chunk(recorder, file, "IEND", NULL, 0);
+    return fclose(file) == 0 && written;
+}
+
+/**
+ * Converts a colour to the studio-range BT.601 luma and chroma used by Y4M.
+ * @param colour The colour, as 0xRRGGBB
+ * @param yuv Output for the luma, blue chroma and red chroma
+ */
+static void rgb_to_yuv(uint32_t colour, uint8_t yuv[3]) {
+    int r = (int)(colour >> 16 & 0xFF), g = (int)(colour >> 8 & 0xFF), b = (int)(colour & 0xFF);
+    yuv[0] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    yuv[1] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    yuv[2] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+/**
+ * Writes a frame to the Y4M video, as full-resolution luma, blue chroma and red chroma planes.
+ * @param recorder The recorder
+ * @param frame The frame
+ * @return true if the frame was written
+ */
+static bool write_y4m(Recorder *recorder, Frame const *frame) {
+    uint8_t colours[2][3];
+    rgb_to_yuv(frame->dead, colours[0]);
+    rgb_to_yuv(frame->alive, colours[1]);
+
+    size_t plane = (size_t)recorder->width * recorder->height;
+    for (uint32_t y = 0; y < recorder->height; y++) {
+        uint64_t const *words = &frame->grid[(uint64_t)recorder->row_words * y];
+        for (uint32_t x = 0; x < recorder->width; x++) {
+            bool alive = (words[x / 64] >> (x % 64)) & 1;
+            size_t i = (size_t)recorder->width * y + x;
+            recorder->buffer[i] = colours[alive][0];
+            recorder->buffer[plane + i] = colours[alive][1];
+            recorder->buffer[2 * plane + i] = colours[alive][2];
+        }
+    }
+    return fputs("FRAME\n", recorder->video) >= 0 &&
+           fwrite(recorder->buffer, 1, 3 * plane, recorder->video) == 3 * plane;
+}
+
+/**
+ * Main loop of the writer thread: wait for frames and write them in order until told to quit with none left.
+ * @param arg The Recorder
+ * @return NULL
+ */
+static void *recorder_main(void *arg) {
+    Recorder *recorder = (Recorder *)arg;
+    while (true) {
+        uint64_t tail = atomic_load_explicit(&recorder->tail, memory_order_relaxed);
+        if (tail == atomic_load_explicit(&recorder->head, memory_order_acquire)) {
+            if (atomic_load(&recorder->quit)) break;
+
+            // Sleep until a frame is captured, checking again every so often in case the wake up was missed
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WRITER_POLL_NS;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_mutex_lock(&recorder->lock);
+            if (tail == atomic_load_explicit(&recorder->head, memory_order_acquire) && !atomic_load(&recorder->quit))
+                pthread_cond_timedwait(&recorder->wake, &recorder->lock, &deadline);
+            pthread_mutex_unlock(&recorder->lock);
+            continue;
+        }
+
+        Frame const *frame = &recorder->frames[tail % recorder->capacity];
+        if (!atomic_load_explicit(&recorder->failed, memory_order_relaxed) &&
+            !(recorder->format == RECORD_Y4M ? write_y4m(recorder, frame) : write_png(recorder, frame))) {
+            fprintf(stderr, "Could not write frame of generation %" PRIu64 " to '%s'.\n", frame->generation,
+                    recorder->path);
+            atomic_store_explicit(&recorder->failed, true, memory_order_relaxed);
+        }
+        atomic_store_explicit(&recorder->tail, tail + 1, memory_order_release); // Hands the slot back
+    }
+    return NULL;
+}
+
+/**
+ * Starts recording. A path ending in `.y4m` is written as a Y4M video, and any other path is used as the prefix of
+ * PNG images named by generation (`<path>00000042.png`).
+ * @param path The video file or image prefix
+ * @param width The width of the grid recorded
+ * @param height The height of the grid recorded
+ * @param memory The number of bytes of frames allowed to wait for the writer before frames are dropped
+ * @return The recorder, or NULL if the video file could not be created
+ */
+Recorder *recorder_init(char const *path, uint32_t width, uint32_t height, size_t memory) {
+    Recorder *recorder = calloc(1, sizeof(Recorder));
+    assert(recorder != NULL);
+    recorder->path = malloc(strlen(path) + 1);
+    assert(recorder->path != NULL);
+    strcpy(recorder->path, path);
+    recorder->width = width;
+    recorder->height = height;
+    recorder->row_words = (width + 63) / 64;
+
+    size_t length = strlen(path);
+    recorder->format = length >= 4 && strcmp(&path[length - 4], ".y4m") == 0 ? RECORD_Y4M : RECORD_PNG;
+    if (recorder->format == RECORD_Y4M) {
+        recorder->video = fopen(path, "wb");
+        if (recorder->video == NULL ||
+            fprintf(recorder->video, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n", width, height, RECORDER_FRAME_RATE) <
+                0) {
+            if (recorder->video != NULL) fclose(recorder->video);
+            free(recorder->path);
+            free(recorder);
+            return NULL;
+        }
+    }
+
+    // Enough slots to fill the memory budget, but at least two so the writer can work on one while another is filled
+    size_t frame_size = (size_t)recorder->row_words * height * sizeof(uint64_t);
+    size_t capacity = memory / frame_size;
+    recorder->capacity = capacity < 2 ? 2 : capacity > RECORDER_MAX_FRAMES ? RECORDER_MAX_FRAMES : (uint32_t)capacity;
+    recorder->frames = calloc(recorder->capacity, sizeof(Frame));
+    assert(recorder->frames != NULL);
+    for (uint32_t i = 0; i < recorder->capacity; i++) {
+        recorder->frames[i].grid = malloc(frame_size);
+        assert(recorder->frames[i].grid != NULL);
+    }
+
+    // Large enough for three planes of a Y4M frame, or the rows of a PNG image with their deflate block headers
+    size_t png_raw = ((size_t)(width + 7) / 8 + 1) * height;
+    size_t png_size = 2 + 5 * (png_raw / DEFLATE_BLOCK + 1) + png_raw + 4;
+    size_t y4m_size = (size_t)3 * width * height;
+    recorder->buffer = malloc(recorder->format == RECORD_Y4M ? y4m_size : png_size);
+    assert(recorder->buffer != NULL);
+
+    crc_init(recorder->crc_table);
+    atomic_init(&recorder->head, 0);
+    atomic_init(&recorder->tail, 0);
+    atomic_init(&recorder->quit, false);
+    atomic_init(&recorder->failed, false);
+    pthread_mutex_init(&recorder->lock, NULL);
+    pthread_cond_init(&recorder->wake, NULL);
+    int err = pthread_create(&recorder->thread, NULL, recorder_main, recorder);
+    assert(err == 0);
+    (void)err;
+    return recorder;
+}
+
+/**
+ * Stops recording once every frame captured has been written, and frees the recorder.
+ * @param recorder The recorder to destroy
+ */
+void recorder_destroy(Recorder *recorder) {
+    atomic_store(&recorder->quit, true);
+    pthread_mutex_lock(&recorder->lock);
+    pthread_cond_signal(&recorder->wake);
+    pthread_mutex_unlock(&recorder->lock);
+    pthread_join(recorder->thread, NULL);
+    pthread_mutex_destroy(&recorder->lock);
+    pthread_cond_destroy(&recorder->wake);
+
+    if (recorder->video != NULL) fclose(recorder->video);
+    for (uint32_t i = 0; i < recorder->capacity; i++)
+        free(recorder->frames[i].grid);
+    free(recorder->frames);
+    free(recorder->buffer);
+    free(recorder->path);
+    free(recorder);
+}
+
+/**
+ * Captures a grid as the next frame, unless it is the same generation as the last frame or does not show the whole
+ * grid (when zoomed in on part of it, or zoomed out to blocks of cells), in which case the generation is counted as
+ * skipped. Only the bit-packed grid is copied on the calling thread. If the writer has fallen so far behind that the
+ * queue is full, the frame is dropped.
+ * @param recorder The recorder
+ * @param cells The bit-packed cells shown, or NULL if blocks of cells are shown instead
+ * @param x0 The column of the grid shown first
+ * @param y0 The row of the grid shown first
+ * @param width The number of columns shown
+ * @param height The number of rows shown
+ * @param generation The generation of the grid
+ * @param hash The hash of the grid, which tells edits apart from the generation they were made in
+ * @param alive The colour of living cells, as 0xRRGGBB
+ * @param dead The colour of dead cells, as 0xRRGGBB
+ * @return true if the frame was captured or skipped, false if it was dropped
+ */
+bool recorder_capture(Recorder *recorder, uint64_t const *cells, int64_t x0, int64_t y0, uint32_t width,
+                      uint32_t height, uint64_t generation, uint64_t hash, uint32_t alive, uint32_t dead) {
+    if (recorder->captured && generation == recorder->last_generation && hash == recorder->last_hash) return true;
+    if (cells == NULL || x0 != 0 || y0 != 0 || width != recorder->width || height != recorder->height) {
+        if (recorder->skipped == 0 || generation != recorder->last_skipped) recorder->skipped++; // Once per generation
+        recorder->last_skipped = generation;
+        return true;
+    }
+    recorder->captured = true;
+    recorder->last_generation = generation;
+    recorder->last_hash = hash;
+
+    uint64_t head = atomic_load_explicit(&recorder->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&recorder->tail, memory_order_acquire) == recorder->capacity) {
+        recorder->dropped++;
+        return false;
+    }
+
+    Frame *frame = &recorder->frames[head % recorder->capacity];
+    frame->generation = generation;
+    frame->alive = alive;
+    frame->dead = dead;
+    memcpy(frame->grid, cells, (size_t)recorder->row_words * recorder->height * sizeof(uint64_t));
+    atomic_store_explicit(&recorder->head, head + 1, memory_order_release); // Publishes the frame
+    pthread_cond_signal(&recorder->wake); // Without the lock, since a missed wake up only delays the writer
+    return true;
+}
+
+/**
+ * Counts the frames dropped because the writer fell behind.
+ * @param recorder The recorder
+ * @return The number of frames dropped
+ */
+uint64_t recorder_dropped(Recorder const *recorder) { return recorder->dropped; }
+
+/**
+ * Counts the generations skipped because they were not shown cell for cell, when zoomed in or out.
+ * @param recorder The recorder
+ * @return The number of generations skipped
+ */
+uint64_t recorder_skipped(Recorder const *recorder) { return recorder->skipped; }
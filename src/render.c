@@ -0,0 +1,229 @@
+/**
+ * Contains the drawing of the simulation grid. Rather than handing the renderer a point for every living cell, the
+ * frame published by the simulation is written into a streaming texture at one pixel per cell, which is then copied to
+ * the screen scaled up to the zoom level. Filling the texture costs the same however many cells are alive, and the
+ * scaling is left to the GPU. Frames zoomed out below a pixel per cell hold the density of each block of cells instead,
+ * which is drawn as a pixel shaded between the two colours. The texture keeps the last frame drawn, so when the frame
+ * is in the same place and only a few tiles of the grid changed, only those tiles are written into the texture and
+ * uploaded; a board which is mostly still costs little however much of it is alive.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/render.h"
+#include "../include/profile.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct cell_renderer {
+    SDL_Renderer *renderer; /**< The renderer drawn with. */
+    SDL_Texture *texture;   /**< The streaming texture holding a pixel for each cell. */
+    int width;              /**< The width of the texture. */
+    int height;             /**< The height of the texture. */
+    uint64_t serial;        /**< The frame the texture holds, or 0 if it holds none. */
+    int64_t x0;             /**< The x coordinate of the first column of the frame the texture holds. */
+    int64_t y0;             /**< The y coordinate of the first row of the frame the texture holds. */
+    unsigned int lod;       /**< The level of detail of the frame the texture holds. */
+    uint32_t alive_pixel;   /**< The colour the texture holds living cells in. */
+    uint32_t dead_pixel;    /**< The colour the texture holds dead cells in. */
+};
+
+/**
+ * Creates a cell renderer. The texture is created on first use, at the size of the grid drawn.
+ * @param renderer The renderer to draw with
+ * @return The cell renderer, which must be freed with render_destroy
+ */
+CellRenderer *render_init(SDL_Renderer *renderer) {
+    CellRenderer *cells = malloc(sizeof(CellRenderer));
+    assert(cells != NULL);
+    cells->renderer = renderer;
+    cells->texture = NULL;
+    cells->width = 0;
+    cells->height = 0;
+    cells->serial = 0;
+    return cells;
+}
+
+/**
+ * Frees a cell renderer and its texture.
+ * @param cells The cell renderer to destroy
+ */
+void render_destroy(CellRenderer *cells) {
+    if (cells->texture != NULL) SDL_DestroyTexture(cells->texture);
+    free(cells);
+}
+
+/**
+ * Converts a colour to a pixel of the texture.
+ * @param colour The colour
+ * @return The colour in ARGB8888 format
+ */
+static inline uint32_t pixel(SDL_Color colour) {
+    return 0xFF000000u | (uint32_t)colour.r << 16 | (uint32_t)colour.g << 8 | colour.b;
+}
+
+/**
+ * Mixes the colours of dead and living cells for a block of cells. Any living cell shows clearly, so that small
+ * patterns do not vanish when zoomed out, and denser blocks are closer to the colour of living cells.
+ * @param alive The colour of living cells
+ * @param dead The colour of dead cells
+ * @param density The density of the block, from 0 for an empty block to 255 for a full one
+ * @return The colour of the block in ARGB8888 format
+ */
+static uint32_t block_pixel(SDL_Color alive, SDL_Color dead, unsigned int density) {
+    unsigned int weight = density == 0 ? 0 : 96 + density * 159 / 255;
+    SDL_Color mixed = {
+        (Uint8)((alive.r * weight + dead.r * (255 - weight)) / 255),
+        (Uint8)((alive.g * weight + dead.g * (255 - weight)) / 255),
+        (Uint8)((alive.b * weight + dead.b * (255 - weight)) / 255),
+        255,
+    };
+    return pixel(mixed);
+}
+
+/**
+ * Makes sure the texture is the given size, replacing it if it is not.
+ * @param cells The cell renderer
+ * @param width The width needed
+ * @param height The height needed
+ * @return true if the texture is ready, false if it could not be created
+ */
+static bool fit_texture(CellRenderer *cells, int width, int height) {
+    if (cells->texture != NULL && cells->width == width && cells->height == height) return true;
+    if (cells->texture != NULL) SDL_DestroyTexture(cells->texture);
+    cells->texture =
+        SDL_CreateTexture(cells->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+    cells->width = width;
+    cells->height = height;
+    cells->serial = 0; // Nothing drawn into the new texture yet
+    return cells->texture != NULL;
+}
+
+/**
+ * Writes a rectangle of a frame into the texture.
+ * @param cells The cell renderer
+ * @param frame The frame
+ * @param area The rectangle, in columns and rows of the frame
+ * @param alive The colour of living cells
+ * @param dead The colour of dead cells
+ * @param shades The colour of each density, above level of detail 0
+ * @return true if the rectangle was written
+ */
+static bool fill(CellRenderer *cells, SimulationFrame const *frame, SDL_Rect const *area, uint32_t alive,
+                 uint32_t dead, uint32_t const *shades) {
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(cells->texture, area, &pixels, &pitch) != 0) return false;
+    uint32_t left = (uint32_t)area->x, right = left + (uint32_t)area->w;
+    for (int y = 0; y < area->h; y++) {
+        uint32_t *row = (uint32_t *)((uint8_t *)pixels + (size_t)pitch * (size_t)y);
+        uint64_t source = (uint64_t)area->y + (uint64_t)y;
+        if (frame->lod == 0) {
+            // Each cell is 0 or 1, so selects between the colours without a branch
+            uint32_t flip = alive ^ dead;
+            uint64_t const *words = &frame->cells[frame->row_words * source];
+            for (uint32_t x = left; x < right; x++)
+                row[x - left] = dead ^ (flip & -(uint32_t)((words[x / 64] >> (x % 64)) & 1));
+        } else {
+            uint8_t const *blocks = &frame->density[frame->width * source];
+            for (uint32_t x = left; x < right; x++)
+                row[x - left] = shades[blocks[x]];
+        }
+    }
+    SDL_UnlockTexture(cells->texture);
+    return true;
+}
+
+/**
+ * Finds the columns or rows of a frame covered by a range of cells.
+ * @param first The first cell
+ * @param end One past the last cell
+ * @param origin The first cell of the frame
+ * @param lod The level of detail of the frame
+ * @param size The number of columns or rows of the frame
+ * @param range Filled with the first column or row and the number of them
+ */
+static void frame_range(int64_t first, int64_t end, int64_t origin, unsigned int lod, uint32_t size, int range[2]) {
+    int64_t block = (int64_t)1 << lod;
+    int64_t start = first > origin ? (first - origin) >> lod : 0;
+    int64_t stop = (end - origin + block - 1) >> lod;
+    if (stop > size) stop = size;
+    range[0] = (int)start;
+    range[1] = stop > start ? (int)(stop - start) : 0;
+}
+
+/**
+ * Writes the tiles of a frame which changed since the frame the texture holds, with runs of changed tiles along a
+ * row written together.
+ * @param cells The cell renderer
+ * @param frame The frame
+ * @param alive The colour of living cells
+ * @param dead The colour of dead cells
+ * @param shades The colour of each density, above level of detail 0
+ * @return true if the tiles were written
+ */
+static bool fill_changes(CellRenderer *cells, SimulationFrame const *frame, uint32_t alive, uint32_t dead,
+                         uint32_t const *shades) {
+    for (uint32_t i = 0; i < frame->change_count;) {
+        uint32_t first = frame->changes[i], ty = first / frame->tiles_x, end = first + 1;
+        for (i++; i < frame->change_count && frame->changes[i] == end && end % frame->tiles_x != 0; i++)
+            end++;
+
+        int columns[2], rows[2];
+        int64_t first_col = (int64_t)(first % frame->tiles_x) * ENV_TILE_WIDTH;
+        int64_t end_col = first_col + (int64_t)(end - first) * ENV_TILE_WIDTH;
+        frame_range(first_col, end_col, frame->x0, frame->lod, frame->width, columns);
+        frame_range((int64_t)ty * ENV_TILE_HEIGHT, (int64_t)(ty + 1) * ENV_TILE_HEIGHT, frame->y0, frame->lod,
+                    frame->height, rows);
+        if (columns[1] == 0 || rows[1] == 0) continue;
+        SDL_Rect area = {columns[0], rows[0], columns[1], rows[1]};
+        if (!fill(cells, frame, &area, alive, dead, shades)) return false;
+    }
+    return true;
+}
+
+/**
+ * Draws a frame published by the simulation. The current render scale zooms it, which is below 1 for frames of blocks.
+ * Only the tiles which changed are written into the texture if it already holds the same part of an earlier frame.
+ * @param cells The cell renderer
+ * @param frame The frame to draw
+ * @param x_offset The x position on screen of cell (0, 0), before scaling
+ * @param y_offset The y position on screen of cell (0, 0), before scaling
+ * @param alive The colour of living cells
+ * @param dead The colour of dead cells
+ * @return true if the frame was drawn
+ */
+bool render_frame(CellRenderer *cells, SimulationFrame const *frame, int x_offset, int y_offset, SDL_Color alive,
+                  SDL_Color dead) {
+    PROFILE_SCOPE(PROFILE_UPLOAD);
+    if (frame->width == 0 || frame->height == 0) return true; // Nothing published yet
+    if (!fit_texture(cells, (int)frame->width, (int)frame->height)) return false;
+
+    uint32_t alive_pixel = pixel(alive), dead_pixel = pixel(dead);
+    bool same = cells->serial != 0 && cells->x0 == frame->x0 && cells->y0 == frame->y0 && cells->lod == frame->lod &&
+                cells->alive_pixel == alive_pixel && cells->dead_pixel == dead_pixel;
+    if (!same || cells->serial != frame->serial) {
+        uint32_t shades[256];
+        if (frame->lod != 0) {
+            for (unsigned int density = 0; density < 256; density++)
+                shades[density] = block_pixel(alive, dead, density);
+        }
+        bool partial = same && !frame->all_changed && cells->serial >= frame->since && cells->serial < frame->serial;
+        SDL_Rect whole = {0, 0, (int)frame->width, (int)frame->height};
+        cells->serial = 0; // Until the texture is known to hold the frame
+        if (partial ? !fill_changes(cells, frame, alive_pixel, dead_pixel, shades)
+                    : !fill(cells, frame, &whole, alive_pixel, dead_pixel, shades))
+            return false;
+        cells->serial = frame->serial;
+        cells->x0 = frame->x0;
+        cells->y0 = frame->y0;
+        cells->lod = frame->lod;
+        cells->alive_pixel = alive_pixel;
+        cells->dead_pixel = dead_pixel;
+    }
+
+    // Blocks are drawn at their size in cells, and scaled back down to a pixel each by the render scale
+    SDL_Rect destination = {(int)frame->x0 + x_offset, (int)frame->y0 + y_offset, (int)frame->width << frame->lod,
+                            (int)frame->height << frame->lod};
+    return SDL_RenderCopy(cells->renderer, cells->texture, NULL, &destination) == 0;
+}
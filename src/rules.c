@@ -4,111 +4,146 @@
  * @author Matteo Golin
  * @version 1.0
  */
+#include "../include/asprintf.h" // First, so that _GNU_SOURCE is defined before any system header
 #include "../include/rules.h"
-#include "../include/asprintf.h"
+#include "../include/boxsum.h"
+#include "../include/simd.h"
+#include <assert.h>
+#include <ctype.h>
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
+
+/* RULESTRINGS */
 
 /**
- * Calculates the next state for the cell at (x, y) based on Conway's original Game of Life rules
- * @param env The environment that holds the simulation
- * @param x The x coordinate of the current cell
- * @param y The y coordinate of the current cell
- * @return The next state of the cell (true for alive, false for dead)
+ * Parses the neighbour counts of one half of a rulestring, either as single digits ("23") or as comma-separated
+ * numbers for neighbourhoods with more than nine cells ("3,10,11").
+ * @param counts The counts to parse, ending at a '/' or the end of the string
+ * @param max The largest neighbour count possible in the neighbourhood
+ * @param mask Output bitmask of the parsed counts
+ * @return A pointer just past the parsed counts, or NULL if they were malformed
  */
-state_calculator(conway_next_state) {
-    unsigned int neighbours = num_neighbours(env, x, y, &MOORE);
-    bool alive = env_access(env, x, y);
-
-    // If a cell is alive and has:
-    // 1 or fewer neighbours, it dies
-    // 4 or more neighbours, it dies
-    // 2-3 neighbours, it stays alive
-    if (alive) return !(neighbours <= 1 || neighbours >= 4);
+static char const *parse_counts(char const *counts, unsigned int max, uint32_t *mask) {
+    bool separated = false;
+    for (char const *c = counts; *c != '\0' && *c != '/'; c++)
+        separated |= *c == ',';
+
+    *mask = 0;
+    while (*counts != '\0' && *counts != '/') {
+        if (!isdigit((unsigned char)*counts)) return NULL;
+
+        unsigned int count = 0;
+        if (separated) {
+            while (isdigit((unsigned char)*counts))
+                count = count * 10 + (unsigned int)(*counts++ - '0');
+            if (*counts == ',') counts++;
+        } else {
+            count = (unsigned int)(*counts++ - '0');
+        }
 
-    // If a cell is dead and it has exactly 3 neighbours, it becomes alive
-    return neighbours == 3;
+        if (count > max) return NULL;
+        *mask |= (uint32_t)1 << count;
+    }
+    return counts;
 }
 
 /**
- * Calculates the next state for the cell at (x, y) based on the rules for Maze cells
- * @param env The environment that holds the simulation
- * @param x The x coordinate of the current cell
- * @param y The y coordinate of the current cell
- * @return The next state of the cell (true for alive, false for dead)
+ * Compiles a B/S rulestring (i.e. "B3/S23" for Conway's Game of Life) into a lookup table. The birth and survival
+ * halves may appear in either order, and the traditional "23/3" survival/birth notation is also accepted.
+ * @param rulestring The rulestring to compile
+ * @param neighbourhood The neighbourhood the rule counts neighbours in
+ * @param rule Output for the compiled rule
+ * @return true if the rulestring was valid, false otherwise
  */
-state_calculator(maze_next_state) {
-    bool alive = env_access(env, x, y);
-    unsigned int neighbours = num_neighbours(env, x, y, &MOORE);
-    if (alive) return 2 <= neighbours && neighbours <= 5; // If already alive must have 2-5 neighbours to survive
-    return neighbours == 3;                               // If dead, must have exactly 3 neighbours to live
-}
+bool rule_compile(char const *rulestring, Neighbourhood const *neighbourhood, LifeRule *rule) {
+
+    uint32_t *halves[2] = {&rule->birth, &rule->survive};
+    bool seen[2] = {false, false};
+    bool lettered = toupper((unsigned char)rulestring[0]) == 'B' || toupper((unsigned char)rulestring[0]) == 'S';
+    rule->birth = 0;
+    rule->survive = 0;
+
+    char const *c = rulestring;
+    for (unsigned int half = 0; half < 2; half++) {
+
+        // Lettered halves name themselves, otherwise survival comes first
+        unsigned int which = half == 0 ? 1 : 0;
+        if (lettered) {
+            char letter = (char)toupper((unsigned char)*c++);
+            if (letter != 'B' && letter != 'S') return false;
+            which = letter == 'B' ? 0 : 1;
+        }
+        if (seen[which]) return false;
+        seen[which] = true;
 
-/**
- * Calculates the next state for the cell at (x, y) based on the rules for Pixel cells
- * @param env The environment that holds the simulation
- * @param x The x coordinate of the current cell
- * @param y The y coordinate of the current cell
- * @return The next state of the cell (true for alive, false for dead)
- */
-state_calculator(noise_next_state) {
-    bool alive = env_access(env, x, y);
-    unsigned int neighbours = num_neighbours(env, x, y, &MOORE);
-    if (alive) return 4 <= neighbours && neighbours <= 5; // If already alive must have 4-5 neighbours to survive
-    return neighbours == 2;                               // If dead, must have exactly 2 neighbours to live
-}
+        c = parse_counts(c, neighbourhood->size, halves[which]);
+        if (c == NULL) return false;
+        if (half == 0 && *c++ != '/') return false;
+    }
+    if (*c != '\0') return false;
 
-/**
- * Calculates the next state for the cell at (x, y) based on a variation of the original CGOL rules using the Von
- * Neumann neighbourhood
- * @param env The environment that holds the simulation
- * @param x The x coordinate of the current cell
- * @param y The y coordinate of the current cell
- * @return The next state of the cell (true for alive, false for dead)
- */
-state_calculator(fractal_next_state) {
-    bool alive = env_access(env, x, y);
-    unsigned int neighbours = num_neighbours(env, x, y, &VON_NEUMANN);
-    if (alive) return (neighbours >= 2); // If already alive, must have more than two neighbours to live
-    return neighbours == 1;              // If dead, must have exactly 1 neighbour to be born
+    for (unsigned int count = 0; count <= MAX_NEIGHBOURHOOD; count++) {
+        rule->table[false][count] = (rule->birth >> count) & 1;
+        rule->table[true][count] = (rule->survive >> count) & 1;
+    }
+    return true;
 }
 
 /**
- * Calculates the next state for the cell at (x, y) based on a variation of the original CGOL rules using the Von
- * Neumann diamond-shaped neighbourhood
- * @param env The environment that holds the simulation
- * @param x The x coordinate of the current cell
- * @param y The y coordinate of the current cell
- * @return The next state of the cell (true for alive, false for dead)
+ * Compiles the rulestring of a Life-like cell type, or the split rule of a cell type which counts its closest
+ * neighbours separately, into a lookup table. Other cell types are left unchanged.
+ * @param cell_type The cell type to compile
+ * @return true if the cell type is ready to be simulated, false if its rulestring was invalid
  */
-state_calculator(fractal_corner_next_state) {
-    bool alive = env_access(env, x, y);
-    unsigned int neighbours = num_neighbours(env, x, y, &VON_NEUMANN_CORNERS);
-    if (alive) return neighbours >= 2; // If already alive Must have more than two neighbours to live
-    return neighbours == 1;            // If dead, must have exactly 1 neighbour to be born
+bool cell_type_compile(CellType *cell_type) {
+    if (cell_type->split.next_state != NULL) {
+        SplitRule *split = &cell_type->split;
+        if (split->closest->size > MAX_CLOSEST) return false;
+        for (unsigned int alive = 0; alive < 2; alive++) {
+            for (unsigned int count = 0; count <= cell_type->neighbourhood->size; count++) {
+                for (unsigned int closest = 0; closest <= split->closest->size; closest++)
+                    split->table[alive][count][closest] = split->next_state(alive, count, closest);
+            }
+        }
+        return true;
+    }
+    if (cell_type->rulestring == NULL) return cell_type->calculator != NULL;
+    return rule_compile(cell_type->rulestring, cell_type->neighbourhood, &cell_type->rule);
 }
 
+/** Names for the included cell types. */
+static const struct {
+    char const *name;
+    CellType cell_type;
+} CELL_TYPE_NAMES[] = {
+    {"conway", ConwayCell},
+    {"maze", MazeCell},
+    {"noise", NoiseCell},
+    {"fractal", FractalCell},
+    {"fractal-corner", FractalCornerCell},
+    {"lesse-conway", LesseConwayCell},
+    {"triple-moore-conway", TripleMooreConwayCell},
+    {"von-neumann-r2-conway", VonNeumannR2ConwayCell},
+    {"conway-cancer", ConwayCancerCell},
+};
+
 /**
- * Calculates the next state for the cell at (x, y) based on Conway's original Game of Life rules in the Lesse
- * neighbourhood.
- * @param env The environment that holds the simulation
- * @param x The x coordinate of the current cell
- * @param y The y coordinate of the current cell
- * @return The next state of the cell (true for alive, false for dead)
+ * Looks up one of the included cell types by name.
+ * @param name The name of the cell type in lowercase, with words separated by dashes (i.e. "triple-moore-conway"), or
+ * the name it is displayed with (i.e. "triple moore conway cell")
+ * @return The cell type, which must be copied and compiled before use, or NULL if there is no cell type with that name
  */
-state_calculator(lesse_conway_next_state) {
-    unsigned int neighbours = num_neighbours(env, x, y, &LESSE);
-    bool alive = env_access(env, x, y);
-
-    // If a cell is alive and it has:
-    // 1 or fewer neighbours, it dies
-    // 4 or more neighbours, it dies
-    // 2-3 neighbours, it stays alive
-    if (alive) return !(neighbours <= 1 || neighbours >= 4);
-
-    // If a cell is dead and it has exactly 3 neighbours, it becomes alive
-    return neighbours == 3;
+CellType const *cell_type_by_name(char const *name) {
+    for (size_t i = 0; i < sizeof(CELL_TYPE_NAMES) / sizeof(CELL_TYPE_NAMES[0]); i++) {
+        if (strcmp(CELL_TYPE_NAMES[i].name, name) == 0 || strcmp(CELL_TYPE_NAMES[i].cell_type.name, name) == 0)
+            return &CELL_TYPE_NAMES[i].cell_type;
+    }
+    return NULL;
 }
 
+/* STATE CALCULATORS */
+
 /**
  * Calculates the next state for the cell at (x, y) based on the Triple Moore variation of the original CGOL rules
  * @param env The environment that holds the simulation
@@ -123,15 +158,28 @@ state_calculator(triple_moore_conway_next_state) {
     neighbours(env, x, y, &TRIPLE_MOORE, &neighbour_vector[0]); // Determine neighbours
 
     // The first eight neighbours
-    int neighbour_count = 0;
+    unsigned int neighbour_count = 0;
     for (unsigned int i = 0; i < 8; i++)
         neighbour_count += neighbour_vector[i];
-    int closest_eight = neighbour_count;
+    unsigned int closest_eight = neighbour_count;
 
     // Get remaining neighbours using custom loop to save computation
     for (unsigned int i = 8; i < TRIPLE_MOORE.size; i++)
         neighbour_count += neighbour_vector[i];
 
+    return triple_moore_conway_rule(alive, neighbour_count, closest_eight);
+}
+
+/**
+ * The Triple Moore variation of the original CGOL rules.
+ * @param alive The state of the cell
+ * @param neighbour_count The number of living cells in the cell's Triple Moore neighbourhood
+ * @param closest_eight The number of living cells in the cell's Moore neighbourhood
+ * @return The next state of the cell (true for alive, false for dead)
+ */
+bool __attribute__((const))
+triple_moore_conway_rule(bool alive, unsigned int neighbour_count, unsigned int closest_eight) {
+
     // If a cell is alive and it has:
     // 1 or fewer neighbours, it dies
     // 4 or more neighbours, it dies
@@ -156,14 +204,27 @@ state_calculator(von_neumann_r2_conway_next_state) {
     neighbours(env, x, y, &VON_NEUMANN_R2, &neighbour_vector[0]); // Determine neighbours
 
     // The first four neighbours
-    int closest_four = neighbour_vector[0] + neighbour_vector[1] + neighbour_vector[2] + neighbour_vector[3];
+    unsigned int closest_four = neighbour_vector[0] + neighbour_vector[1] + neighbour_vector[2] + neighbour_vector[3];
 
     // Get remaining neighbours using custom loop to save computation
-    int neighbour_count = closest_four;
+    unsigned int neighbour_count = closest_four;
     for (unsigned int i = 4; i < VON_NEUMANN_R2.size; i++) {
         neighbour_count += neighbour_vector[i];
     }
 
+    return von_neumann_r2_conway_rule(alive, neighbour_count, closest_four);
+}
+
+/**
+ * A more complex variation of Conway's original GOL rules in the Von Neumann R2 neighbourhood.
+ * @param alive The state of the cell
+ * @param neighbour_count The number of living cells in the cell's Von Neumann R2 neighbourhood
+ * @param closest_four The number of living cells in the cell's Von Neumann neighbourhood
+ * @return The next state of the cell (true for alive, false for dead)
+ */
+bool __attribute__((const))
+von_neumann_r2_conway_rule(bool alive, unsigned int neighbour_count, unsigned int closest_four) {
+
     // If a cell is alive:
     if (alive) {
         if (neighbour_count <= 2 || neighbour_count >= 6 || closest_four == 4) {
@@ -180,27 +241,59 @@ state_calculator(von_neumann_r2_conway_next_state) {
 }
 
 /**
- * Calculates the next state for the cell at (x, y) to create a more organic maze shape.
- * Note: This pattern seems to occur if the original COGL rules are scaled to a larger neighbourhood. Cells begin to
- * grow uncontrollably. All other COGL variations included in this simulation have an additional control factor added,
- * like also considering the number of neighbours in another smaller neighbourhood.
- * @param env The environment that holds the simulation
- * @param x The x coordinate of the current cell
- * @param y The y coordinate of the current cell
- * @return The next state of the cell (true for alive, false for dead)
+ * Formats simulation analytics into a string.
+ * @param string Pointer to the string that will contain the analytics
+ * @param data The analytics to format
+ * @param area The number of cells in the simulated area
+ * @param cell_type The cell type currently being used in the simulation
  */
-state_calculator(conway_cancer_next_state) {
-    unsigned int neighbours = num_neighbours(env, x, y, &VON_NEUMANN_R2);
-    bool alive = env_access(env, x, y);
+void format_analytics_string(char **string, SimulationAnalytics const *data, uint64_t area, CellType const *cell_type) {
 
-    // If a cell is alive and it has:
-    // 2 or fewer neighbours, it dies
-    // 5 or more neighbours, it dies
-    // 3-4 neighbours, it stays alive
-    if (alive) return !(neighbours <= 2 || neighbours > 6);
+    double percent_alive = ((double)(data->total_cells) / (double)area) * 100.0;
+    double initial_cells = data->initial_cells == 0 ? 1.0 : (double)data->initial_cells;
+    double growth = ((double)data->total_cells / initial_cells) * 100.0;
 
-    // If a cell is dead and it has exactly 4 neighbours, it becomes alive
-    return neighbours == 4;
+    char stability[64] = "";
+    if (data->period != 0) {
+        snprintf(stability, sizeof(stability), "\nstable at generation %" PRIu64 ", period %u", data->stable_generation,
+                 data->period);
+    }
+
+    char length[32] = "as fast as possible";
+    if (data->generation_period >= 1000) {
+        snprintf(length, sizeof(length), "%.1fms", data->generation_period / (double)1000);
+    } else if (data->generation_period != 0) {
+        snprintf(length, sizeof(length), "%uus", data->generation_period);
+    }
+
+    // The extended analytics, when they were collected
+    char extended[256] = "";
+    if (data->extended) {
+        char span[32] = "";
+        if (data->step > 1) snprintf(span, sizeof(span), " over %u generations", data->step);
+        char box[64] = "none";
+        if (data->box_width != 0) {
+            snprintf(box, sizeof(box), "%ux%u at (%u, %u)", data->box_width, data->box_height, data->box_x,
+                     data->box_y);
+        }
+        uint32_t lowest = UINT32_MAX, highest = 0;
+        for (uint32_t i = 0; i < data->population.length; i++) {
+            if (data->population.counts[i] < lowest) lowest = data->population.counts[i];
+            if (data->population.counts[i] > highest) highest = data->population.counts[i];
+        }
+        double densest = (double)data->densest_region / data->densest_area * 100;
+        snprintf(extended, sizeof(extended),
+                 "\nbirths: %u, deaths: %u%s\nbounding box: %s\nlive regions: %u of %u, densest %.1f%%\n"
+                 "population over the last %u steps: %u to %u",
+                 data->births, data->deaths, span, box, data->live_regions, data->regions, densest,
+                 data->population.length, data->population.length != 0 ? lowest : 0, highest);
+    }
+
+    asprintf(string,
+             "cell type: %s\ngenerations: %llu\ninitial cells: %u\ncells: %u\npercentage alive: %.3f%%\ngrowth: "
+             "%.1f%%\ngeneration length: %s\ngenerations per second: %.0f%s%s",
+             cell_type->name, data->generations, data->initial_cells, data->total_cells, percent_alive, growth, length,
+             data->generation_rate, extended, stability);
 }
 
 /**
@@ -210,17 +303,142 @@ state_calculator(conway_cancer_next_state) {
  * @param cell_type The cell type currently being used in the simulation
  */
 void populate_analytics_string(char **string, Environment const *env, CellType const *cell_type) {
+    format_analytics_string(string, &env->data, (uint64_t)env->width * env->height, cell_type);
+}
 
-    SimulationAnalytics data = env->data;
-    double percent_alive = ((double)(data.total_cells) / (double)(env->width * env->height)) * 100.0;
-    double initial_cells = data.initial_cells == 0 ? 1.0 : (double)data.initial_cells;
-    double growth = ((double)data.total_cells / initial_cells) * 100.0;
+/** The partial results of a single worker, padded to a cache line so workers never share one. */
+typedef struct {
+    _Alignas(64) uint32_t total_cells; /**< The number of living cells counted by this worker. */
+    uint64_t hash;                     /**< The change in the grid's hash from the tiles of this worker. */
+    uint32_t changes[2];               /**< The cells born and the cells which died in the tiles of this worker. */
+} WorkerTally;
+
+/** Shared state of a generation step which is split into bands of tiles across the worker pool. */
+typedef struct {
+    Environment *env;               /**< The environment being stepped. */
+    CellType const *cell_type;      /**< The type of cell to calculate the next generation for. */
+    bool bit_packed;                /**< Whether to use the bit-packed kernel. */
+    WorkerTally tally[MAX_WORKERS]; /**< Per-worker partial results, reduced after the step. */
+} GenerationJob;
 
-    asprintf(string,
-             "cell type: %s\ngenerations: %llu\ninitial cells: %u\ncells: %u\npercentage alive: %.3f%%\ngrowth: "
-             "%.1f%%\ngeneration length: %ums",
-             cell_type->name, data.generations, data.initial_cells, data.total_cells, percent_alive, growth,
-             data.generation_speed);
+/**
+ * Calculates the next generation for a block of cells using the cell type's state calculator.
+ * @param env The environment being stepped, with an up to date halo
+ * @param cell_type The cell type
+ * @param first_row The first row of the block
+ * @param end_row One past the last row of the block
+ * @param first_col The first column of the block
+ * @param end_col One past the last column of the block
+ * @param changed Set to true if any cell in the block changed state, left untouched otherwise
+ * @return The number of living cells in the block in the next generation
+ */
+static uint32_t calculator_block(Environment *env, CellType const *cell_type, uint32_t first_row, uint32_t end_row,
+                                 uint32_t first_col, uint32_t end_col, bool *changed) {
+
+    uint32_t total_cells = 0;
+    bool difference = false;
+    for (uint32_t y = first_row; y < end_row; y++) {
+        bool const *row = &env->grid[(uint64_t)env->stride * y];
+        bool *next_row = &env->_next_generation[(uint64_t)env->stride * y];
+        for (uint32_t x = first_col; x < end_col; x++) {
+            bool state = cell_type->calculator(env, x, y);
+            total_cells += state; // Increase cell total
+            difference |= state != row[x];
+            next_row[x] = state; // Write next state onto the next generation grid
+        }
+    }
+
+    if (difference) *changed = true;
+    return total_cells;
+}
+
+/**
+ * Calculates the next generation for a block of cells on the byte-per-cell grid, writing it to the next generation
+ * grid. Only the grid, next generation grid and stride of the environment are used, so this also works on views of
+ * other cell storage laid out the same way.
+ * @param env The environment being stepped, with an up to date halo
+ * @param cell_type The cell type
+ * @param first_row The first row of the block
+ * @param end_row One past the last row of the block
+ * @param first_col The first column of the block
+ * @param end_col One past the last column of the block
+ * @param changed Set to true if any cell in the block changed state, left untouched otherwise
+ * @return The number of living cells in the block in the next generation
+ */
+uint32_t step_block(Environment *env, CellType const *cell_type, uint32_t first_row, uint32_t end_row,
+                    uint32_t first_col, uint32_t end_col, bool *changed) {
+    if (cell_type->rulestring != NULL) {
+        // Life-like rules are vectorised with the widest instructions the processor has
+        return simd_life_block(simd_detect(), env, cell_type, first_row, end_row, first_col, end_col, changed);
+    }
+    if (cell_type->split.next_state != NULL && boxsum_supports(cell_type->neighbourhood) &&
+        boxsum_supports(cell_type->split.closest)) {
+        // Counts of large neighbourhoods are built out of running box sums
+        return boxsum_block(env, cell_type, first_row, end_row, first_col, end_col, changed);
+    }
+    return calculator_block(env, cell_type, first_row, end_row, first_col, end_col, changed);
+}
+
+/**
+ * Calculates the next generation for one row of tiles. Tiles which are not active (see env_tile_active) are skipped:
+ * their next states are the same as their current states, which the next generation grid already holds from the
+ * generation before, and their population is reused.
+ * @param context The GenerationJob
+ * @param band The row of tiles to calculate
+ * @param worker The worker calculating the band
+ */
+static void generation_band(void *context, uint32_t band, unsigned int worker) {
+    GenerationJob *job = (GenerationJob *)context;
+    Environment *env = job->env;
+    CellType const *cell_type = job->cell_type;
+    uint32_t first_row = band * ENV_TILE_HEIGHT;
+    uint32_t end_row = first_row + ENV_TILE_HEIGHT < env->height ? first_row + ENV_TILE_HEIGHT : env->height;
+
+    uint32_t total_cells = 0;
+    uint64_t hash = 0;
+    for (uint32_t tx = 0; tx < env->tiles_x; tx++) {
+        size_t tile = (size_t)band * env->tiles_x + tx;
+        bool changed = false;
+
+        if (env_tile_active(env, tx, band)) {
+            uint32_t first_col = tx * ENV_TILE_WIDTH;
+            uint32_t end_col = first_col + ENV_TILE_WIDTH < env->width ? first_col + ENV_TILE_WIDTH : env->width;
+
+            if (job->bit_packed) {
+                // Moore-neighbourhood rules can be stepped 64 cells at a time on the bit-packed grid
+                env->tile_population[tile] = bitpack_moore_block(env, cell_type->rule.birth, cell_type->rule.survive,
+                                                                  first_row, end_row, tx, tx + 1, &changed);
+            } else {
+                env->tile_population[tile] =
+                    step_block(env, cell_type, first_row, end_row, first_col, end_col, &changed);
+            }
+            if (changed) {
+                hash ^= env_hash_changes(env, first_row, end_row, first_col, end_col, job->bit_packed,
+                                         env->analytics ? job->tally[worker].changes : NULL);
+                if (job->bit_packed) env->tile_stale[tile] = true; // Unpacked only once something reads it
+            }
+        }
+
+        env->_next_tile_changed[tile] = changed;
+        env->tile_dirty[tile] |= changed;
+        total_cells += env->tile_population[tile];
+    }
+    job->tally[worker].total_cells += total_cells;
+    job->tally[worker].hash ^= hash;
+}
+
+/**
+ * Identifies the rule and kernel used to calculate a generation. Skipping inactive regions is only valid while these
+ * stay the same from one generation to the next.
+ * @param cell_type The type of cell being simulated
+ * @param bit_packed Whether the bit-packed kernel is used
+ * @return The signature of the step, never 0
+ */
+uint64_t step_signature(CellType const *cell_type, bool bit_packed) {
+    uint64_t signature = (uint64_t)(uintptr_t)cell_type->calculator * 0x9E3779B97F4A7C15ULL;
+    signature ^= (uint64_t)(uintptr_t)cell_type->neighbourhood * 0xC2B2AE3D27D4EB4FULL;
+    signature ^= ((uint64_t)cell_type->rule.birth << 32 | cell_type->rule.survive) * 0x165667B19E3779F9ULL;
+    return (signature ^ (uint64_t)bit_packed << 1) | 1; // Never 0, which is the signature of a fresh environment
 }
 
 /**
@@ -230,20 +448,296 @@ void populate_analytics_string(char **string, Environment const *env, CellType c
  */
 void next_generation(Environment *env, CellType const *cell_type) {
 
-    env->data.total_cells = 0; // Reset cell total
-    env->data.generations++;   // Increase generations
+    env->data.generations++; // Increase generations
 
-    // Update the next generation with all the new states
-    for (uint32_t x = 0; x < env->width; x++) {
-        for (uint32_t y = 0; y < env->height; y++) {
-            bool state = cell_type->calculator(env, x, y);
-            env->data.total_cells += state;                      // Increase cell total
-            env->_next_generation[(env->width * y) + x] = state; // Write next state onto the next generation grid
+    bool bit_packed = env->packed_kernel && cell_type->rulestring != NULL && cell_type->neighbourhood == &MOORE;
+    GenerationJob job = {.env = env, .cell_type = cell_type, .bit_packed = bit_packed};
+    if (job.bit_packed) {
+        bitpack_sync(env);
+    } else {
+        bitpack_unpack(env);
+        env_refresh_halo(env); // Neighbours past the edges are read from the halo
+    }
+
+    // A different rule or kernel invalidates everything learned about inactive tiles, as does a step of several
+    // generations which leaves the next generation grids behind
+    uint64_t signature = step_signature(cell_type, bit_packed);
+    if (signature != env->_step_signature) {
+        env_mark_all_changed(env);
+        env_forget_cycle(env); // Repeats under different rules are not cycles
+    }
+    if (env->_next_behind) env_mark_all_changed(env);
+    env->_step_signature = signature;
+    env->_next_behind = false;
+
+    // Split the grid into rows of tiles shared out between the workers
+    workers_run(env->workers, generation_band, &job, env->tiles_y);
+
+    // Reduce the per-worker cell totals, hash changes, births and deaths
+    env->data.total_cells = 0;
+    uint32_t changes[2] = {0, 0};
+    for (unsigned int i = 0; i < workers_count(env->workers); i++) {
+        env->data.total_cells += job.tally[i].total_cells;
+        env->hash ^= job.tally[i].hash;
+        changes[0] += job.tally[i].changes[0];
+        changes[1] += job.tally[i].changes[1];
+    }
+
+    // Swap current simulation grid for the next generation, leaving the byte-per-cell grid behind if bit-packed
+    if (job.bit_packed) {
+        uint64_t *temp_packed = env->packed;
+        env->packed = env->_next_packed;
+        env->_next_packed = temp_packed;
+        env->grid_stale = true;
+    } else {
+        bool *temp = env->grid;
+        env->grid = env->_next_generation;
+        env->_next_generation = temp;
+        env->packed_stale = true;
+    }
+    env->stepped_packed = job.bit_packed;
+
+    bool *temp_changed = env->tile_changed;
+    env->tile_changed = env->_next_tile_changed;
+    env->_next_tile_changed = temp_changed;
+
+    env->data.extended = env->analytics;
+    if (env->analytics) env_collect_analytics(env, changes[0], changes[1], 1);
+    cycle_record(&env->cycles, env->hash, env->data.generations, &env->data.stable_generation, &env->data.period);
+}
+
+/** Shared state of several generations which are calculated a block at a time across the worker pool. */
+typedef struct {
+    Environment *env;               /**< The environment being stepped. */
+    CellType const *cell_type;      /**< The type of cell to calculate the next generations for. */
+    uint32_t depth;                 /**< The number of generations to calculate. */
+    uint32_t radius;                /**< The radius of the cell type's neighbourhood. */
+    uint32_t blocks_x;              /**< The number of columns of blocks. */
+    size_t scratch_size;            /**< The number of cells in each of a worker's scratch grids. */
+    bool *scratch;                  /**< A pair of scratch grids for each worker (see Environment._block_scratch). */
+    WorkerTally tally[MAX_WORKERS]; /**< Per-worker partial results, reduced after the step. */
+} BlockJob;
+
+/**
+ * @param coordinate A coordinate which may be past the edges of the grid, by any distance
+ * @param size The size of the grid along the coordinate's axis
+ * @return The coordinate wrapped around to inside the grid
+ */
+static inline uint32_t wrap_coordinate(int64_t coordinate, uint32_t size) {
+    int64_t wrapped = coordinate % size;
+    return (uint32_t)(wrapped < 0 ? wrapped + size : wrapped);
+}
+
+/**
+ * Calculates several generations of one block of the grid in a worker's scratch grids, which are small enough to stay
+ * in cache. The block is copied in along with an apron of the cells around it, wide enough that each generation only
+ * eats one neighbourhood radius into it, so the block itself is exact after the last generation. A tile of the block
+ * is marked as changed if it changed in the last generation or differs from where the block started.
+ * @param context The BlockJob
+ * @param band The block to calculate
+ * @param worker The worker calculating the block
+ */
+static void block_band(void *context, uint32_t band, unsigned int worker) {
+    BlockJob *job = (BlockJob *)context;
+    Environment *env = job->env;
+    uint32_t first_col = (band % job->blocks_x) * TEMPORAL_BLOCK_WIDTH;
+    uint32_t first_row = (band / job->blocks_x) * TEMPORAL_BLOCK_HEIGHT;
+    uint32_t width = env->width - first_col < TEMPORAL_BLOCK_WIDTH ? env->width - first_col : TEMPORAL_BLOCK_WIDTH;
+    uint32_t height =
+        env->height - first_row < TEMPORAL_BLOCK_HEIGHT ? env->height - first_row : TEMPORAL_BLOCK_HEIGHT;
+    uint32_t apron = job->radius * job->depth;
+
+    // View the scratch grids as an environment so they can be stepped with the same kernels
+    Environment view = {.width = width + 2 * apron, .height = height + 2 * apron};
+    view.stride = view.width + 2 * ENV_HALO;
+    view.grid = job->scratch + 2 * job->scratch_size * worker + (uint64_t)view.stride * ENV_HALO + ENV_HALO;
+    view._next_generation = view.grid + job->scratch_size;
+
+    // Copy in the block and its apron, wrapping around the edges of the grid
+    for (uint32_t y = 0; y < view.height; y++) {
+        uint32_t source_row = wrap_coordinate((int64_t)first_row - apron + y, env->height);
+        bool const *row = &env->grid[(uint64_t)env->stride * source_row];
+        bool *scratch_row = &view.grid[(uint64_t)view.stride * y];
+        for (uint32_t x = 0; x < view.width;) {
+            uint32_t source = wrap_coordinate((int64_t)first_col - apron + x, env->width);
+            uint32_t run = view.width - x < env->width - source ? view.width - x : env->width - source;
+            memcpy(&scratch_row[x], &row[source], run);
+            x += run;
         }
     }
 
-    // Swap current simulation grid for the next generation
+    // Each generation is exact over a region one radius smaller than the last, ending on the block itself
+    for (uint32_t generation = 1; generation < job->depth; generation++) {
+        uint32_t margin = job->radius * generation;
+        bool changed = false;
+        step_block(&view, job->cell_type, margin, view.height - margin, margin, view.width - margin, &changed);
+        bool *temp = view.grid;
+        view.grid = view._next_generation;
+        view._next_generation = temp;
+    }
+
+    // The last generation is calculated a tile at a time, keeping the population of each tile up to date
+    uint32_t total_cells = 0;
+    for (uint32_t y = 0; y < height; y += ENV_TILE_HEIGHT) {
+        for (uint32_t x = 0; x < width; x += ENV_TILE_WIDTH) {
+            uint32_t end_row = y + ENV_TILE_HEIGHT < height ? y + ENV_TILE_HEIGHT : height;
+            uint32_t end_col = x + ENV_TILE_WIDTH < width ? x + ENV_TILE_WIDTH : width;
+            size_t tile = (size_t)((first_row + y) / ENV_TILE_HEIGHT) * env->tiles_x + (first_col + x) / ENV_TILE_WIDTH;
+            bool changed = false;
+            env->tile_population[tile] = step_block(&view, job->cell_type, apron + y, apron + end_row, apron + x,
+                                                    apron + end_col, &changed);
+            env->tile_changed[tile] = changed;
+            total_cells += env->tile_population[tile];
+        }
+    }
+    bool *temp = view.grid;
+    view.grid = view._next_generation;
+    view._next_generation = temp;
+
+    // Copy the block out to the next generation grid
+    for (uint32_t y = 0; y < height; y++) {
+        memcpy(&env->_next_generation[(uint64_t)env->stride * (first_row + y) + first_col],
+               &view.grid[(uint64_t)view.stride * (apron + y) + apron], width);
+    }
+
+    // Hash the changes a tile at a time, to find the tiles which differ from where the block started
+    uint64_t hash = 0;
+    for (uint32_t y = first_row; y < first_row + height; y += ENV_TILE_HEIGHT) {
+        for (uint32_t x = first_col; x < first_col + width; x += ENV_TILE_WIDTH) {
+            uint32_t end_row = y + ENV_TILE_HEIGHT < first_row + height ? y + ENV_TILE_HEIGHT : first_row + height;
+            uint32_t end_col = x + ENV_TILE_WIDTH < first_col + width ? x + ENV_TILE_WIDTH : first_col + width;
+            uint32_t changes[2] = {0, 0};
+            hash ^= env_hash_changes(env, y, end_row, x, end_col, false, changes);
+            size_t tile = (size_t)(y / ENV_TILE_HEIGHT) * env->tiles_x + x / ENV_TILE_WIDTH;
+            env->tile_changed[tile] |= changes[0] + changes[1] != 0;
+            env->tile_dirty[tile] |= changes[0] + changes[1] != 0;
+            job->tally[worker].changes[0] += changes[0];
+            job->tally[worker].changes[1] += changes[1];
+        }
+    }
+    job->tally[worker].total_cells += total_cells;
+    job->tally[worker].hash ^= hash;
+}
+
+/**
+ * Calculates several generations at once, a block at a time (see block_band). Each generation of a large grid
+ * otherwise streams both grids through memory, while a block stays in cache for all of its generations.
+ * @param env The environment to update
+ * @param cell_type The type of cell to calculate the generations for
+ * @param depth The number of generations to calculate
+ * @param radius The radius of the cell type's neighbourhood
+ */
+static void block_generations(Environment *env, CellType const *cell_type, uint32_t depth, uint32_t radius) {
+    bitpack_unpack(env);
+    BlockJob job = {.env = env, .cell_type = cell_type, .depth = depth, .radius = radius};
+    job.blocks_x = (env->width + TEMPORAL_BLOCK_WIDTH - 1) / TEMPORAL_BLOCK_WIDTH;
+    uint32_t blocks_y = (env->height + TEMPORAL_BLOCK_HEIGHT - 1) / TEMPORAL_BLOCK_HEIGHT;
+
+    // The scratch grids are kept with the environment, and only replaced when a deeper step needs larger ones
+    uint32_t apron = radius * depth;
+    job.scratch_size = (size_t)(TEMPORAL_BLOCK_WIDTH + 2 * apron + 2 * ENV_HALO) *
+                       (TEMPORAL_BLOCK_HEIGHT + 2 * apron + 2 * ENV_HALO);
+    size_t scratch_cells = 2 * job.scratch_size * workers_count(env->workers);
+    if (scratch_cells > env->_block_scratch_size) {
+        free(env->_block_scratch);
+        env->_block_scratch = (bool *)calloc(scratch_cells, sizeof(bool));
+        assert(env->_block_scratch != NULL);
+        env->_block_scratch_size = scratch_cells;
+    }
+    job.scratch = env->_block_scratch;
+
+    workers_run(env->workers, block_band, &job, job.blocks_x * blocks_y);
+
+    // Reduce the per-worker cell totals, hash changes, births and deaths
+    env->data.total_cells = 0;
+    uint32_t changes[2] = {0, 0};
+    for (unsigned int i = 0; i < workers_count(env->workers); i++) {
+        env->data.total_cells += job.tally[i].total_cells;
+        env->hash ^= job.tally[i].hash;
+        changes[0] += job.tally[i].changes[0];
+        changes[1] += job.tally[i].changes[1];
+    }
+
     bool *temp = env->grid;
     env->grid = env->_next_generation;
     env->_next_generation = temp;
+    env->packed_stale = true;
+    env->stepped_packed = false;
+    env->data.generations += depth;
+    env->data.extended = env->analytics;
+    if (env->analytics) env_collect_analytics(env, changes[0], changes[1], depth); // Counted across the whole block
+
+    // The other grid is now several generations behind, so it can no longer stand in for inactive tiles. The tile flags
+    // are left describing the block's activity, so that grids which have gone still stop being stepped in blocks
+    env->_next_behind = true;
+    cycle_record(&env->cycles, env->hash, env->data.generations, &env->data.stable_generation, &env->data.period);
+}
+
+/**
+ * Advances the simulation by a number of generations. Large grids which are mostly changing are calculated several
+ * generations at a time (see block_generations) until they are found to repeat themselves.
+ * @param env The environment to advance
+ * @param cell_type The type of cell to calculate the generations for
+ * @param generations The number of generations to advance by
+ * @param skip_periods Whether whole periods are skipped once the simulation is found to repeat itself
+ * @return The number of generations skipped
+ */
+static uint64_t advance(Environment *env, CellType const *cell_type, uint64_t generations, bool skip_periods) {
+
+    // The bit-packed kernel is compact enough to stay out of memory's way, and mostly still grids are cheaper to skip
+    bool bit_packed = env->packed_kernel && cell_type->rulestring != NULL && cell_type->neighbourhood == &MOORE;
+    size_t tiles = (size_t)env->tiles_x * env->tiles_y, changed_tiles = 0;
+    for (size_t i = 0; i < tiles; i++)
+        changed_tiles += env->tile_changed[i];
+    bool blocking =
+        !bit_packed && (uint64_t)env->width * env->height >= TEMPORAL_MIN_CELLS && 2 * changed_tiles > tiles;
+
+    uint32_t radius = cell_type->neighbourhood != NULL ? neighbourhood_radius(cell_type->neighbourhood) : ENV_HALO;
+    if (blocking && env->_step_signature != step_signature(cell_type, false)) {
+        env_forget_cycle(env); // Repeats under different rules are not cycles
+        env->_step_signature = step_signature(cell_type, false);
+    }
+
+    uint64_t skipped = 0;
+    while (generations > 0) {
+        if (skip_periods && env->data.period != 0) {
+            uint64_t periods = generations - generations % env->data.period;
+            env->data.generations += periods;
+            generations -= periods;
+            skipped += periods;
+            if (generations == 0) break;
+        }
+        if (!blocking || generations == 1 || env->data.period != 0) {
+            next_generation(env, cell_type);
+            generations--;
+            continue;
+        }
+        uint32_t depth = generations < TEMPORAL_BLOCK_DEPTH ? (uint32_t)generations : TEMPORAL_BLOCK_DEPTH;
+        block_generations(env, cell_type, depth, radius);
+        generations -= depth;
+    }
+    return skipped;
+}
+
+/**
+ * Advances the simulation by a number of generations. This is the same as calling next_generation for each generation,
+ * except that large grids may be calculated a block at a time (see advance).
+ * @param env The environment to advance
+ * @param cell_type The type of cell to calculate the generations for
+ * @param generations The number of generations to advance by
+ */
+void step_generations(Environment *env, CellType const *cell_type, uint64_t generations) {
+    (void)advance(env, cell_type, generations, false);
+}
+
+/**
+ * Advances the simulation by a number of generations. As soon as the simulation is found to repeat itself, even partway
+ * through, the whole periods left are skipped instead of being calculated.
+ * @param env The environment to advance
+ * @param cell_type The type of cell to calculate the generations for
+ * @param generations The number of generations to advance by
+ * @return The number of generations skipped rather than calculated
+ */
+uint64_t fast_forward(Environment *env, CellType const *cell_type, uint64_t generations) {
+    return advance(env, cell_type, generations, true);
 }
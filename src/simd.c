@@ -0,0 +1,226 @@
+/**
+ * Contains the vectorised kernel for stepping Life-like rules on the byte-per-cell grid. Each neighbour is a fixed
+ * offset from its cell thanks to the halo, so the neighbour counts of a run of cells are the sum of one shifted vector
+ * load per neighbour. The rule is then applied with one vector compare per neighbour count in its birth and survival
+ * halves.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/simd.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#else
+#define SIMD_X86 0
+#endif
+
+/**
+ * Finds the widest instruction set the processor supports.
+ * @return The instruction set to step with
+ */
+SimdLevel simd_detect(void) {
+#if SIMD_X86
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+/**
+ * Calculates the next generation of a run of cells in a row, one cell at a time.
+ * @param row The current row
+ * @param next_row The next generation of the row
+ * @param offsets The offset of each neighbour from its cell
+ * @param size The number of neighbours
+ * @param rule The rule to apply
+ * @param first_col The first column of the run
+ * @param end_col One past the last column of the run
+ * @param difference Set to true if any cell changed state
+ * @return The number of living cells in the run in the next generation
+ */
+static uint32_t scalar_run(bool const *row, bool *next_row, int64_t const *offsets, unsigned int size,
+                           LifeRule const *rule, uint32_t first_col, uint32_t end_col, bool *difference) {
+    uint32_t total_cells = 0;
+    for (uint32_t x = first_col; x < end_col; x++) {
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < size; i++)
+            count += row[x + offsets[i]];
+
+        bool state = rule->table[row[x]][count];
+        total_cells += state;
+        *difference |= state != row[x];
+        next_row[x] = state;
+    }
+    return total_cells;
+}
+
+/**
+ * Lists the neighbour counts in one half of a rule.
+ * @param mask The birth or survival mask of the rule
+ * @param counts Output for the neighbour counts in the mask
+ * @return The number of neighbour counts
+ */
+static unsigned int mask_counts(uint32_t mask, uint8_t counts[MAX_NEIGHBOURHOOD + 1]) {
+    unsigned int length = 0;
+    for (unsigned int count = 0; count <= MAX_NEIGHBOURHOOD; count++) {
+        if ((mask >> count) & 1) counts[length++] = (uint8_t)count;
+    }
+    return length;
+}
+
+#if SIMD_X86
+
+/** Calculates the next generation of a block of cells 16 at a time, see simd_life_block. */
+__attribute__((target("sse2"))) static uint32_t sse2_block(Environment *env, LifeRule const *rule,
+                                                           int64_t const *offsets, unsigned int size,
+                                                           uint32_t first_row, uint32_t end_row, uint32_t first_col,
+                                                           uint32_t end_col, bool *difference) {
+    uint8_t counts[2][MAX_NEIGHBOURHOOD + 1];
+    unsigned int lengths[2] = {mask_counts(rule->birth, counts[0]), mask_counts(rule->survive, counts[1])};
+    __m128i targets[2][MAX_NEIGHBOURHOOD + 1];
+    for (unsigned int half = 0; half < 2; half++) {
+        for (unsigned int i = 0; i < lengths[half]; i++)
+            targets[half][i] = _mm_set1_epi8((char)counts[half][i]);
+    }
+
+    __m128i const zero = _mm_setzero_si128();
+    __m128i const one = _mm_set1_epi8(1);
+    __m128i population = zero;
+    __m128i changes = zero;
+    uint32_t total_cells = 0;
+
+    for (uint32_t y = first_row; y < end_row; y++) {
+        bool const *row = &env->grid[(uint64_t)env->stride * y];
+        bool *next_row = &env->_next_generation[(uint64_t)env->stride * y];
+
+        uint32_t x = first_col;
+        for (; x + 16 <= end_col; x += 16) {
+            __m128i sum = zero;
+            for (unsigned int i = 0; i < size; i++)
+                sum = _mm_add_epi8(sum, _mm_loadu_si128((__m128i const *)(row + x + offsets[i])));
+
+            __m128i born = zero, survives = zero;
+            for (unsigned int i = 0; i < lengths[0]; i++)
+                born = _mm_or_si128(born, _mm_cmpeq_epi8(sum, targets[0][i]));
+            for (unsigned int i = 0; i < lengths[1]; i++)
+                survives = _mm_or_si128(survives, _mm_cmpeq_epi8(sum, targets[1][i]));
+
+            __m128i cells = _mm_loadu_si128((__m128i const *)(row + x));
+            __m128i alive = _mm_cmpeq_epi8(cells, one);
+            __m128i state = _mm_and_si128(_mm_or_si128(_mm_and_si128(alive, survives), _mm_andnot_si128(alive, born)),
+                                          one);
+            _mm_storeu_si128((__m128i *)(next_row + x), state);
+            population = _mm_add_epi64(population, _mm_sad_epu8(state, zero));
+            changes = _mm_or_si128(changes, _mm_xor_si128(state, cells));
+        }
+        total_cells += scalar_run(row, next_row, offsets, size, rule, x, end_col, difference);
+    }
+
+    total_cells += (uint32_t)_mm_cvtsi128_si32(population) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(population, 8));
+    *difference |= _mm_movemask_epi8(_mm_cmpeq_epi8(changes, zero)) != 0xFFFF;
+    return total_cells;
+}
+
+/** Calculates the next generation of a block of cells 32 at a time, see simd_life_block. */
+__attribute__((target("avx2"))) static uint32_t avx2_block(Environment *env, LifeRule const *rule,
+                                                           int64_t const *offsets, unsigned int size,
+                                                           uint32_t first_row, uint32_t end_row, uint32_t first_col,
+                                                           uint32_t end_col, bool *difference) {
+    uint8_t counts[2][MAX_NEIGHBOURHOOD + 1];
+    unsigned int lengths[2] = {mask_counts(rule->birth, counts[0]), mask_counts(rule->survive, counts[1])};
+    __m256i targets[2][MAX_NEIGHBOURHOOD + 1];
+    for (unsigned int half = 0; half < 2; half++) {
+        for (unsigned int i = 0; i < lengths[half]; i++)
+            targets[half][i] = _mm256_set1_epi8((char)counts[half][i]);
+    }
+
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const one = _mm256_set1_epi8(1);
+    __m256i population = zero;
+    __m256i changes = zero;
+    uint32_t total_cells = 0;
+
+    for (uint32_t y = first_row; y < end_row; y++) {
+        bool const *row = &env->grid[(uint64_t)env->stride * y];
+        bool *next_row = &env->_next_generation[(uint64_t)env->stride * y];
+
+        uint32_t x = first_col;
+        for (; x + 32 <= end_col; x += 32) {
+            __m256i sum = zero;
+            for (unsigned int i = 0; i < size; i++)
+                sum = _mm256_add_epi8(sum, _mm256_loadu_si256((__m256i const *)(row + x + offsets[i])));
+
+            __m256i born = zero, survives = zero;
+            for (unsigned int i = 0; i < lengths[0]; i++)
+                born = _mm256_or_si256(born, _mm256_cmpeq_epi8(sum, targets[0][i]));
+            for (unsigned int i = 0; i < lengths[1]; i++)
+                survives = _mm256_or_si256(survives, _mm256_cmpeq_epi8(sum, targets[1][i]));
+
+            __m256i cells = _mm256_loadu_si256((__m256i const *)(row + x));
+            __m256i alive = _mm256_cmpeq_epi8(cells, one);
+            __m256i state = _mm256_and_si256(_mm256_blendv_epi8(born, survives, alive), one);
+            _mm256_storeu_si256((__m256i *)(next_row + x), state);
+            population = _mm256_add_epi64(population, _mm256_sad_epu8(state, zero));
+            changes = _mm256_or_si256(changes, _mm256_xor_si256(state, cells));
+        }
+        total_cells += scalar_run(row, next_row, offsets, size, rule, x, end_col, difference);
+    }
+
+    __m128i halves = _mm_add_epi64(_mm256_castsi256_si128(population), _mm256_extracti128_si256(population, 1));
+    total_cells += (uint32_t)_mm_cvtsi128_si32(halves) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(halves, 8));
+    *difference |= !_mm256_testz_si256(changes, changes);
+    return total_cells;
+}
+
+#endif // SIMD_X86
+
+/**
+ * Calculates the next generation of a Life-like rule for a block of cells on the byte-per-cell grid. Every level
+ * produces exactly the same cells as looking each one up in the rule's table.
+ * @param level The instruction set to use, which must be supported by the processor (see simd_detect)
+ * @param env The environment being stepped, with an up to date halo
+ * @param cell_type The Life-like cell type
+ * @param first_row The first row of the block
+ * @param end_row One past the last row of the block
+ * @param first_col The first column of the block
+ * @param end_col One past the last column of the block
+ * @param changed Set to true if any cell in the block changed state, left untouched otherwise
+ * @return The number of living cells in the block in the next generation
+ */
+uint32_t simd_life_block(SimdLevel level, Environment *env, CellType const *cell_type, uint32_t first_row,
+                         uint32_t end_row, uint32_t first_col, uint32_t end_col, bool *changed) {
+
+    // Neighbours are fixed offsets from each cell thanks to the halo
+    Neighbourhood const *neighbourhood = cell_type->neighbourhood;
+    int64_t offsets[MAX_NEIGHBOURHOOD];
+    for (unsigned int i = 0; i < neighbourhood->size; i++)
+        offsets[i] = (int64_t)neighbourhood->neighbours[i].y * env->stride + neighbourhood->neighbours[i].x;
+
+    uint32_t total_cells = 0;
+    bool difference = false;
+    switch (level) {
+#if SIMD_X86
+    case SIMD_AVX2:
+        total_cells = avx2_block(env, &cell_type->rule, offsets, neighbourhood->size, first_row, end_row, first_col,
+                                 end_col, &difference);
+        break;
+    case SIMD_SSE2:
+        total_cells = sse2_block(env, &cell_type->rule, offsets, neighbourhood->size, first_row, end_row, first_col,
+                                 end_col, &difference);
+        break;
+#endif
+    default:
+        for (uint32_t y = first_row; y < end_row; y++) {
+            total_cells += scalar_run(&env->grid[(uint64_t)env->stride * y],
+                                      &env->_next_generation[(uint64_t)env->stride * y], offsets,
+                                      neighbourhood->size, &cell_type->rule, first_col, end_col, &difference);
+        }
+        break;
+    }
+
+    if (difference) *changed = true;
+    return total_cells;
+}
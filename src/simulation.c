@@ -0,0 +1,646 @@
+/**
+ * Contains the simulation thread, which calculates generations independently of the display.
+ *
+ * The thread owns the simulation while it runs: the display only reads the frames it publishes and queues commands
+ * for it. Frames are passed through a triple buffer, where the thread fills a back frame, swaps it with the middle one
+ * and marks it fresh, and the display swaps a fresh middle frame with the one it last drew. Neither side ever waits
+ * for the other. When generations are calculated faster than they are shown, a frame is only copied once the display
+ * has taken the last one, so the thread spends its time simulating rather than copying frames nobody sees. Only the
+ * part of the grid on screen is copied, and when zoomed out below a pixel per cell it is copied from the grid's
+ * density pyramid, which is only created once it is first needed. Each frame also lists the tiles of the grid which
+ * changed since the last frame the display took, so that the display only has to redraw those.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/profile.h"
+#include "../include/simulation.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Marks the middle frame of the triple buffer as published since the display last took it. */
+#define FRAME_FRESH 4u
+/** Selects the index of the middle frame of the triple buffer. */
+#define FRAME_INDEX 3u
+
+struct simulation {
+    SimulationSetup setup;                        /**< The simulation, owned by the thread until it stops. */
+    SimulationAnalytics *data;                    /**< The analytics of the environment or world simulated. */
+    CellType cell_type;                           /**< The cell type being simulated. */
+    bool playing;                                 /**< Whether generations are being calculated. */
+    int64_t view_x;                               /**< The x coordinate of the part of the grid or world shown. */
+    int64_t view_y;                               /**< The y coordinate of the part of the grid or world shown. */
+    uint32_t view_width;                          /**< The number of columns of cells shown. */
+    uint32_t view_height;                         /**< The number of rows of cells shown. */
+    unsigned int view_lod;                        /**< The level of detail shown. */
+    DensityPyramid *pyramid;                      /**< The density pyramid of the grid, or NULL until zoomed out. */
+    bool *recent;                                 /**< Whether each tile changed since the last frame published. */
+    bool *unseen;                                 /**< Whether each tile changed since the display's last frame. */
+    uint64_t serial;                              /**< The number of frames published. */
+    uint64_t unseen_since;                        /**< The frame `unseen` counts changes from. */
+    uint64_t due;                                 /**< When the next generation is due, in monotonic nanoseconds. */
+    uint64_t rate_start;                          /**< When the generation rate started being measured. */
+    uint64_t rate_generations;                    /**< The generations calculated since `rate_start`. */
+    SimulationFrame frames[3];                    /**< The triple buffer. */
+    unsigned int back;                            /**< The frame being filled by the thread. */
+    unsigned int front;                           /**< The frame being drawn by the display. */
+    _Atomic unsigned int middle;                  /**< The frame between them, and whether it is fresh. */
+    pthread_t thread;                             /**< The simulation thread. */
+    pthread_mutex_t lock;                         /**< Guards the command queue and `quit`. */
+    pthread_cond_t wake;                          /**< Signalled when a command is queued or the thread should quit. */
+    SimulationCommand queue[SIMULATION_QUEUE];    /**< Commands waiting for the thread. */
+    uint32_t queued;                              /**< The number of commands waiting. */
+    SimulationCommand applying[SIMULATION_QUEUE]; /**< The commands being applied by the thread. */
+    bool quit;                                    /**< Set to make the thread exit. */
+};
+
+/**
+ * Reads the monotonic clock.
+ * @return The time in nanoseconds
+ */
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * Plays or pauses the simulation. Playing starts the schedule and the measured generation rate over.
+ * @param sim The simulation
+ * @param playing Whether to play
+ */
+static void set_playing(Simulation *sim, bool playing) {
+    if (playing && !sim->playing) {
+        sim->due = now_ns();
+        sim->rate_start = sim->due;
+        sim->rate_generations = 0;
+    }
+    sim->playing = playing;
+    if (!playing) sim->data->generation_rate = 0;
+}
+
+/**
+ * Sets a cell in the bit-packed grid of a frame.
+ * @param context The SimulationFrame
+ * @param x The x coordinate of the cell in the world
+ * @param y The y coordinate of the cell in the world
+ */
+static void frame_set(void *context, int64_t x, int64_t y) {
+    SimulationFrame *frame = (SimulationFrame *)context;
+    uint64_t column = (uint64_t)(x - frame->x0);
+    frame->cells[(uint64_t)(y - frame->y0) * frame->row_words + column / 64] |= (uint64_t)1 << (column % 64);
+}
+
+/**
+ * Adds a cell to the density of its block in a frame, rounding up so that no living cell disappears.
+ * @param context The SimulationFrame
+ * @param x The x coordinate of the cell in the world
+ * @param y The y coordinate of the cell in the world
+ */
+static void frame_add(void *context, int64_t x, int64_t y) {
+    SimulationFrame *frame = (SimulationFrame *)context;
+    uint8_t *block = &frame->density[(uint64_t)((y - frame->y0) >> frame->lod) * frame->width +
+                                     (uint64_t)((x - frame->x0) >> frame->lod)];
+    unsigned int share = 255u >> (2 * frame->lod); // One cell of the block's 4^lod
+    unsigned int density = *block + (share == 0 ? 1u : share);
+    *block = (uint8_t)(density > 255 ? 255 : density);
+}
+
+/**
+ * Sizes a frame and makes room for its cells or densities.
+ * @param frame The frame
+ * @param x0 The x coordinate of the first column of cells
+ * @param y0 The y coordinate of the first row of cells
+ * @param width The number of columns of cells, or of blocks
+ * @param height The number of rows of cells, or of blocks
+ * @param lod The level of detail
+ */
+static void fit_frame(SimulationFrame *frame, int64_t x0, int64_t y0, uint32_t width, uint32_t height,
+                      unsigned int lod) {
+    frame->x0 = x0;
+    frame->y0 = y0;
+    frame->width = width;
+    frame->height = height;
+    frame->lod = lod;
+    frame->row_words = lod == 0 ? (width + 63) / 64 : 0;
+    size_t words = (size_t)frame->row_words * height;
+    if (frame->capacity < words) {
+        frame->cells = realloc(frame->cells, words * sizeof(uint64_t));
+        assert(frame->cells != NULL);
+        frame->capacity = words;
+    }
+    size_t blocks = lod == 0 ? 0 : (size_t)width * height;
+    if (frame->density_capacity < blocks) {
+        frame->density = realloc(frame->density, blocks);
+        assert(frame->density != NULL);
+        frame->density_capacity = blocks;
+    }
+}
+
+/**
+ * Copies the part of the unbounded world on screen into a frame.
+ * @param sim The simulation
+ * @param frame The frame
+ */
+static void publish_world(Simulation *sim, SimulationFrame *frame) {
+    unsigned int lod = sim->view_lod;
+    int64_t block = (int64_t)1 << lod;
+    int64_t left = sim->view_x >> lod, top = sim->view_y >> lod; // Rounded down to whole blocks
+    int64_t right = (sim->view_x + sim->view_width + block - 1) >> lod;
+    int64_t bottom = (sim->view_y + sim->view_height + block - 1) >> lod;
+    fit_frame(frame, left * block, top * block, (uint32_t)(right - left), (uint32_t)(bottom - top), lod);
+    if (lod == 0) {
+        memset(frame->cells, 0, (size_t)frame->row_words * frame->height * sizeof(uint64_t));
+    } else {
+        memset(frame->density, 0, (size_t)frame->width * frame->height);
+    }
+    world_visit(sim->setup.world, left * block, top * block, right * block, bottom * block,
+                lod == 0 ? frame_set : frame_add, frame);
+    frame->area = (uint64_t)sim->setup.world->chunk_count * CHUNK_SIZE * CHUNK_SIZE;
+    frame->hash = 0;
+}
+
+/**
+ * Copies the part of the grid on screen into a frame, cell by cell or from the density pyramid.
+ * @param sim The simulation
+ * @param frame The frame
+ */
+static void publish_grid(Simulation *sim, SimulationFrame *frame) {
+    Environment *env = sim->setup.env;
+    unsigned int lod = sim->view_lod;
+    frame->area = (uint64_t)env->width * env->height;
+    frame->hash = env->hash;
+
+    // The blocks on screen, clipped to the grid and starting on a word at level of detail 0
+    int64_t block = lod == 0 ? 64 : (int64_t)1 << lod;
+    int64_t left = sim->view_x > 0 ? sim->view_x / block * block : 0;
+    int64_t top = sim->view_y > 0 ? sim->view_y : 0;
+    int64_t right = sim->view_x + sim->view_width < env->width ? sim->view_x + sim->view_width : env->width;
+    int64_t bottom = sim->view_y + sim->view_height < env->height ? sim->view_y + sim->view_height : env->height;
+    if (right <= left || bottom <= top) {
+        fit_frame(frame, 0, 0, 0, 0, lod); // Nothing of the grid on screen
+        return;
+    }
+
+    if (lod == 0) {
+        fit_frame(frame, left, top, (uint32_t)(right - left), (uint32_t)(bottom - top), 0);
+        uint32_t first_word = (uint32_t)left / 64;
+        for (uint32_t y = 0; y < frame->height; y++) {
+            uint64_t *words = &frame->cells[(uint64_t)frame->row_words * y];
+            uint64_t row = (uint64_t)top + y;
+            if (!env->packed_stale) {
+                memcpy(words, &env->packed[env->row_words * row + first_word], frame->row_words * sizeof(uint64_t));
+                continue;
+            }
+            bool const *cells = &env->grid[env->stride * row]; // Packed here rather than packing the whole grid
+            for (uint32_t i = 0; i < frame->row_words; i++) {
+                uint32_t start = (first_word + i) * 64;
+                uint32_t end = start + 64 < env->width ? start + 64 : env->width;
+                uint64_t word = 0;
+                for (uint32_t x = start; x < end; x++)
+                    word |= (uint64_t)cells[x] << (x - start);
+                words[i] = word;
+            }
+        }
+        return;
+    }
+
+    if (sim->pyramid == NULL) sim->pyramid = pyramid_init(env); // The first time zoomed out
+    pyramid_update(sim->pyramid, env);
+    uint32_t level_width, level_height;
+    uint8_t const *level = pyramid_level(sim->pyramid, lod, &level_width, &level_height);
+    uint32_t first_col = (uint32_t)(left >> lod), first_row = (uint32_t)(top >> lod);
+    uint32_t end_col = (uint32_t)((right + block - 1) >> lod), end_row = (uint32_t)((bottom + block - 1) >> lod);
+    if (end_col > level_width) end_col = level_width;
+    if (end_row > level_height) end_row = level_height;
+    fit_frame(frame, left, (int64_t)first_row << lod, end_col - first_col, end_row - first_row, lod);
+    for (uint32_t y = 0; y < frame->height; y++)
+        memcpy(&frame->density[(uint64_t)frame->width * y], &level[(uint64_t)level_width * (first_row + y) + first_col],
+               frame->width);
+}
+
+/**
+ * Lists the tiles of the grid on screen which changed since the last frame the display took. When the last frame
+ * published has not been taken, the display is still drawing an older one, so its changes are kept in the list.
+ * @param sim The simulation
+ * @param frame The frame, already filled with the part of the grid on screen
+ * @param taken Whether the display took the last frame published
+ */
+static void list_changes(Simulation *sim, SimulationFrame *frame, bool taken) {
+    Environment *env = sim->setup.env;
+    size_t tiles = (size_t)env->tiles_x * env->tiles_y;
+    if (taken) {
+        memset(sim->unseen, false, tiles * sizeof(bool));
+        sim->unseen_since = sim->serial;
+    }
+    for (size_t i = 0; i < tiles; i++)
+        sim->unseen[i] |= sim->recent[i];
+    memset(sim->recent, false, tiles * sizeof(bool));
+
+    frame->since = sim->unseen_since;
+    frame->tiles_x = env->tiles_x;
+    frame->change_count = 0;
+    frame->all_changed = false;
+    if (frame->width == 0 || frame->height == 0) return;
+
+    // Only the tiles on screen are listed, since the display redraws everything when the view moves
+    uint64_t right = (uint64_t)frame->x0 + ((uint64_t)frame->width << frame->lod);
+    uint64_t bottom = (uint64_t)frame->y0 + ((uint64_t)frame->height << frame->lod);
+    uint32_t first_tx = (uint32_t)((uint64_t)frame->x0 / ENV_TILE_WIDTH);
+    uint32_t first_ty = (uint32_t)((uint64_t)frame->y0 / ENV_TILE_HEIGHT);
+    uint32_t end_tx = (uint32_t)((right + ENV_TILE_WIDTH - 1) / ENV_TILE_WIDTH);
+    uint32_t end_ty = (uint32_t)((bottom + ENV_TILE_HEIGHT - 1) / ENV_TILE_HEIGHT);
+    if (end_tx > env->tiles_x) end_tx = env->tiles_x;
+    if (end_ty > env->tiles_y) end_ty = env->tiles_y;
+    size_t shown = (size_t)(end_tx - first_tx) * (end_ty - first_ty);
+    if (frame->change_capacity < shown) {
+        frame->changes = realloc(frame->changes, shown * sizeof(uint32_t));
+        assert(frame->changes != NULL);
+        frame->change_capacity = shown;
+    }
+    for (uint32_t ty = first_ty; ty < end_ty; ty++) {
+        for (uint32_t tx = first_tx; tx < end_tx; tx++) {
+            uint32_t tile = ty * env->tiles_x + tx;
+            if (sim->unseen[tile]) frame->changes[frame->change_count++] = tile;
+        }
+    }
+    if (frame->change_count * 2 > shown) { // Cheaper to redraw everything than piece by piece
+        frame->change_count = 0;
+        frame->all_changed = true;
+    }
+}
+
+/**
+ * Copies the current generation into the back frame and swaps it into the middle of the triple buffer.
+ * @param sim The simulation
+ */
+static void publish(Simulation *sim) {
+    PROFILE_SCOPE(PROFILE_PUBLISH);
+    SimulationFrame *frame = &sim->frames[sim->back];
+    bool taken = !(atomic_load_explicit(&sim->middle, memory_order_acquire) & FRAME_FRESH);
+    if (sim->setup.world != NULL) {
+        publish_world(sim, frame);
+        frame->since = sim->serial;
+        frame->change_count = 0;
+        frame->all_changed = true; // The world is not divided into tiles
+    } else {
+        publish_grid(sim, frame);
+        list_changes(sim, frame, taken);
+    }
+    frame->serial = ++sim->serial;
+    if (frame->area == 0) frame->area = 1;
+    frame->data = *sim->data;
+    frame->cell_type = sim->cell_type;
+    frame->playing = sim->playing;
+
+    unsigned int previous = atomic_exchange_explicit(&sim->middle, sim->back | FRAME_FRESH, memory_order_acq_rel);
+    sim->back = previous & FRAME_INDEX;
+
+    // A display which has not taken the last frame is already due to wake for one
+    if (!(previous & FRAME_FRESH) && sim->setup.on_publish != NULL) sim->setup.on_publish(sim->setup.publish_context);
+}
+
+/**
+ * Collects the tiles of the grid which changed for the next frame, and into its density pyramid if it has one. The
+ * environment gathers the tiles changed by every generation and edit until they are collected, so steps of several
+ * generations lose none of them.
+ * @param sim The simulation
+ */
+static void mark_changes(Simulation *sim) {
+    Environment *env = sim->setup.env;
+    if (sim->pyramid != NULL) pyramid_mark(sim->pyramid, env);
+    for (size_t i = 0; i < (size_t)env->tiles_x * env->tiles_y; i++) {
+        sim->recent[i] |= env->tile_dirty[i];
+        env->tile_dirty[i] = false;
+    }
+}
+
+/**
+ * Checks whether the cell type is Conway's Game of Life, the only rule HashLife simulates.
+ * @param cell_type The cell type
+ * @return true if HashLife can simulate the cell type
+ */
+static bool hashlife_supports(CellType const *cell_type) {
+    return cell_type->rulestring != NULL && cell_type->neighbourhood == &MOORE &&
+           cell_type->rule.birth == NEIGHBOURS(3) && cell_type->rule.survive == (NEIGHBOURS(2) | NEIGHBOURS(3));
+}
+
+/**
+ * Moves through the history of the wrapping grid, calculating new generations when stepping forward past the newest.
+ * @param sim The simulation
+ * @param generations The number of generations to move, negative to go back
+ */
+static void rewind_history(Simulation *sim, int64_t generations) {
+    History *history = sim->setup.history;
+    Environment *env = sim->setup.env;
+    uint64_t generation = env->data.generations;
+    if (generations == -1) {
+        history_back(history, env);
+    } else if (generations < 0) {
+        history_seek(history, env, generation > (uint64_t)-generations ? generation - (uint64_t)-generations : 0);
+    } else if (generations > 1) {
+        history_seek(history, env, generation + (uint64_t)generations);
+    } else if (generations == 1 && !history_forward(history, env)) {
+        history_record(history, env); // Past the newest generation remembered, or edited
+        mark_changes(sim);
+        next_generation(env, &sim->cell_type);
+        history_record(history, env);
+    }
+}
+
+/**
+ * Applies a command from the display.
+ * @param sim The simulation
+ * @param command The command
+ * @return true if the command may have changed cells of the grid
+ */
+static bool apply(Simulation *sim, SimulationCommand const *command) {
+    PROFILE_SCOPE(PROFILE_COMMANDS);
+    Environment *env = sim->setup.env;
+    World *world = sim->setup.world;
+    bool edited = false;
+    switch (command->type) {
+    case SIMULATION_TOGGLE_PLAYING:
+        set_playing(sim, !sim->playing);
+        break;
+    case SIMULATION_SET_SPEED:
+        sim->data->generation_period = (uint32_t)command->value;
+        sim->due = now_ns(); // The new length counts from now
+        break;
+    case SIMULATION_CLEAR:
+        if (world != NULL)
+            world_clear(world);
+        else
+            env_clear(env);
+        edited = true;
+        break;
+    case SIMULATION_TOGGLE_CELL:
+        if (world != NULL)
+            world_toggle_cell(world, command->x, command->y);
+        else if (command->x >= 0 && command->y >= 0 && env_in_bounds(env, (uint32_t)command->x, (uint32_t)command->y))
+            env_toggle_cell(env, (uint32_t)command->x, (uint32_t)command->y);
+        edited = true;
+        break;
+    case SIMULATION_WRITE_CELL:
+        if (world != NULL)
+            world_write(world, command->x, command->y, command->value != 0);
+        else if (command->x >= 0 && command->y >= 0 && env_in_bounds(env, (uint32_t)command->x, (uint32_t)command->y))
+            env_write(env, (uint32_t)command->x, (uint32_t)command->y, command->value != 0);
+        edited = true;
+        break;
+    case SIMULATION_CELL_TYPE:
+        sim->cell_type = *command->cell_type;
+        break;
+    case SIMULATION_TOGGLE_PACKED:
+        env->packed_kernel = !env->packed_kernel;
+        break;
+    case SIMULATION_JUMP:
+        if (world == NULL && hashlife_supports(&sim->cell_type)) {
+            uint64_t generations = (uint64_t)1 << SIMULATION_JUMP_LOG2;
+            generations -= hashlife_jump(sim->setup.hashlife, env, generations);
+            step_generations(env, &sim->cell_type, generations); // Too close to the edges to jump the rest
+        }
+        edited = true;
+        break;
+    case SIMULATION_SAVE:
+        if (world == NULL && !checkpoint_save(env, &sim->cell_type, sim->setup.checkpoint_path, true))
+            printf("Could not write checkpoint '%s'.\n", sim->setup.checkpoint_path);
+        break;
+    case SIMULATION_REWIND:
+        if (sim->setup.history == NULL) break;
+        set_playing(sim, false);
+        rewind_history(sim, command->value);
+        edited = true;
+        break;
+    case SIMULATION_VIEW:
+        sim->view_x = command->x;
+        sim->view_y = command->y;
+        sim->view_width = command->width;
+        sim->view_height = command->height;
+        sim->view_lod = command->value < 0 ? 0 : (unsigned int)command->value;
+        if (sim->view_lod > PYRAMID_LEVELS) sim->view_lod = PYRAMID_LEVELS;
+        break;
+    }
+    return edited;
+}
+
+/**
+ * Calculates the next generation (or several, at max speed) and updates everything which follows the simulation.
+ * @param sim The simulation
+ */
+static void step(Simulation *sim) {
+    PROFILE_SCOPE(PROFILE_GENERATION);
+    Environment *env = sim->setup.env;
+    History *history = sim->setup.history;
+    CycleAction on_cycle = sim->setup.on_cycle;
+    bool was_stable = sim->data->period != 0;
+
+    if (history != NULL) history_record(history, env); // Starts over if the grid was edited
+    if (sim->setup.world != NULL) {
+        world_next_generation(sim->setup.world, &sim->cell_type);
+    } else if (was_stable && on_cycle == CYCLE_FAST_FORWARD) {
+        fast_forward(env, &sim->cell_type, (uint64_t)1 << SIMULATION_JUMP_LOG2); // Nothing new to see
+    } else if (sim->data->generation_period == 0 && (history == NULL || (uint64_t)env->width * env->height >=
+                                                                           TEMPORAL_MIN_CELLS)) {
+        step_generations(env, &sim->cell_type, TEMPORAL_BLOCK_DEPTH); // Large grids advance in blocks
+    } else {
+        next_generation(env, &sim->cell_type);
+    }
+    if (!was_stable && sim->data->period != 0 && on_cycle == CYCLE_PAUSE) set_playing(sim, false);
+    if (sim->setup.world == NULL) {
+        mark_changes(sim);
+        if (history != NULL) history_record(history, env);
+        if (sim->setup.checkpointer != NULL) checkpointer_update(sim->setup.checkpointer, env, &sim->cell_type);
+    }
+}
+
+/**
+ * Calculates every generation which has come due, on a fixed timestep so that generations shorter than the time it
+ * takes to wake up are still calculated at the rate asked for. Stops once the budget is spent, so commands and frames
+ * are never held up for long, and drops the generations it is behind by if it cannot keep up.
+ * @param sim The simulation
+ * @return true if any generation was calculated
+ */
+static bool run_due(Simulation *sim) {
+    uint64_t period = (uint64_t)sim->data->generation_period * 1000;
+    uint64_t start = now_ns();
+    uint64_t now = start;
+    bool stepped = false;
+    while (sim->playing && now >= sim->due && now - start < SIMULATION_BUDGET_US * 1000) {
+        uint64_t generations = sim->data->generations;
+        step(sim);
+        sim->rate_generations += sim->data->generations - generations;
+        sim->due += period;
+        stepped = true;
+        now = now_ns();
+    }
+    if (!sim->playing) return stepped;
+    if (now > sim->due + SIMULATION_BUDGET_US * 1000) sim->due = now; // Too far behind to catch up
+
+    if (now - sim->rate_start >= SIMULATION_RATE_WINDOW_US * 1000) {
+        sim->data->generation_rate = (double)sim->rate_generations * 1000000000 / (double)(now - sim->rate_start);
+        sim->rate_start = now;
+        sim->rate_generations = 0;
+    }
+    return stepped;
+}
+
+/**
+ * Main loop of the simulation thread: apply the commands queued, calculate the generations which are due, publish a
+ * frame if the display is ready for one, and sleep until there is something to do.
+ * @param arg The Simulation
+ * @return NULL
+ */
+static void *simulation_main(void *arg) {
+    Simulation *sim = (Simulation *)arg;
+    bool changed = false;
+    pthread_mutex_lock(&sim->lock);
+    while (!sim->quit) {
+
+        // Take the queued commands, and apply them without holding up the display
+        uint32_t count = sim->queued;
+        memcpy(sim->applying, sim->queue, count * sizeof(SimulationCommand));
+        sim->queued = 0;
+        pthread_mutex_unlock(&sim->lock);
+        bool edited = false;
+        for (uint32_t i = 0; i < count; i++)
+            edited |= apply(sim, &sim->applying[i]);
+        if (edited && sim->setup.world == NULL) mark_changes(sim);
+        changed |= count > 0;
+
+        changed |= run_due(sim);
+
+        // A frame is copied once the display has taken the last one, or before going to sleep
+        uint64_t now = now_ns();
+        bool idle = !sim->playing || now < sim->due;
+        bool taken = !(atomic_load_explicit(&sim->middle, memory_order_relaxed) & FRAME_FRESH);
+        if (changed && (idle || taken)) {
+            publish(sim);
+            changed = false;
+        }
+
+        pthread_mutex_lock(&sim->lock);
+        if (sim->queued > 0 || sim->quit || !idle) continue;
+        if (!sim->playing) {
+            pthread_cond_wait(&sim->wake, &sim->lock); // Nothing to do until the display sends a command
+            continue;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t nanoseconds = (uint64_t)deadline.tv_nsec + (sim->due - now);
+        deadline.tv_sec += (time_t)(nanoseconds / 1000000000);
+        deadline.tv_nsec = (long)(nanoseconds % 1000000000);
+        pthread_cond_timedwait(&sim->wake, &sim->lock, &deadline); // Until the next generation is due
+    }
+    pthread_mutex_unlock(&sim->lock);
+    return NULL;
+}
+
+/**
+ * Starts calculating generations on a new thread. The environment, world, history and checkpointer of the setup must
+ * not be touched by anything else until the simulation is stopped. The setup's `on_publish` is called at most once for
+ * each frame the display takes, so a display can sleep until it is called instead of polling for frames.
+ * @param setup The simulation to run
+ * @return The simulation, which must be stopped with simulation_stop
+ */
+Simulation *simulation_start(SimulationSetup const *setup) {
+    Simulation *sim = calloc(1, sizeof(Simulation));
+    assert(sim != NULL);
+    sim->setup = *setup;
+    sim->data = setup->world != NULL ? &setup->world->data : &setup->env->data;
+    sim->cell_type = setup->cell_type;
+    set_playing(sim, setup->playing);
+    sim->view_width = setup->view_width;
+    sim->view_height = setup->view_height;
+    if (setup->world == NULL) {
+        size_t tiles = (size_t)setup->env->tiles_x * setup->env->tiles_y;
+        sim->recent = calloc(tiles, sizeof(bool));
+        sim->unseen = calloc(tiles, sizeof(bool));
+        assert(sim->recent != NULL && sim->unseen != NULL);
+    }
+
+    // The display starts with a copy of the first generation
+    sim->back = 0;
+    atomic_init(&sim->middle, 1);
+    sim->front = 2;
+    publish(sim);
+
+    pthread_mutex_init(&sim->lock, NULL);
+    pthread_cond_init(&sim->wake, NULL);
+    int err = pthread_create(&sim->thread, NULL, simulation_main, sim);
+    assert(err == 0);
+    (void)err;
+    return sim;
+}
+
+/**
+ * Stops the simulation thread and frees its frames and density pyramid. The simulation's environment, world and so
+ * on are left to the caller.
+ * @param sim The simulation to stop
+ */
+void simulation_stop(Simulation *sim) {
+    pthread_mutex_lock(&sim->lock);
+    sim->quit = true;
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->lock);
+    pthread_join(sim->thread, NULL);
+    pthread_mutex_destroy(&sim->lock);
+    pthread_cond_destroy(&sim->wake);
+    for (unsigned int i = 0; i < 3; i++) {
+        free(sim->frames[i].cells);
+        free(sim->frames[i].density);
+        free(sim->frames[i].changes);
+    }
+    free(sim->recent);
+    free(sim->unseen);
+    if (sim->pyramid != NULL) pyramid_destroy(sim->pyramid);
+    free(sim);
+}
+
+/**
+ * Queues a command for the simulation thread.
+ * @param sim The simulation
+ * @param command The command
+ * @return true if the command was queued, false if the queue is full
+ */
+bool simulation_command(Simulation *sim, SimulationCommand const *command) {
+    pthread_mutex_lock(&sim->lock);
+    bool queued = sim->queued < SIMULATION_QUEUE;
+    if (queued) sim->queue[sim->queued++] = *command;
+    pthread_cond_signal(&sim->wake);
+    pthread_mutex_unlock(&sim->lock);
+    return queued;
+}
+
+/**
+ * Takes the latest frame published by the simulation thread. The frame stays valid and unchanged until the next call.
+ * Must only be called from one thread.
+ * @param sim The simulation
+ * @return The latest frame
+ */
+SimulationFrame const *simulation_frame(Simulation *sim) {
+    if (atomic_load_explicit(&sim->middle, memory_order_relaxed) & FRAME_FRESH) {
+        unsigned int previous = atomic_exchange_explicit(&sim->middle, sim->front, memory_order_acq_rel);
+        sim->front = previous & FRAME_INDEX;
+    }
+    return &sim->frames[sim->front];
+}
+
+/**
+ * Reads a cell of a frame.
+ * @param frame The frame
+ * @param x The x coordinate of the cell
+ * @param y The y coordinate of the cell
+ * @return true if the cell is alive (or any cell of its block, when zoomed out), false if not or outside the frame
+ */
+bool simulation_frame_cell(SimulationFrame const *frame, int64_t x, int64_t y) {
+    if (x < frame->x0 || y < frame->y0) return false;
+    uint64_t column = (uint64_t)(x - frame->x0) >> frame->lod, row = (uint64_t)(y - frame->y0) >> frame->lod;
+    if (column >= frame->width || row >= frame->height) return false;
+    if (frame->lod > 0) return frame->density[row * frame->width + column] != 0; // Any cell of the block
+    return (frame->cells[row * frame->row_words + column / 64] >> (column % 64)) & 1;
+}
@@ -0,0 +1,196 @@
+/**
+ * Contains a persistent pool of worker threads for splitting the simulation step into bands of rows. The threads are
+ * created once and sleep on a barrier between jobs, so running a job costs no thread creation and no locking beyond
+ * the one barrier which publishes it. Bands are claimed from a shared atomic counter, so threads which finish cheap
+ * bands early keep taking work from the ones stuck on expensive bands, and so they all run out of bands at about the
+ * same time: the calling thread waits out the last few bands by spinning on a count of the workers still running,
+ * rather than meeting them at a second barrier.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/workers.h"
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/** Per-thread startup information. */
+typedef struct {
+    WorkerPool *pool; /**< The pool the thread belongs to. */
+    unsigned int id;  /**< The worker number of the thread. */
+} WorkerInfo;
+
+struct worker_pool {
+    unsigned int count;             /**< The number of workers, including the thread calling workers_run. */
+    pthread_t threads[MAX_WORKERS]; /**< The background threads (workers 1 to count - 1). */
+    WorkerInfo info[MAX_WORKERS];   /**< Startup information for each background thread. */
+    pthread_barrier_t barrier;      /**< Barrier which all workers meet at to start each job. */
+    _Atomic unsigned int running;   /**< The background threads which have not finished the current job. */
+    BandJob job;                    /**< The job currently being run. */
+    void *context;                  /**< The context passed to the current job. */
+    uint32_t bands;                 /**< The number of bands in the current job. */
+    _Atomic uint32_t next_band;     /**< The next band which has not been claimed by a worker. */
+    bool quit;                      /**< Set to make the background threads exit. */
+};
+
+/**
+ * Claims and runs bands of the current job until none are left.
+ * @param pool The pool running the job
+ * @param worker The worker number of the calling thread
+ */
+static void run_bands(WorkerPool *pool, unsigned int worker) {
+    uint32_t band;
+    while ((band = atomic_fetch_add_explicit(&pool->next_band, 1, memory_order_relaxed)) < pool->bands) {
+        pool->job(pool->context, band, worker);
+    }
+}
+
+/**
+ * Main loop of each background thread: wait for a job, help run it, then report that it is finished. The job is not
+ * touched again until the next barrier, so the calling thread may replace it as soon as every worker has reported.
+ * @param arg The WorkerInfo of the thread
+ * @return NULL
+ */
+static void *worker_main(void *arg) {
+    WorkerInfo const *info = (WorkerInfo const *)arg;
+    WorkerPool *pool = info->pool;
+
+    while (true) {
+        pthread_barrier_wait(&pool->barrier); // Job published
+        if (pool->quit) break;
+        run_bands(pool, info->id);
+        atomic_fetch_sub_explicit(&pool->running, 1, memory_order_release); // Job complete
+    }
+    return NULL;
+}
+
+/**
+ * Creates a worker pool.
+ * @param count The number of workers, including the thread which will call workers_run. Clamped to [1, MAX_WORKERS].
+ * @return The worker pool
+ */
+WorkerPool *workers_init(unsigned int count) {
+    if (count < 1) count = 1;
+    if (count > MAX_WORKERS) count = MAX_WORKERS;
+
+    WorkerPool *pool = (WorkerPool *)malloc(sizeof(WorkerPool));
+    assert(pool != NULL);
+    pool->count = count;
+    pool->job = NULL;
+    pool->context = NULL;
+    pool->bands = 0;
+    pool->quit = false;
+    atomic_init(&pool->next_band, 0);
+    atomic_init(&pool->running, 0);
+
+    if (count > 1) {
+        int err = pthread_barrier_init(&pool->barrier, NULL, count);
+        assert(err == 0);
+        (void)err;
+    }
+    for (unsigned int i = 1; i < count; i++) {
+        pool->info[i] = (WorkerInfo){pool, i};
+        int err = pthread_create(&pool->threads[i], NULL, worker_main, &pool->info[i]);
+        assert(err == 0);
+        (void)err;
+    }
+    return pool;
+}
+
+/**
+ * Stops the background threads and frees the worker pool.
+ * @param pool The pool to be destroyed
+ */
+void workers_destroy(WorkerPool *pool) {
+    if (pool->count > 1) {
+        pool->quit = true;
+        pthread_barrier_wait(&pool->barrier);
+        for (unsigned int i = 1; i < pool->count; i++)
+            pthread_join(pool->threads[i], NULL);
+        pthread_barrier_destroy(&pool->barrier);
+    }
+    free(pool);
+}
+
+/**
+ * @param pool The worker pool
+ * @return The number of workers in the pool, including the calling thread
+ */
+unsigned int workers_count(WorkerPool const *pool) { return pool->count; }
+
+/**
+ * Counts the physical cores, which is the default number of workers. A second hardware thread on a core shares the
+ * core's caches and execution units with the first, so a worker on it only slows down the other worker's band. Falls
+ * back to the number of online logical processors where the cores cannot be told apart.
+ * @return The number of physical cores
+ */
+unsigned int workers_default_count(void) {
+#ifdef _WIN32
+    DWORD length = 0;
+    GetLogicalProcessorInformation(NULL, &length);
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION *processors = malloc(length);
+    unsigned int cores = 0;
+    if (processors != NULL && GetLogicalProcessorInformation(processors, &length)) {
+        for (DWORD i = 0; i < length / sizeof(*processors); i++)
+            cores += processors[i].Relationship == RelationProcessorCore;
+    }
+    free(processors);
+    if (cores > 0) return cores;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    // Each core is counted once, at the first logical processor of its siblings
+    long logical = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int cores = 0;
+    for (long cpu = 0; cpu < logical; cpu++) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%ld/topology/thread_siblings_list", cpu);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            cores = 0; // Not Linux, or processors are offline
+            break;
+        }
+        long first;
+        if (fscanf(file, "%ld", &first) == 1 && first == cpu) cores++;
+        fclose(file);
+    }
+    if (cores > 0) return cores;
+    return logical < 1 ? 1 : (unsigned int)logical;
+#endif
+}
+
+/**
+ * Runs a job over all of its bands on every worker in the pool, returning once all bands are complete. The calling
+ * thread takes part as worker 0.
+ * @param pool The worker pool
+ * @param job The job to run
+ * @param context The context passed to each invocation of the job
+ * @param bands The number of bands to split the job into
+ */
+void workers_run(WorkerPool *pool, BandJob job, void *context, uint32_t bands) {
+    pool->job = job;
+    pool->context = context;
+    pool->bands = bands;
+    atomic_store_explicit(&pool->next_band, 0, memory_order_relaxed);
+
+    if (pool->count == 1) {
+        run_bands(pool, 0);
+        return;
+    }
+
+    atomic_store_explicit(&pool->running, pool->count - 1, memory_order_relaxed);
+    pthread_barrier_wait(&pool->barrier); // Publish the job
+    run_bands(pool, 0);
+    while (atomic_load_explicit(&pool->running, memory_order_acquire) != 0)
+        sched_yield(); // Every band is claimed, so the others are finishing their last ones
+}
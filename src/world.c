@@ -0,0 +1,490 @@
+/**
+ * Contains a sparse, unbounded simulation world made of fixed-size chunks which are allocated as cells spread into
+ * them and freed once they empty out. Memory follows the living population instead of the area it spans, and only
+ * chunks around recent changes are recalculated each generation.
+ *
+ * Each chunk stores its cells with the same halo layout as an Environment, so the halo can be filled from the
+ * neighbouring chunks and the chunk stepped with the same kernels as the fixed-size grid. Space outside of the
+ * allocated chunks is always dead, so rules which give birth to cells without neighbours (B0) only apply inside them.
+ * @author Matteo Golin
+ * @version 1.0
+ */
+#include "../include/world.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** The distance between rows of a chunk's cells, including the halo. */
+#define CHUNK_STRIDE (CHUNK_SIZE + 2 * ENV_HALO)
+/** The number of cells in a chunk's storage, including the halo. */
+#define CHUNK_STORAGE (CHUNK_STRIDE * CHUNK_STRIDE)
+/** The offset of cell (0, 0) in a chunk's storage. */
+#define CHUNK_ORIGIN (CHUNK_STRIDE * ENV_HALO + ENV_HALO)
+/** The initial number of buckets in the chunk hash table (must be a power of 2). */
+#define INITIAL_BUCKETS 256
+
+/** A square of CHUNK_SIZE by CHUNK_SIZE cells. */
+struct chunk {
+    int64_t cx;                         /**< The x coordinate of the chunk, in chunks. */
+    int64_t cy;                         /**< The y coordinate of the chunk, in chunks. */
+    bool *cells;                        /**< The current cells, pointing at cell (0, 0) inside the halo. */
+    bool *next;                         /**< The cells of the next generation, laid out like `cells`. */
+    uint32_t population;                /**< The number of living cells in the chunk. */
+    bool changed;                       /**< Whether any cell changed in the last generation (or was edited). */
+    bool _next_changed;                 /**< Change flag for the generation being calculated. */
+    Chunk *around[9];                   /**< The 3x3 block of chunks centred on this one, NULL where unallocated. */
+    Chunk *next_in_bucket;              /**< The next chunk in the hash bucket or free list. */
+    bool storage[2][CHUNK_STORAGE];     /**< Cell storage for both generations. */
+};
+
+/** The partial results of a single worker, padded to a cache line so workers never share one. */
+typedef struct {
+    _Alignas(64) uint32_t total_cells; /**< The number of living cells counted by this worker. */
+} WorkerTally;
+
+/** Shared state of a generation step which is split into chunks across the worker pool. */
+typedef struct {
+    Chunk **chunks;                 /**< The chunks being stepped. */
+    CellType const *cell_type;      /**< The type of cell to calculate the next generation for. */
+    WorkerTally tally[MAX_WORKERS]; /**< Per-worker partial results, reduced after the step. */
+} ChunkJob;
+
+/* CHUNK STORAGE */
+
+/**
+ * @param coordinate A cell coordinate
+ * @return The coordinate of the chunk containing it
+ */
+static inline int64_t chunk_coordinate(int64_t coordinate) {
+    return coordinate >= 0 ? coordinate / CHUNK_SIZE : -((-coordinate - 1) / CHUNK_SIZE) - 1;
+}
+
+/**
+ * @param cx The x coordinate of a chunk
+ * @param cy The y coordinate of a chunk
+ * @param bucket_count The number of buckets in the hash table
+ * @return The bucket of the chunk
+ */
+static inline size_t chunk_bucket(int64_t cx, int64_t cy, size_t bucket_count) {
+    uint64_t hash = (uint64_t)cx * 0x9E3779B97F4A7C15ULL ^ (uint64_t)cy * 0xC2B2AE3D27D4EB4FULL;
+    return (size_t)(hash ^ (hash >> 32)) & (bucket_count - 1);
+}
+
+/**
+ * Finds an allocated chunk.
+ * @param world The world
+ * @param cx The x coordinate of the chunk
+ * @param cy The y coordinate of the chunk
+ * @return The chunk, or NULL if it is not allocated
+ */
+static Chunk *find_chunk(World const *world, int64_t cx, int64_t cy) {
+    for (Chunk *chunk = world->buckets[chunk_bucket(cx, cy, world->bucket_count)]; chunk != NULL;
+         chunk = chunk->next_in_bucket) {
+        if (chunk->cx == cx && chunk->cy == cy) return chunk;
+    }
+    return NULL;
+}
+
+/**
+ * Doubles the number of buckets in the chunk hash table.
+ * @param world The world
+ */
+static void grow_table(World *world) {
+    size_t bucket_count = world->bucket_count * 2;
+    Chunk **buckets = (Chunk **)calloc(bucket_count, sizeof(Chunk *));
+    assert(buckets != NULL);
+
+    for (size_t i = 0; i < world->bucket_count; i++) {
+        Chunk *chunk = world->buckets[i];
+        while (chunk != NULL) {
+            Chunk *next = chunk->next_in_bucket;
+            size_t bucket = chunk_bucket(chunk->cx, chunk->cy, bucket_count);
+            chunk->next_in_bucket = buckets[bucket];
+            buckets[bucket] = chunk;
+            chunk = next;
+        }
+    }
+    free(world->buckets);
+    world->buckets = buckets;
+    world->bucket_count = bucket_count;
+}
+
+/**
+ * Allocates an empty chunk.
+ * @param world The world
+ * @param cx The x coordinate of the chunk
+ * @param cy The y coordinate of the chunk
+ * @return The new chunk
+ */
+static Chunk *create_chunk(World *world, int64_t cx, int64_t cy) {
+    Chunk *chunk = world->free_chunks;
+    if (chunk != NULL) {
+        world->free_chunks = chunk->next_in_bucket;
+    } else {
+        chunk = (Chunk *)malloc(sizeof(Chunk));
+        assert(chunk != NULL);
+    }
+
+    memset(chunk->storage, 0, sizeof(chunk->storage));
+    chunk->cx = cx;
+    chunk->cy = cy;
+    chunk->cells = chunk->storage[0] + CHUNK_ORIGIN;
+    chunk->next = chunk->storage[1] + CHUNK_ORIGIN;
+    chunk->population = 0;
+    chunk->changed = false;
+    chunk->_next_changed = false;
+
+    size_t bucket = chunk_bucket(cx, cy, world->bucket_count);
+    chunk->next_in_bucket = world->buckets[bucket];
+    world->buckets[bucket] = chunk;
+    if (++world->chunk_count > world->bucket_count) grow_table(world);
+    return chunk;
+}
+
+/**
+ * Removes a chunk from the world, keeping its memory for reuse.
+ * @param world The world
+ * @param chunk The chunk to free
+ */
+static void free_chunk(World *world, Chunk *chunk) {
+    Chunk **link = &world->buckets[chunk_bucket(chunk->cx, chunk->cy, world->bucket_count)];
+    while (*link != chunk)
+        link = &(*link)->next_in_bucket;
+    *link = chunk->next_in_bucket;
+
+    chunk->next_in_bucket = world->free_chunks;
+    world->free_chunks = chunk;
+    world->chunk_count--;
+}
+
+/**
+ * Makes sure the list of chunks being stepped can hold a number of chunks.
+ * @param world The world
+ * @param capacity The number of chunks
+ */
+static void reserve_step_chunks(World *world, size_t capacity) {
+    if (capacity <= world->_step_capacity) return;
+    world->_step_capacity = capacity * 2;
+    world->_step_chunks = (Chunk **)realloc(world->_step_chunks, sizeof(Chunk *) * world->_step_capacity);
+    assert(world->_step_chunks != NULL);
+}
+
+/* WORLD CREATION */
+
+/**
+ * Creates an empty world.
+ * @param generation_period The length of each generation in microseconds
+ * @return The world
+ */
+World *world_init(uint32_t generation_period) {
+    World *world = (World *)malloc(sizeof(World));
+    assert(world != NULL);
+
+    world->bucket_count = INITIAL_BUCKETS;
+    world->buckets = (Chunk **)calloc(world->bucket_count, sizeof(Chunk *));
+    assert(world->buckets != NULL);
+    world->chunk_count = 0;
+    world->free_chunks = NULL;
+    world->_step_chunks = NULL;
+    world->_step_capacity = 0;
+    world->_step_signature = 0;
+    world->workers = workers_init(workers_default_count());
+
+    world->data.total_cells = 0;
+    world->data.initial_cells = 0;
+    world->data.generations = 0;
+    world->data.generation_period = generation_period;
+    world->data.generation_rate = 0;
+    world->data.stable_generation = 0;
+    world->data.period = 0; // Cycles are only detected on the fixed-size grid
+    return world;
+}
+
+/**
+ * Destroys a world.
+ * @param world The world to be freed
+ */
+void world_destroy(World *world) {
+    world_clear(world);
+    while (world->free_chunks != NULL) {
+        Chunk *next = world->free_chunks->next_in_bucket;
+        free(world->free_chunks);
+        world->free_chunks = next;
+    }
+    workers_destroy(world->workers);
+    free(world->_step_chunks);
+    free(world->buckets);
+    free(world);
+}
+
+/**
+ * Clear all cells from the world.
+ * @param world The world to be cleared
+ */
+void world_clear(World *world) {
+    for (size_t i = 0; i < world->bucket_count; i++) {
+        while (world->buckets[i] != NULL)
+            free_chunk(world, world->buckets[i]);
+    }
+
+    // Reset totals
+    world->data.initial_cells = 0;
+    world->data.total_cells = 0;
+    world->data.generations = 0;
+}
+
+/* WORLD ACCESS & MANIPULATION */
+
+/**
+ * @param world The world to be accessed
+ * @param x The x coordinate of the desired cell
+ * @param y The y coordinate of the desired cell
+ * @return The state of the cell at the provided coordinates
+ */
+bool world_access(World const *world, int64_t x, int64_t y) {
+    int64_t cx = chunk_coordinate(x), cy = chunk_coordinate(y);
+    Chunk const *chunk = find_chunk(world, cx, cy);
+    if (chunk == NULL) return false;
+    return chunk->cells[(y - cy * CHUNK_SIZE) * CHUNK_STRIDE + (x - cx * CHUNK_SIZE)];
+}
+
+/**
+ * Writes a value to the (x, y) coordinate in the world, allocating its chunk if needed.
+ * @param world The world to be modified
+ * @param x The x coordinate of the location to be modified
+ * @param y The y coordinate of the location to be modified
+ * @param value The value to be written to the (x, y) location
+ */
+void world_write(World *world, int64_t x, int64_t y, bool value) {
+    int64_t cx = chunk_coordinate(x), cy = chunk_coordinate(y);
+    Chunk *chunk = find_chunk(world, cx, cy);
+    if (chunk == NULL) {
+        if (!value) return;
+        chunk = create_chunk(world, cx, cy);
+    }
+
+    bool *cell = &chunk->cells[(y - cy * CHUNK_SIZE) * CHUNK_STRIDE + (x - cx * CHUNK_SIZE)];
+    if (*cell == value) return;
+    *cell = value;
+    chunk->population += value ? 1 : -1;
+    chunk->changed = true;
+}
+
+/**
+ * Toggles the cell at the coordinates.
+ * @param world The world in which to toggle the cell
+ * @param x The x location of the cell to be toggled
+ * @param y The y location of the cell to be toggled
+ * @return The new cell state
+ */
+bool world_toggle_cell(World *world, int64_t x, int64_t y) {
+    bool state = !world_access(world, x, y);
+    world_write(world, x, y, state);
+
+    // Update stats
+    if (state) {
+        world->data.initial_cells++;
+    } else {
+        world->data.initial_cells--;
+    }
+    return state;
+}
+
+/* SIMULATION */
+
+/**
+ * Fills the halo of a chunk with the edges of its neighbouring chunks (or dead cells where they are unallocated).
+ * @param chunk The chunk, with its `around` chunks resolved
+ */
+static void fill_halo(Chunk *chunk) {
+    for (int32_t y = -ENV_HALO; y < CHUNK_SIZE + ENV_HALO; y++) {
+        int32_t dy = y < 0 ? -1 : y >= CHUNK_SIZE ? 1 : 0;
+        for (int32_t x = -ENV_HALO; x < CHUNK_SIZE + ENV_HALO; x++) {
+            int32_t dx = x < 0 ? -1 : x >= CHUNK_SIZE ? 1 : 0;
+            if (dx == 0 && dy == 0) {
+                x = CHUNK_SIZE - 1; // Skip over the interior of the row
+                continue;
+            }
+
+            Chunk const *source = chunk->around[(dy + 1) * 3 + dx + 1];
+            int32_t source_index = (y - dy * CHUNK_SIZE) * CHUNK_STRIDE + (x - dx * CHUNK_SIZE);
+            chunk->cells[y * CHUNK_STRIDE + x] = source != NULL && source->cells[source_index];
+        }
+    }
+}
+
+/**
+ * Checks whether a chunk has living cells close enough to one of its edges or corners to affect the neighbouring chunk
+ * in that direction.
+ * @param chunk The chunk
+ * @param dx The horizontal direction of the neighbour (-1, 0 or 1)
+ * @param dy The vertical direction of the neighbour (-1, 0 or 1)
+ * @return true if a living cell is within ENV_HALO cells of the neighbour
+ */
+static bool edge_alive(Chunk const *chunk, int32_t dx, int32_t dy) {
+    int32_t first_x = dx > 0 ? CHUNK_SIZE - ENV_HALO : 0, end_x = dx < 0 ? ENV_HALO : CHUNK_SIZE;
+    int32_t first_y = dy > 0 ? CHUNK_SIZE - ENV_HALO : 0, end_y = dy < 0 ? ENV_HALO : CHUNK_SIZE;
+    for (int32_t y = first_y; y < end_y; y++) {
+        for (int32_t x = first_x; x < end_x; x++) {
+            if (chunk->cells[y * CHUNK_STRIDE + x]) return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Checks whether any cell could be born in an unallocated chunk, which needs living cells in the allocated chunks
+ * around it within reach of its edges. Without any, it stays empty and does not need to be allocated.
+ * @param world The world
+ * @param cx The x coordinate of the unallocated chunk
+ * @param cy The y coordinate of the unallocated chunk
+ * @return true if cells could be born in the chunk
+ */
+static bool border_alive(World const *world, int64_t cx, int64_t cy) {
+    for (int32_t dy = -1; dy <= 1; dy++) {
+        for (int32_t dx = -1; dx <= 1; dx++) {
+            Chunk const *neighbour = find_chunk(world, cx + dx, cy + dy);
+            if (neighbour != NULL && neighbour->population > 0 && edge_alive(neighbour, -dx, -dy)) return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Calculates the next generation of a single chunk, if it or one of its neighbours changed in the last generation.
+ * Otherwise its next generation is the same as its current one, which its next generation storage already holds from
+ * the generation before.
+ * @param context The ChunkJob
+ * @param index The index of the chunk to calculate
+ * @param worker The worker calculating the chunk
+ */
+static void chunk_band(void *context, uint32_t index, unsigned int worker) {
+    ChunkJob *job = (ChunkJob *)context;
+    Chunk *chunk = job->chunks[index];
+
+    bool active = false;
+    for (unsigned int i = 0; i < 9; i++)
+        active |= chunk->around[i] != NULL && chunk->around[i]->changed;
+
+    chunk->_next_changed = false;
+    if (active) {
+        fill_halo(chunk);
+
+        // View the chunk as an environment so it can be stepped with the same kernels
+        Environment view = {.width = CHUNK_SIZE, .height = CHUNK_SIZE, .stride = CHUNK_STRIDE};
+        view.grid = chunk->cells;
+        view._next_generation = chunk->next;
+        chunk->population =
+            step_block(&view, job->cell_type, 0, CHUNK_SIZE, 0, CHUNK_SIZE, &chunk->_next_changed);
+    }
+    job->tally[worker].total_cells += chunk->population;
+}
+
+/**
+ * Steps through one generation of the world, calculating the next one.
+ * @param world The world to update with the next generation
+ * @param cell_type The type of cell to calculate the next generation for
+ */
+void world_next_generation(World *world, CellType const *cell_type) {
+
+    world->data.generations++; // Increase generations
+
+    // A different rule invalidates everything learned about unchanged chunks
+    uint64_t signature = step_signature(cell_type, false);
+    bool rule_changed = signature != world->_step_signature;
+    world->_step_signature = signature;
+
+    // Gather the allocated chunks
+    size_t count = 0;
+    reserve_step_chunks(world, world->chunk_count);
+    for (size_t i = 0; i < world->bucket_count; i++) {
+        for (Chunk *chunk = world->buckets[i]; chunk != NULL; chunk = chunk->next_in_bucket) {
+            if (rule_changed) chunk->changed = true;
+            world->_step_chunks[count++] = chunk;
+        }
+    }
+
+    // Changes can spread into neighbouring chunks, so those must exist to be calculated if cells can be born in them
+    size_t allocated = count;
+    for (size_t i = 0; i < allocated; i++) {
+        Chunk const *chunk = world->_step_chunks[i];
+        if (!chunk->changed) continue;
+        for (int64_t dy = -1; dy <= 1; dy++) {
+            for (int64_t dx = -1; dx <= 1; dx++) {
+                int64_t cx = chunk->cx + dx, cy = chunk->cy + dy;
+                if (find_chunk(world, cx, cy) != NULL || !border_alive(world, cx, cy)) continue;
+                reserve_step_chunks(world, count + 1);
+                world->_step_chunks[count++] = create_chunk(world, cx, cy);
+            }
+        }
+    }
+
+    // Resolve the neighbours of every chunk up front so the workers never touch the hash table
+    for (size_t i = 0; i < count; i++) {
+        Chunk *chunk = world->_step_chunks[i];
+        for (int64_t dy = -1; dy <= 1; dy++) {
+            for (int64_t dx = -1; dx <= 1; dx++)
+                chunk->around[(dy + 1) * 3 + dx + 1] = find_chunk(world, chunk->cx + dx, chunk->cy + dy);
+        }
+    }
+
+    ChunkJob job = {.chunks = world->_step_chunks, .cell_type = cell_type};
+    workers_run(world->workers, chunk_band, &job, (uint32_t)count);
+
+    // Reduce the per-worker cell totals
+    world->data.total_cells = 0;
+    for (unsigned int i = 0; i < workers_count(world->workers); i++)
+        world->data.total_cells += job.tally[i].total_cells;
+
+    // Swap in the next generation, and free chunks which have been empty for a whole generation
+    for (size_t i = 0; i < count; i++) {
+        Chunk *chunk = world->_step_chunks[i];
+        bool *temp = chunk->cells;
+        chunk->cells = chunk->next;
+        chunk->next = temp;
+        chunk->changed = chunk->_next_changed;
+        if (chunk->population == 0 && !chunk->changed) free_chunk(world, chunk);
+    }
+}
+
+/**
+ * Calls a function for every living cell inside a rectangle of the world.
+ * @param world The world
+ * @param x0 The left edge of the rectangle
+ * @param y0 The top edge of the rectangle
+ * @param x1 One past the right edge of the rectangle
+ * @param y1 One past the bottom edge of the rectangle
+ * @param visitor The function to call with the coordinates of each living cell
+ * @param context Passed to the visitor
+ */
+void world_visit(World const *world, int64_t x0, int64_t y0, int64_t x1, int64_t y1, CellVisitor visitor,
+                 void *context) {
+    for (size_t i = 0; i < world->bucket_count; i++) {
+        for (Chunk const *chunk = world->buckets[i]; chunk != NULL; chunk = chunk->next_in_bucket) {
+            if (chunk->population == 0) continue;
+
+            // Clip the rectangle to the chunk
+            int64_t left = chunk->cx * CHUNK_SIZE, top = chunk->cy * CHUNK_SIZE;
+            int64_t start_x = x0 > left ? x0 : left, end_x = x1 < left + CHUNK_SIZE ? x1 : left + CHUNK_SIZE;
+            int64_t start_y = y0 > top ? y0 : top, end_y = y1 < top + CHUNK_SIZE ? y1 : top + CHUNK_SIZE;
+
+            for (int64_t y = start_y; y < end_y; y++) {
+                for (int64_t x = start_x; x < end_x; x++) {
+                    if (chunk->cells[(y - top) * CHUNK_STRIDE + (x - left)]) visitor(context, x, y);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Populates a string with the most recent simulation analytics of a world. The percentage alive is relative to the
+ * area of the allocated chunks.
+ * @param string Pointer to the string that will contain the analytics
+ * @param world The world to gather analytics on
+ * @param cell_type The cell type currently being used in the simulation
+ */
+void populate_world_analytics_string(char **string, World const *world, CellType const *cell_type) {
+    uint64_t area = (uint64_t)world->chunk_count * CHUNK_SIZE * CHUNK_SIZE;
+    format_analytics_string(string, &world->data, area == 0 ? 1 : area, cell_type);
+}